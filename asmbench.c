@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "assembler.h"
+
+#define BENCH_LINES 200000
+#define BENCH_REPS 20
+
+/**
+ * Assembler lookup microbenchmark. Times the mnemonic and register lookups
+ * for a generated program with the old strcmp chains ("before") and the
+ * perfect hashes ("after"), then the whole assemble() pass, all reported
+ * as source lines per second.
+ */
+
+static const char *benchMnemonics[] = {"add", "addi", "lw", "sw", "beq", "sll", "slt", "ori"};
+static const char *benchRegisters[] = {"t0", "t1", "s0", "s7", "sp", "ra", "a0", "zero"};
+
+/**
+ * The lookups as they were before the hashes, kept here for comparison
+ */
+static char chainGetInstruction(char *word, int *code) {
+   if (!strcmp(word, "and")) {
+      *code |= AND_CODE; return 'R';
+   } else if (!strcmp(word, "or")) {
+      *code |= OR_CODE; return 'R';
+   } else if (!strcmp(word, "ori")) {
+      *code |= ORI_CODE; return 'I';
+   } else if (!strcmp(word, "add")) {
+      *code |= ADD_CODE; return 'R';
+   } else if (!strcmp(word, "addu")) {
+      *code |= ADDU_CODE; return 'R';
+   } else if (!strcmp(word, "addi")) {
+      *code |= ADDI_CODE; return 'I';
+   } else if (!strcmp(word, "addiu")) {
+      *code |= ADDIU_CODE; return 'I';
+   } else if (!strcmp(word, "sll")) {
+      *code |= SLL_CODE; return 'S';
+   } else if (!strcmp(word, "srl")) {
+      *code |= SRL_CODE; return 'S';
+   } else if (!strcmp(word, "sra")) {
+      *code |= SRA_CODE; return 'S';
+   } else if (!strcmp(word, "sub")) {
+      *code |= SUB_CODE; return 'R';
+   } else if (!strcmp(word, "slt")) {
+      *code |= SLT_CODE; return 'R';
+   } else if (!strcmp(word, "slti")) {
+      *code |= SLTIU_CODE; return 'I';
+   } else if (!strcmp(word, "sltu")) {
+      *code |= SLTU_CODE; return 'R';
+   } else if (!strcmp(word, "sltiu")) {
+      *code |= SLTIU_CODE; return 'I';
+   } else if (!strcmp(word, "beq")) {
+      *code |= BEQ_CODE; return 'B';
+   } else if (!strcmp(word, "bne")) {
+      *code |= BNE_CODE; return 'B';
+   } else if (!strcmp(word, "lui")) {
+      *code |= LUI_CODE; return 'I';
+   } else if (!strcmp(word, "lw")) {
+      *code |= LW_CODE; return 'I';
+   } else if (!strcmp(word, "sw")) {
+      *code |= SW_CODE; return 'I';
+   } else if (!strcmp(word, "j")) {
+      *code |= J_CODE; return 'J';
+   } else if (!strcmp(word, "jr")) {
+      *code |= JR_CODE; return 'U';
+   } else if (!strcmp(word, "jal")) {
+      *code |= JAL_CODE; return 'J';
+   } else if (!strcmp(word, "syscall")) {
+      *code |= SYSCALL_CODE; return 'T';
+   }
+   return '\0';
+}
+
+static int chainGetRegisterNumber(char *reg) {
+   static const char *names[] = {"zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+    "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7", "s0", "s1", "s2", "s3", "s4",
+    "s5", "s6", "s7", "t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra"};
+   int num;
+
+   if (!strcmp(reg, "0"))
+      return 0;
+   for (num = 0; num < NUM_REGISTERS; num++) {
+      if (!strcmp(reg, names[num]))
+         return num;
+   }
+   return -1;
+}
+
+static double now(void) {
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *what, double secs, long lines) {
+   printf("%-26s %8.3f s %12.0f lines/s\n", what, secs, lines / secs);
+}
+
+int main(void) {
+   static line prog[BENCH_LINES];
+   char (*words)[4][8] = malloc(BENCH_LINES * sizeof(*words));
+   char *text = malloc(BENCH_LINES * 32), *p = text;
+   volatile int sink = 0;
+   symtab symbolTable;
+   double start;
+   int i, j, rep, code;
+
+   if (words == NULL || text == NULL) {
+      perror("malloc");
+      return 1;
+   }
+
+   srand(315);
+   for (i = 0; i < BENCH_LINES; i++) {
+      strcpy(words[i][0], benchMnemonics[rand() % 8]);
+      for (j = 1; j < 4; j++)
+         strcpy(words[i][j], benchRegisters[rand() % 8]);
+      p += sprintf(p, "\t%s $%s, $%s, $%s\n", words[i][0], words[i][1], words[i][2],
+       words[i][3]);
+   }
+
+   start = now();
+   for (rep = 0; rep < BENCH_REPS; rep++) {
+      for (i = 0; i < BENCH_LINES; i++) {
+         code = 0;
+         sink += chainGetInstruction(words[i][0], &code);
+         for (j = 1; j < 4; j++)
+            sink += chainGetRegisterNumber(words[i][j]);
+      }
+   }
+   report("lookups, strcmp chains", now() - start, (long) BENCH_LINES * BENCH_REPS);
+
+   start = now();
+   for (rep = 0; rep < BENCH_REPS; rep++) {
+      for (i = 0; i < BENCH_LINES; i++) {
+         code = 0;
+         sink += getInstruction(words[i][0], strlen(words[i][0]), &code);
+         for (j = 1; j < 4; j++)
+            sink += getRegisterNumber(words[i][j], strlen(words[i][j]));
+      }
+   }
+   report("lookups, perfect hash", now() - start, (long) BENCH_LINES * BENCH_REPS);
+
+   start = now();
+   for (rep = 0; rep < BENCH_REPS; rep++) {
+      symtabInit(&symbolTable);
+      sink += assemble(text, p - text, prog, BENCH_LINES, &symbolTable);
+      symtabFree(&symbolTable);
+   }
+   report("assemble()", now() - start, (long) BENCH_LINES * BENCH_REPS);
+
+   free(words);
+   free(text);
+   return 0;
+}
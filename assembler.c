@@ -1,303 +1,311 @@
 #include <stdio.h>
 #include <ctype.h>
+#include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "assembler.h"
+
+//Per thread, so batch runs can assemble several programs at once
+static _Thread_local line *assembledLines;
+static _Thread_local int progCap;
+static _Thread_local symtab *symbols;
+static _Thread_local fixup *fixups = NULL;
+static _Thread_local int numFixups = 0;
+static _Thread_local int fixupCap = 0;
+static _Thread_local int outOfMemory;   // a label reference could not be recorded
 
-#define NUM_LINES
-#define LINE_LENGTH 100
-#define WORD_SIZE 10
-#define INST_SIZE 32
-#define SYMBOL_TABLE_SIZE 500
-#define INITIAL_PC 0x400024
+/**
+ * Mnemonic and register names are looked up through perfect hashes: the
+ * hash functions below were picked so that every name gets its own slot,
+ * and the tables are filled in at compile time through the same macros,
+ * so a lookup is one hash and one compare. Mnemonics hash their first,
+ * second and last characters (folded to lower case) and length; register
+ * names are always two characters.
+ */
+#define FOLD(c) ((c) | 0x20)
+#define MNEMONIC_HASH(c0, c1, cl, len) \
+ ((FOLD(c0) + FOLD(c1) * 20 + FOLD(cl) * 11 + (len)) & 63)
+#define MNEMONIC(name, c0, c1, cl, opFormat, code) \
+ [MNEMONIC_HASH(c0, c1, cl, sizeof(name) - 1)] = {name, sizeof(name) - 1, opFormat, code}
+#define REGISTER_HASH(c0, c1) (((c0) * 9 + (c1)) & 127)
+#define REGISTER(c0, c1, num) [REGISTER_HASH(c0, c1)] = {c0, c1, num}
 
 typedef struct {
-   char symbol[40];
-   int loc;
-} symbolEntry;
-
-static symbolEntry symbolTable[SYMBOL_TABLE_SIZE];
-static int *assembledLines;
+   const char *name;
+   int len;
+   char opFormat;
+   int code;
+} mnemonic;
 
-int findInSymbolTable(char *symbol) {
+typedef struct {
+   char c0, c1;
+   int num;
+} registerName;
+
+static const mnemonic mnemonics[64] = {
+   MNEMONIC(".word", '.', 'w', 'd', 'W', 0),
+   MNEMONIC(".byte", '.', 'b', 'e', 'D', 0),
+   MNEMONIC("and", 'a', 'n', 'd', 'R', AND_CODE),
+   MNEMONIC("or", 'o', 'r', 'r', 'R', OR_CODE),
+   MNEMONIC("ori", 'o', 'r', 'i', 'I', ORI_CODE),
+   MNEMONIC("add", 'a', 'd', 'd', 'R', ADD_CODE),
+   MNEMONIC("addu", 'a', 'd', 'u', 'R', ADDU_CODE),
+   MNEMONIC("addi", 'a', 'd', 'i', 'I', ADDI_CODE),
+   MNEMONIC("addiu", 'a', 'd', 'u', 'I', ADDIU_CODE),
+   MNEMONIC("sll", 's', 'l', 'l', 'S', SLL_CODE),
+   MNEMONIC("srl", 's', 'r', 'l', 'S', SRL_CODE),
+   MNEMONIC("sra", 's', 'r', 'a', 'S', SRA_CODE),
+   MNEMONIC("sub", 's', 'u', 'b', 'R', SUB_CODE),
+   MNEMONIC("slt", 's', 'l', 't', 'R', SLT_CODE),
+   MNEMONIC("slti", 's', 'l', 'i', 'I', SLTIU_CODE),
+   MNEMONIC("sltu", 's', 'l', 'u', 'R', SLTU_CODE),
+   MNEMONIC("sltiu", 's', 'l', 'u', 'I', SLTIU_CODE),
+   MNEMONIC("beq", 'b', 'e', 'q', 'B', BEQ_CODE),
+   MNEMONIC("bne", 'b', 'n', 'e', 'B', BNE_CODE),
+   MNEMONIC("lui", 'l', 'u', 'i', 'I', LUI_CODE),
+   MNEMONIC("lw", 'l', 'w', 'w', 'I', LW_CODE),
+   MNEMONIC("sw", 's', 'w', 'w', 'I', SW_CODE),
+   MNEMONIC("j", 'j', 0, 'j', 'J', J_CODE),
+   MNEMONIC("jr", 'j', 'r', 'r', 'U', JR_CODE),
+   MNEMONIC("jal", 'j', 'a', 'l', 'J', JAL_CODE),
+   MNEMONIC("syscall", 's', 'y', 'l', 'T', SYSCALL_CODE),
+};
+
+static const registerName registerNames[128] = {
+   REGISTER('a', 't', 1),
+   REGISTER('v', '0', 2), REGISTER('v', '1', 3),
+   REGISTER('a', '0', 4), REGISTER('a', '1', 5), REGISTER('a', '2', 6), REGISTER('a', '3', 7),
+   REGISTER('t', '0', 8), REGISTER('t', '1', 9), REGISTER('t', '2', 10), REGISTER('t', '3', 11),
+   REGISTER('t', '4', 12), REGISTER('t', '5', 13), REGISTER('t', '6', 14), REGISTER('t', '7', 15),
+   REGISTER('s', '0', 16), REGISTER('s', '1', 17), REGISTER('s', '2', 18), REGISTER('s', '3', 19),
+   REGISTER('s', '4', 20), REGISTER('s', '5', 21), REGISTER('s', '6', 22), REGISTER('s', '7', 23),
+   REGISTER('t', '8', 24), REGISTER('t', '9', 25),
+   REGISTER('k', '0', 26), REGISTER('k', '1', 27),
+   REGISTER('g', 'p', 28), REGISTER('s', 'p', 29), REGISTER('f', 'p', 30), REGISTER('r', 'a', 31),
+};
+
+static int matchLower(const char *word, const char *name, int len) {
    int i;
 
-   for (i = 0; i < SYMBOL_TABLE_SIZE; i++) {
-      if (!strcmp(symbol, symbolTable[i].symbol))
-        return symbolTable[i].loc; 
+   for (i = 0; i < len; i++) {
+      if (tolower((unsigned char) word[i]) != name[i])
+         return 0;
    }
-   
-   return -1;
+   return 1;
 }
-int numSymbols = 0;
 
 /**
- * Check beginning of each line for symbol
+ * Split off the next operand: delimiters are whitespace, commas and ':'.
+ * Returns the token length, 0 at the end of the line.
  */
-int parseLineForSymbolTable(char *line, int numLines) {
-   const char *format = " \t,\n";
-   char *word, *end;
-   int len;
+static int nextToken(const char **pos, const char *end, const char **tok) {
+   const char *p = *pos, *start;
+
+   while (p < end && strchr(" \t\r,:", *p) != NULL)
+      p++;
+   start = p;
+   while (p < end && strchr(" \t\r,:", *p) == NULL)
+      p++;
+
+   *pos = p;
+   *tok = start;
+   return p - start;
+}
 
-   if (strlen(line) == 0) {
-      return 0;
-   }
-   
-   word = strtok(line, format);
-   if (word == NULL || strlen(word) == 0 || strchr(word, '#') != NULL) {
-      return 0;
+/**
+ * strtol() for a token that is not NUL terminated
+ */
+static long parseNumber(const char *word, int len, int base) {
+   long val = 0;
+   int i = 0, neg = 0, digit;
+
+   if (i < len && (word[i] == '-' || word[i] == '+'))
+      neg = word[i++] == '-';
+   if (base == 16 && i + 1 < len && word[i] == '0' && tolower((unsigned char) word[i + 1]) == 'x')
+      i += 2;
+
+   for (; i < len; i++) {
+      if (isdigit((unsigned char) word[i]))
+         digit = word[i] - '0';
+      else if (base == 16 && isxdigit((unsigned char) word[i]))
+         digit = tolower((unsigned char) word[i]) - 'a' + 10;
+      else
+         break;
+      val = val * base + digit;
    }
 
-   //Only need to check first word of line for symbol
-   if ((end = strchr(word, ':')) != NULL) {
-      *(end + 1) = '\0';
-      //printf("adding symbol: %s\n", word);
-      strcpy(symbolTable[numSymbols].symbol, word);
-      symbolTable[numSymbols].symbol[strlen(word) - 1] = '\0';
-      symbolTable[numSymbols].loc = (numLines) * 4 + INITIAL_PC;
-      numSymbols++;
+   return neg ? -val : val;
+}
+
+static int isHex(const char *word, int len) {
+   int i;
+
+   for (i = 0; i + 1 < len; i++) {
+      if (word[i] == '0' && word[i + 1] == 'x')
+         return 1;
    }
+   return 0;
+}
 
-   return 1;
+/**
+ * Parse an immediate the way the assembler always has: hex if the token
+ * has a 0x in it anywhere, otherwise decimal.
+ */
+static long parseImmediate(const char *word, int len) {
+   return parseNumber(word, len, isHex(word, len) ? 16 : 10);
 }
 
 /**
- * First Pass - check each line for a symbol
- * Return number of lines in file
+ * Whether an unresolved operand could be a label defined further down
  */
-int constructSymbolTable(FILE *code) {
-   char line[LINE_LENGTH];
-   int numLines = 0;
+static int isLabelName(const char *word, int len) {
+   if (!isalpha((unsigned char) word[0]) && word[0] != '_' && word[0] != '.')
+      return 0;
 
-   while (fgets(line, LINE_LENGTH, code)) {
-      if (parseLineForSymbolTable(line,  numLines))
-         numLines++;
-   }
-   
-   return numLines;
+   return memchr(word, '(', len) == NULL && memchr(word, ')', len) == NULL
+    && getRegisterNumber(word, len) == -1;
 }
 
 /**
- * Set the instruction op/function code for each instruction, and return type.
- * The S type is actually the R type, but for a shift command as the format is different.
+ * Look up a label operand. A label that is not defined yet gets a fixup so
+ * it is patched into curLine once the whole input has been read. When
+ * there is no memory for that, outOfMemory is set and the assemble fails.
  */
-char getInstruction(char *word, int *code) {
-   int i;
-   char opFormat = 0;
-
-   //Make word lowercase for matching
-   for (i = 0; word[i]; i++) {
-      word[i] = tolower(word[i]);
-      if (word[i] == '$')
-         word[i] = '\0';
+static symbolEntry *labelOperand(const char *word, int len, int curLine, int kind) {
+   symbolEntry *sym = symtabLookup(symbols, word, len);
+   fixup *grown;
+
+   if (sym != NULL && sym->defined)
+      return sym;
+   if (!isLabelName(word, len))
+      return NULL;
+
+   sym = symtabReference(symbols, word, len);
+   if (sym == NULL) {
+      outOfMemory = 1;
+      return NULL;
    }
 
-   //Begin matching
-   if (!strcmp(word, "and")) { //R
-      opFormat = 'R';
-      *code |= 0x24;
-   } else if (!strcmp(word, "or")) { //R
-      opFormat = 'R';
-      *code |= 0x25;
-   } else if (!strcmp(word, "add")) { //R
-      opFormat = 'R';
-      *code |= 0x20;
-   } else if (!strcmp(word, "addu")) { //R
-      opFormat = 'R';
-      *code |= 0x21;
-   } else if (!strcmp(word, "addi")) { //I
-      opFormat = 'I';
-      *code |= 0x08 << 26;
-   } else if (!strcmp(word, "addiu")) { //I
-      opFormat = 'I';
-      *code |= 0x09 << 26;
-   } else if (!strcmp(word, "sll")) { //S = R
-      opFormat = 'S';
-      *code |= 0;
-   } else if (!strcmp(word, "srl")) { //S = R
-      opFormat = 'S';
-      *code |= 0x02;
-   } else if (!strcmp(word, "sra")) { //R = R
-      opFormat = 'S';
-      *code |= 0x03;
-   } else if (!strcmp(word, "sub")) { //R
-      opFormat = 'R';
-      *code |= 0x22;
-   } else if (!strcmp(word, "slt")) { //R
-      opFormat = 'R';
-      *code |= 0x2a; 
-   } else if (!strcmp(word, "sltu")) { //R
-      opFormat = 'R';
-      *code |= 0x2b;
-   } else if (!strcmp(word, "sltiu")) { //I
-      opFormat = 'I';
-      *code |= 0x0b << 26;
-<<<<<<< HEAD
-   } else if (!strcmp(word, "beq")) { //B = I
-      opFormat = 'B';
-      *code |= 0x04 << 26;
-   } else if (!strcmp(word, "bne")) { //B = I
-=======
-   } else if (!strcmp(word, "beq")) { //I
-      opFormat = 'B';
-      *code |= 0x04 << 26;
-   } else if (!strcmp(word, "bne")) { //I
->>>>>>> da832aecbd63627e8b8d4f82fe64eece89341890
-      opFormat = 'B';
-      *code |= 0x05 << 26;
-   } else if (!strcmp(word, "lw")) { //I
-      opFormat = 'I';
-      *code |= 0x23 << 26;
-   } else if (!strcmp(word, "sw")) { //I
-      opFormat = 'I';
-      *code |= 0x2b << 26;
-   } else if (!strcmp(word, "j")) { //J
-      opFormat = 'J';
-      *code |= 0x02 << 26;
-   } else if (!strcmp(word, "jr")) { //R
-      opFormat = 'U';
-      *code |= 0x08;
-   } else if (!strcmp(word, "jal")) { //J
-      opFormat ='J';
-      *code |= 0x03 << 26;
-   } else {
-      opFormat = '\0';
+   if (numFixups == fixupCap) {
+      grown = realloc(fixups, (fixupCap ? fixupCap * 2 : 64) * sizeof(fixup));
+      if (grown == NULL) {
+         outOfMemory = 1;
+         return NULL;
+      }
+      fixups = grown;
+      fixupCap = fixupCap ? fixupCap * 2 : 64;
    }
+   fixups[numFixups].line = curLine;
+   fixups[numFixups].kind = kind;
+   fixups[numFixups].symbol = sym - symbols->entries;
+   numFixups++;
 
-   return opFormat;
+   return NULL;
 }
 
 /**
- * Trims comment from word, returns whether there was one
+ * Patch every forward reference whose label turned up later in the input
  */
-int trimComment(char *word) {
-   char *c = strchr(word, '#');
-
-   if (c != NULL) {
-      *c = '\0';
-      return 1;
+static void resolveFixups(void) {
+   symbolEntry *sym;
+   int i, curLine;
+
+   for (i = 0; i < numFixups; i++) {
+      sym = &symbols->entries[fixups[i].symbol];
+      curLine = fixups[i].line;
+      if (!sym->defined)
+         continue;
+      if (fixups[i].kind == FIXUP_REL16)
+         assembledLines[curLine].inst |= ((sym->loc - (curLine * 4 + INITIAL_PC )) / 4) & 0xFFFF;
+      else
+         assembledLines[curLine].inst |= sym->loc / 4;
    }
+}
 
-   return 0;
+/**
+ * Set the instruction op/function code for each instruction, and return type.
+ * The S type is actually the R type, but for a shift command as the format is different.
+ */
+char getInstruction(const char *word, int len, int *code) {
+   const mnemonic *m;
+
+   if (len == 0)
+      return '\0';
+
+   m = &mnemonics[MNEMONIC_HASH(word[0], len > 1 ? word[1] : 0, word[len - 1], len)];
+   if (m->len != len || !matchLower(word, m->name, len))
+      return '\0';
+
+   *code |= m->code;
+   return m->opFormat;
 }
 
 /**
- * Parse word to get register number
+ * Parse word to get register number: a name or number after '$' ($t0,
+ * $8), or a bare name (t0) as the assembler has always accepted.
  */
-int getRegisterNumber(char *reg) {
+int getRegisterNumber(const char *reg, int len) {
+   const registerName *r;
    int num;
 
-<<<<<<< HEAD
-=======
-   if (reg[strlen(reg) - 1] == ')')
-      reg[strlen(reg) - 1] = '\0';
-
->>>>>>> da832aecbd63627e8b8d4f82fe64eece89341890
-   if (!strcmp(reg, "zero") || !strcmp(reg, "0")) {
-      num = 0;
-   } else if (!strcmp(reg, "at")) {
-      num = 1;
-   } else if (!strcmp(reg, "v0")) {
-      num = 2; 
-   } else if (!strcmp(reg, "v1")) {
-      num = 3; 
-   } else if (!strcmp(reg, "a0")) {
-      num = 4;
-   } else if (!strcmp(reg, "a1")) {
-      num = 5;
-   } else if (!strcmp(reg, "a2")) {
-      num = 6;
-   } else if (!strcmp(reg, "a3")) {
-      num = 7;
-   } else if (!strcmp(reg, "t0")) {
-      num = 8;
-   } else if (!strcmp(reg, "t1")) {
-      num = 9;
-   } else if (!strcmp(reg, "t2")) {
-      num = 10;
-   } else if (!strcmp(reg, "t3")) {
-      num = 11;
-   } else if (!strcmp(reg, "t4")) {
-      num = 12;
-   } else if (!strcmp(reg, "t5")) {
-      num = 13;
-   } else if (!strcmp(reg, "t6")) {
-      num = 14;
-   } else if (!strcmp(reg, "t7")) {
-      num = 15;
-   } else if (!strcmp(reg, "s0")) {
-      num = 16;
-   } else if (!strcmp(reg, "s1")) {
-      num = 17;
-   } else if (!strcmp(reg, "s2")) {
-      num = 18;
-   } else if (!strcmp(reg, "s3")) {
-      num = 19;
-   } else if (!strcmp(reg, "s4")) {
-      num = 20;
-   } else if (!strcmp(reg, "s5")) {
-      num = 21;
-   } else if (!strcmp(reg, "s6")) {
-      num = 22;
-   } else if (!strcmp(reg, "s7")) {
-      num = 23;
-   } else if (!strcmp(reg, "t8")) {
-      num = 24;
-   } else if (!strcmp(reg, "t9")) {
-      num = 25;
-   } else if (!strcmp(reg, "k0")) {
-      num = 26;
-   } else if (!strcmp(reg, "k1")) {
-      num = 27;
-   } else if (!strcmp(reg, "gp")) {
-      num = 28;
-   } else if (!strcmp(reg, "sp")) {
-      num = 29;
-   } else if (!strcmp(reg, "fp")) {
-      num = 30;
-   } else if (!strcmp(reg, "ra")) {
-      num = 31;
-   } else {
-      num = -1;
+   if (len > 0 && reg[len - 1] == ')')
+      len--;
+
+   if (len > 1 && reg[0] == '$') {
+      reg++;
+      len--;
+      if (isdigit((unsigned char) reg[0])) {
+         if (len == 2 && isdigit((unsigned char) reg[1]) && reg[0] != '0')
+            num = (reg[0] - '0') * 10 + reg[1] - '0';
+         else if (len == 1)
+            num = reg[0] - '0';
+         else
+            return -1;
+         return num < NUM_REGISTERS ? num : -1;
+      }
+   }
+
+   if (len == 2) {
+      r = &registerNames[REGISTER_HASH(reg[0], reg[1])];
+      return r->c0 == reg[0] && r->c1 == reg[1] ? r->num : -1;
    }
+   if (len == 1)
+      return reg[0] == '0' ? 0 : -1;
+   if (len == 4)
+      return memcmp(reg, "zero", 4) ? -1 : 0;
 
-   return num;
+   return -1;
 }
 
 /**
- * General parsing of line
+ * General parsing of line, [line, end) with any comment already cut off.
+ * A first word ending in ':' defines a label at curLine. Returns the number
+ * of instructions emitted, or -1 when one would not fit in the program.
  */
-int parseLineGeneral(char *line, int curLine) {
-<<<<<<< HEAD
-   const char *format = " \t,\n$";
-=======
-   const char *format = " \t,\n$:";
-   const char *formatReg = " \t\n()";
->>>>>>> da832aecbd63627e8b8d4f82fe64eece89341890
-   char *word;
-   char *immediate;
-   char *regStr;
-   int code = 0, reg, instLoc = 0, isComment;
+int parseLineGeneral(const char *line, const char *end, int curLine) {
+   const char *pos = line, *word, *regStr, *paren;
+   int len, regLen;
+   int code = 0, type = 0, reg, instLoc = 0;
    char opFormat = 0;
-   char buffer[INST_SIZE];
-   int i = 0;
-   int setSymbol = 0;
    int jumpSymbol = 0;
-   
-
-   if (line == NULL || strlen(line) == 0)
-      return 0;
+   symbolEntry *sym;
 
-   if (line == NULL || strlen(line) == 0)
+   len = nextToken(&pos, end, &word);
+   if (len == 0)
       return 0;
+   if (pos < end && *pos == ':' && (line + strspn(line, " \t\r,")) == word)
+      symtabAdd(symbols, word, len, curLine * 4 + INITIAL_PC);
 
-   word = strtok(line, format);
-   while (word != NULL) {
-      isComment = trimComment(word);
-
-      if (opFormat == '\0') {
-         opFormat = getInstruction(word, &code);
+   for (; len != 0; len = nextToken(&pos, end, &word)) {
+      if (opFormat == '\0') { 
+         opFormat = getInstruction(word, len, &code);
+         type = code;
       } else if (opFormat == 'R') {
-         reg = getRegisterNumber(word); 
+         reg = getRegisterNumber(word, len); 
          if (reg != -1) {
             if (instLoc == 0) {
                code |= reg << 11; //rd
@@ -309,7 +317,7 @@ int parseLineGeneral(char *line, int curLine) {
          }
          instLoc++;
       } else if (opFormat == 'U') {
-         reg = getRegisterNumber(word); 
+         reg = getRegisterNumber(word, len); 
          if (reg != -1) {
             if (instLoc == 0) {
                code |= reg << 21; //rd
@@ -317,9 +325,9 @@ int parseLineGeneral(char *line, int curLine) {
          }
          instLoc++;
       } else if (opFormat == 'S') {
-         reg = getRegisterNumber(word); 
+         reg = getRegisterNumber(word, len); 
          if (instLoc == 2) {
-            code |= (strtol(word, NULL, 10) & 0x1F) << 6; //shamt
+            code |= (parseNumber(word, len, 10) & 0x1F) << 6; //shamt
          } else {
             if (reg != -1) {
                if (instLoc == 0) {
@@ -331,50 +339,41 @@ int parseLineGeneral(char *line, int curLine) {
          }
          instLoc++;
       } else if (opFormat == 'I') {
-         for (i = 0; i < numSymbols; i++) {
-            if (!strcmp(symbolTable[i].symbol, word)) {
-               code |= ((symbolTable[i].loc - (curLine * 4 + INITIAL_PC )) / 4) & 0xFFFF;
-               jumpSymbol = 1;
-            }
+         if ((sym = labelOperand(word, len, curLine, FIXUP_REL16)) != NULL) {
+            code |= ((sym->loc - (curLine * 4 + INITIAL_PC )) / 4) & 0xFFFF;
+            jumpSymbol = 1;
          }
-         if (instLoc == 2) {
-            if (strstr(word, "0x") != NULL)
-               code |= strtol(word, NULL, 16) & 0xFFFF;
-            else
-               code |= strtol(word, NULL, 10) & 0xFFFF; //and word so only 16 bytes are copied
+         if (instLoc == 2 || isHex(word, len)) {
+            code |= parseImmediate(word, len) & 0xFFFF; //and word so only 16 bytes are copied
+         } else if ((reg = getRegisterNumber(word, len)) != -1) {
+            if (instLoc == 0) {
+               code |= reg << 16;
+            }
+            else if (instLoc == 1) {
+               code |= reg << 21;
+            }
          } else {
-            reg = getRegisterNumber(word); 
+            // offset(base), the base may be split off by a space
+            code |= parseNumber(word, len, 10) & 0xFFFF;
+            if ((paren = memchr(word, '(', len)) != NULL && paren + 1 < word + len)
+               reg = getRegisterNumber(paren + 1, word + len - paren - 1);
+            else if ((regLen = nextToken(&pos, end, &regStr)) != 0)
+               reg = getRegisterNumber(regStr, regLen);
+            else
+               reg = -1;
             if (reg != -1) {
-               if (instLoc == 0) {
-                  code |= reg << 16;
-               }
-               else if (instLoc == 1) {
-                  code |= reg << 21;
-               }
+               code |= reg << 21;
             }
-            else {
-               code |= strtol(word, NULL, 10);
-               regStr = strtok(NULL, format);
-               if (regStr != NULL) {
-                  reg = getRegisterNumber(regStr);
-                  if (reg != -1) {
-                     code |= reg << 21;
-                  }
-               }
-            }
-               
          }
          instLoc++;
       } else if (opFormat == 'B') {
          if (instLoc == 2) {
-            for (i = 0; i < numSymbols; i++) {
-               if (!strcmp(symbolTable[i].symbol, word)) {
-                  code |= ((symbolTable[i].loc - (curLine * 4 + INITIAL_PC )) / 4) & 0xFFFF;
-                  jumpSymbol = 1;
-               }
+            if ((sym = labelOperand(word, len, curLine, FIXUP_REL16)) != NULL) {
+               code |= ((sym->loc - (curLine * 4 + INITIAL_PC )) / 4) & 0xFFFF;
+               jumpSymbol = 1;
             }
          } else {
-            reg = getRegisterNumber(word); 
+            reg = getRegisterNumber(word, len); 
             if (reg != -1) {
                if (instLoc == 0) {
                   code |= reg << 21;
@@ -384,12 +383,9 @@ int parseLineGeneral(char *line, int curLine) {
                }
             }
             else {
-               immediate = strtok(word, formatReg);
-               if (immediate != NULL)
-                  code |= strtol(immediate, NULL, 10);
-               regStr = strtok(NULL, formatReg);
-               if (regStr != NULL) {
-                  reg = getRegisterNumber(regStr);
+               code |= parseNumber(word, len, 10);
+               if ((paren = memchr(word, '(', len)) != NULL) {
+                  reg = getRegisterNumber(paren + 1, word + len - paren - 1);
                   if (reg != -1) {
                      code |= reg << 21;
                   }
@@ -397,64 +393,166 @@ int parseLineGeneral(char *line, int curLine) {
             }
          }
          instLoc++;
-      } else if (opFormat == 'B') {
-         if  (instLoc == 2) {
-            code |= (findInSymbolTable(word) - curLine) & 0xFFFF;
-         } else {
-            reg = getRegisterNumber(word); 
-            if (reg != -1) {
-               if (instLoc == 0)
-                  code |= reg << 21;
-               else if (instLoc == 1)
-                  code |= reg << 16;
-            }
-         }
-         instLoc++;
       } else if (opFormat == 'J') {
-         for (i = 0; i < numSymbols; i++) {
-            if (!strcmp(symbolTable[i].symbol, word)) {
-               code |= symbolTable[i].loc / 4;
-               jumpSymbol = 1;
-            }
+         if ((sym = labelOperand(word, len, curLine, FIXUP_ABS26)) != NULL) {
+            code |= sym->loc / 4;
+            jumpSymbol = 1;
          }
          if (jumpSymbol == 0) {
-            reg = getRegisterNumber(word);
+            reg = getRegisterNumber(word, len);
             if (reg != -1) {
                code |= (reg & 0x1F);
             }
-            else if (strstr(word, "0x") != NULL && !setSymbol) {
-               code |= (strtol(word, NULL, 16) & 0xFFFF) << 5;
-            }
             else {
-               code |= (strtol(word, NULL, 10) & 0xFFFF) << 5; //and word so only 16 bytes are copied
+               code |= (parseImmediate(word, len) & 0xFFFF) << 5; //and word so only 16 bytes are copied
             }  
          }
          jumpSymbol = 0;
+      } else {
+         // syscall takes no operands; .word and .byte data is not assembled
+         break;
       }
+   }
 
-      //Rest of line is comment
-      //Put this at the end because there may be no space between previous word and comment
-      if (isComment)
-         break;
+   if (code == 0 && opFormat != 'S')
+      return 0;
+   if (curLine >= progCap)
+      return -1;
+   assembledLines[curLine].type = type;
+   assembledLines[curLine].inst = code;
+   return 1;
+}
+
+/**
+ * Map a source file read-only, or slurp it when it cannot be mapped (stdin
+ * as "-", pipes). Returns 0, or -1 with errno set.
+ */
+int sourceOpen(const char *path, asmSource *src) {
+   struct stat st;
+   char *buf, *grown;
+   size_t cap = 65536;
+   ssize_t got = 0;
+   int fd;
+
+   src->text = NULL;
+   src->len = 0;
+   src->mapped = 0;
+
+   fd = strcmp(path, "-") ? open(path, O_RDONLY) : STDIN_FILENO;
+   if (fd < 0)
+      return -1;
+
+   if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (fd != STDIN_FILENO)
+         close(fd);
+      if (buf == MAP_FAILED)
+         return -1;
+      src->text = buf;
+      src->len = st.st_size;
+      src->mapped = 1;
+      return 0;
+   }
 
-      
-      word = strtok(NULL, format);
+   buf = malloc(cap);
+   while (buf != NULL && (got = read(fd, buf + src->len, cap - src->len)) > 0) {
+      src->len += got;
+      if (src->len == cap) {
+         grown = realloc(buf, cap *= 2);
+         if (grown == NULL)
+            free(buf);
+         buf = grown;
+      }
+   }
+   if (fd != STDIN_FILENO)
+      close(fd);
+   if (buf == NULL || got < 0) {
+      free(buf);
+      return -1;
    }
 
-   return 1;
+   src->text = buf;
+   return 0;
+}
+
+void sourceClose(asmSource *src) {
+   if (src->mapped)
+      munmap((void *) src->text, src->len);
+   else
+      free((void *) src->text);
+   src->text = NULL;
+   src->len = 0;
+   src->mapped = 0;
+}
+
+/**
+ * The most instructions [text, text + len) can assemble to, one per
+ * source line, for sizing the program before assembling it
+ */
+int sourceLineCount(const char *text, size_t len) {
+   const char *p = text, *end = text + len;
+   int count = 1;
+
+   while ((p = memchr(p, '\n', end - p)) != NULL) {
+      p++;
+      count++;
+   }
+   return count;
 }
 
 /**
- * Second pass - assemble the program
+ * Assemble the program in a single pass over the source text, lexing it in
+ * place with no copies or line length limit. Labels are defined as they are
+ * reached and forward references are patched at the end. Returns the
+ * number of lines, or -1 if the program does not fit in progSize lines or
+ * there was no memory to record its forward references (errno is ENOMEM).
  */
-int assemble(FILE *code) {
-   char line[LINE_LENGTH];
-   int curLine = 0;
+int assemble(const char *text, size_t len, line *prog, int progSize, symtab *symTable) {
+   return assembleMapped(text, len, prog, progSize, symTable, NULL);
+}
 
-   while (fgets(line, LINE_LENGTH, code)) {
-      if (parseLineGeneral(line, curLine))
-         curLine++;
+/**
+ * assemble, also filling sourceLines (when not NULL) with the 1-based
+ * source line each instruction came from
+ */
+int assembleMapped(const char *text, size_t len, line *prog, int progSize, symtab *symTable,
+ int *sourceLines) {
+   const char *p = text, *end = text + len, *eol, *hash;
+   int curLine = 0, srcLine = 0, added;
+
+   assembledLines = prog;
+   progCap = progSize;
+   symbols = symTable;
+   numFixups = 0;
+   outOfMemory = 0;
+
+   for (; p < end; p = eol + 1) {
+      if ((eol = memchr(p, '\n', end - p)) == NULL)
+         eol = end;
+      //Rest of line is comment
+      if ((hash = memchr(p, '#', eol - p)) == NULL)
+         hash = eol;
+      srcLine++;
+      if ((added = parseLineGeneral(p, hash, curLine)) < 0) {
+         curLine = -1;
+         break;
+      }
+      if (added && sourceLines != NULL)
+         sourceLines[curLine] = srcLine;
+      curLine += added;
    }
+
+   if (outOfMemory) {
+      errno = ENOMEM;
+      curLine = -1;
+   }
+   if (curLine >= 0)
+      resolveFixups();
+
+   free(fixups);
+   fixups = NULL;
+   fixupCap = 0;
+
    return curLine;
 }
 
@@ -462,32 +560,18 @@ void printAssembled(int numLines) {
    int i;
 
    for (i = 0; i < numLines; i++) {
-      printf("%08X\n", assembledLines[i]);
+      printf("%08X\n", assembledLines[i].inst);
    }
 }
 
 void printSymbolTable(int numLines) {
    int i;
 
-   for( i = 0; i < numLines; i++) {
-      if (strlen(symbolTable[i].symbol) != 0) {
-         printf("Symbol: %s @ line: %d\n", symbolTable[i].symbol, symbolTable[i].loc);
+   for( i = 0; i < numLines && i < symbols->count; i++) {
+      if (symbols->entries[i].defined) {
+         printf("Symbol: %s @ line: %d\n", symbols->entries[i].symbol,
+          symbols->entries[i].loc);
       }
    }
 }
-int main(int argc, char **argv) {
-   FILE *code;
-   int numLines = 0;
-
-   code = fopen(argv[1], "r");
-   
-   numLines = constructSymbolTable(code);
-   assembledLines = calloc(sizeof(int), numLines);
 
-   fclose(code);
-   code = fopen(argv[1], "r");
-   printAssembled(assemble(code));
-
-   free(assembledLines);
-   return 0;
-}
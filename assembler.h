@@ -1,44 +1,45 @@
 #ifndef ASSEMBLER_H
 #define ASSEMBLER_H
 
-#include <stdio.h>
+#include <stddef.h>
 #include "simulator.h"
+#include "symtab.h"
 
-#define LINE_LENGTH 100
-#define WORD_SIZE 10
-#define INST_SIZE 32
-#define SYMBOL_TABLE_SIZE 500
-#define INITIAL_PC 0
-#define PROG_SIZE 0x800000
+#define FIXUP_REL16 0   // branch/immediate offset from the referencing line
+#define FIXUP_ABS26 1   // jump target
 
 typedef struct {
-   char symbol[40];
-   int loc;
-} symbolEntry;
-
+   int line;
+   int kind;
+   int symbol;   // index into the symbol table entries
+} fixup;
+
+/**
+ * Assembler input: the whole source, mapped read-only when it is a regular
+ * file and read into a heap buffer otherwise.
+ */
 typedef struct {
-   int inst;
-   int type;
-} line;
-
-static symbolEntry symbolTable[SYMBOL_TABLE_SIZE];
-static line assembledLines[PROG_SIZE];
+   const char *text;
+   size_t len;
+   int mapped;
+} asmSource;
 
-static int numSymbols = 0;
+char getInstruction(const char *word, int len, int *code);
 
-int parseLineForSymbolTable(char *line, int numLines);
+int getRegisterNumber(const char *reg, int len);
 
-int constructSymbolTable(FILE *code);
+int parseLineGeneral(const char *line, const char *end, int curLine);
 
-char getInstruction(char *word, int *code);
+int sourceOpen(const char *path, asmSource *src);
 
-int trimComment(char *word);
+void sourceClose(asmSource *src);
 
-int getRegisterNumber(char *reg);
+int sourceLineCount(const char *text, size_t len);
 
-int parseLineGeneral(char *line, int curLine);
+int assemble(const char *text, size_t len, line *prog, int progSize, symtab *symTable);
 
-int assemble(FILE *code);
+int assembleMapped(const char *text, size_t len, line *prog, int progSize, symtab *symTable,
+ int *sourceLines);
 
 void printAssembled(int numLines);
 
@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "batch.h"
+#include "machine.h"
+#include "cache.h"
+
+/**
+ * A worker's share of the programs. The owner pops from the bottom and
+ * idle workers steal from the top, so a worker that drew short programs
+ * helps with the rest instead of sitting out the run. Jobs are whole
+ * programs, so a lock per deque costs nothing next to the work.
+ */
+typedef struct {
+   pthread_mutex_t lock;
+   int *jobs;
+   int top;
+   int bottom;
+} jobDeque;
+
+typedef struct {
+   int id;
+   pthread_t thread;
+} batchWorker;
+
+static const batchConfig *cfg;
+static batchResult *results;
+static jobDeque *deques;
+static int numWorkers;
+
+static int popJob(jobDeque *d) {
+   int job = -1;
+
+   pthread_mutex_lock(&d->lock);
+   if (d->bottom > d->top)
+      job = d->jobs[--d->bottom];
+   pthread_mutex_unlock(&d->lock);
+
+   return job;
+}
+
+static int stealJob(jobDeque *d) {
+   int job = -1;
+
+   pthread_mutex_lock(&d->lock);
+   if (d->bottom > d->top)
+      job = d->jobs[d->top++];
+   pthread_mutex_unlock(&d->lock);
+
+   return job;
+}
+
+/**
+ * Next program for worker id: its own first, then the other deques in
+ * turn. No jobs are added once the run starts, so finding every deque
+ * empty means the worker is done.
+ */
+static int nextJob(int id) {
+   int job, k;
+
+   if ((job = popJob(&deques[id])) >= 0)
+      return job;
+   for (k = 1; k < numWorkers; k++) {
+      if ((job = stealJob(&deques[(id + k) % numWorkers])) >= 0)
+         return job;
+   }
+
+   return -1;
+}
+
+/**
+ * Run one program to completion, counting the way the functional engine
+ * does
+ */
+static void runJob(machine *m, cacheHierarchy *caches, batchResult *res) {
+   streamRecord r;
+   long memRefs = 0, steps = 0;
+   int i = 0;
+
+   if ((res->status = machineLoad(m, res->path)) < 0) {
+      machineFree(m);
+      return;
+   }
+   res->status = 0;
+   if (cfg->l1i || cfg->l1d || cfg->l2)
+      cacheHierarchyInit(caches, cfg->l1i, cfg->l1d, cfg->l2, cfg->memLatency);
+
+   while (i < m->textLines && i >= 0 && (cfg->maxInsts < 0 || steps < cfg->maxInsts)) {
+      i = machineStep(m, &m->decodedLines[i], &memRefs, i, &r);
+      res->cycles += r.op.cycles;
+      if (cfg->l1i || cfg->l1d || cfg->l2) {
+         res->cycles += cacheHierarchyFetch(caches, r.pc);
+         if (r.op.handler == UOP_LW)
+            res->cycles += cacheHierarchyRead(caches, r.addr);
+         else if (r.op.handler == UOP_SW)
+            res->cycles += cacheHierarchyWrite(caches, r.addr);
+      }
+      if (i > 0)
+         res->instructions++;
+      steps++;
+   }
+   res->memRefs = memRefs;
+   memcpy(res->registers, m->registers, sizeof(res->registers));
+
+   cacheHierarchyFree(caches);
+   machineFree(m);
+}
+
+static void *workerMain(void *arg) {
+   batchWorker *w = arg;
+   cacheHierarchy caches;
+   machine *m = malloc(sizeof(machine));
+   int job;
+
+   if (m == NULL)
+      return NULL;
+   memset(&caches, 0, sizeof(caches));
+   while ((job = nextJob(w->id)) >= 0)
+      runJob(m, &caches, &results[job]);
+   free(m);
+
+   return NULL;
+}
+
+/**
+ * Append a copy of path to the program list. Returns 0, or -1 when there
+ * is no memory for it.
+ */
+static int addProgram(char ***programs, int *count, int *cap, const char *path) {
+   char **grown, *copy;
+
+   if (*count == *cap) {
+      if ((grown = realloc(*programs, (*cap ? *cap * 2 : 64) * sizeof(char *))) == NULL)
+         return -1;
+      *programs = grown;
+      *cap = *cap ? *cap * 2 : 64;
+   }
+   if ((copy = strdup(path)) == NULL)
+      return -1;
+   (*programs)[(*count)++] = copy;
+
+   return 0;
+}
+
+/**
+ * Append the programs named in list, one per line ('-' reads stdin).
+ * Blank lines and lines starting with # are skipped. Returns 0 or -1.
+ */
+static int readList(const char *list, char ***programs, int *count, int *cap) {
+   FILE *in = strcmp(list, "-") ? fopen(list, "r") : stdin;
+   char *buf = NULL, *p;
+   size_t bufSize = 0;
+   ssize_t len;
+   int err = 0;
+
+   if (in == NULL) {
+      perror(list);
+      return -1;
+   }
+   while (!err && (len = getline(&buf, &bufSize, in)) >= 0) {
+      while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == '\r'))
+         buf[--len] = '\0';
+      for (p = buf; *p == ' ' || *p == '\t'; p++)
+         ;
+      if (*p == '\0' || *p == '#')
+         continue;
+      if ((err = addProgram(programs, count, cap, p)) != 0)
+         perror("batch");
+   }
+   free(buf);
+   if (in != stdin)
+      fclose(in);
+
+   return err;
+}
+
+static void printResult(batchResult *res) {
+   static const char *errors[] = {"ok", "cannot read program", "no memory for program"};
+   int j;
+
+   if (cfg->json) {
+      printf("{\"program\": \"%s\", \"status\": \"%s\"", res->path, errors[-res->status]);
+      if (res->status == 0) {
+         printf(", \"instructions\": %ld, \"memory_references\": %ld, \"clock_cycles\": %ld",
+          res->instructions, res->memRefs, res->cycles);
+         if (!cfg->quiet) {
+            printf(", \"registers\": [");
+            for (j = 0; j < NUM_REGISTERS; j++)
+               printf("%s%d", j ? ", " : "", res->registers[j]);
+            printf("]");
+         }
+      }
+      printf("}\n");
+      return;
+   }
+
+   if (res->status != 0) {
+      printf("%s: %s\n", res->path, errors[-res->status]);
+      return;
+   }
+   printf("%s: %ld instructions, %ld memory references, %ld clock cycles\n", res->path,
+    res->instructions, res->memRefs, res->cycles);
+   for (j = 0; j < NUM_REGISTERS && !cfg->quiet; j++)
+      printf("%sR%d = %08X%s", j % 8 ? " " : "  ", j, res->registers[j],
+       j % 8 == 7 ? "\n" : "");
+}
+
+/**
+ * Run every program in list (NULL for none) and programs on a pool of
+ * cfg->jobs threads, then print one record per program in the order they
+ * were given. Returns 0 when they all ran, 1 when some could not be
+ * loaded and -1 for a bad list or configuration, or when the run could
+ * not be set up (no memory, no threads).
+ */
+int batchRun(const char *list, char **programs, int numPrograms, const batchConfig *config) {
+   batchWorker *workers;
+   cacheHierarchy check;
+   char **paths = NULL;
+   int count = 0, cap = 0, i, started, err = 0, failed = 0;
+
+   cfg = config;
+   if (cacheHierarchyInit(&check, cfg->l1i, cfg->l1d, cfg->l2, cfg->memLatency) != 0) {
+      cacheHierarchyFree(&check);
+      return -1;
+   }
+   cacheHierarchyFree(&check);
+   if (list != NULL && readList(list, &paths, &count, &cap) != 0)
+      err = -1;
+   for (i = 0; i < numPrograms && err == 0; i++) {
+      if ((err = addProgram(&paths, &count, &cap, programs[i])) != 0)
+         perror("batch");
+   }
+   if (err) {
+      for (i = 0; i < count; i++)
+         free(paths[i]);
+      free(paths);
+      return -1;
+   }
+
+   numWorkers = cfg->jobs > 0 ? cfg->jobs : (int) sysconf(_SC_NPROCESSORS_ONLN);
+   if (numWorkers < 1)
+      numWorkers = 1;
+   if (numWorkers > BATCH_MAX_JOBS)
+      numWorkers = BATCH_MAX_JOBS;
+   if (numWorkers > count)
+      numWorkers = count > 0 ? count : 1;
+
+   results = calloc(count > 0 ? count : 1, sizeof(batchResult));
+   deques = calloc(numWorkers, sizeof(jobDeque));
+   workers = calloc(numWorkers, sizeof(batchWorker));
+   err = results == NULL || deques == NULL || workers == NULL ? -1 : 0;
+   for (i = 0; i < numWorkers && deques != NULL; i++) {
+      pthread_mutex_init(&deques[i].lock, NULL);
+      if ((deques[i].jobs = malloc((count / numWorkers + 1) * sizeof(int))) == NULL)
+         err = -1;
+   }
+   if (err)
+      perror("batch");
+
+   if (!err) {
+      //Deal the programs out round robin; each deque pops its first program last
+      for (i = count - 1; i >= 0; i--) {
+         results[i].path = paths[i];
+         deques[i % numWorkers].jobs[deques[i % numWorkers].bottom++] = i;
+      }
+      //Only the threads that started are joined; a failed start abandons the run
+      for (started = 0; started < numWorkers; started++) {
+         workers[started].id = started;
+         if ((errno = pthread_create(&workers[started].thread, NULL, workerMain,
+          &workers[started])) != 0) {
+            perror("batch");
+            err = -1;
+            break;
+         }
+      }
+      for (i = 0; i < started; i++)
+         pthread_join(workers[i].thread, NULL);
+   }
+
+   for (i = 0; i < count; i++) {
+      if (!err) {
+         printResult(&results[i]);
+         failed |= results[i].status != 0;
+      }
+      free(paths[i]);
+   }
+   for (i = 0; i < numWorkers && deques != NULL; i++) {
+      pthread_mutex_destroy(&deques[i].lock);
+      free(deques[i].jobs);
+   }
+   free(deques);
+   free(workers);
+   free(results);
+   free(paths);
+
+   return err ? err : failed;
+}
@@ -0,0 +1,35 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "simulator.h"
+
+#define BATCH_MAX_JOBS 256
+
+/**
+ * What a batch run does with each program: the functional core with the
+ * fixed costs, plus the given caches (NULL specs for none), private to
+ * each program so results do not depend on scheduling
+ */
+typedef struct {
+   int jobs;          // worker threads, 0 for one per online CPU
+   long maxInsts;     // per-program instruction budget, -1 for no limit
+   int json;          // one JSON object per line instead of text
+   int quiet;         // leave the registers out of the records
+   const char *l1i;
+   const char *l1d;
+   const char *l2;
+   int memLatency;
+} batchConfig;
+
+typedef struct {
+   const char *path;
+   int status;        // 0, or the MACHINE_ERR code machineLoad gave
+   long instructions;
+   long memRefs;
+   long cycles;
+   int registers[NUM_REGISTERS];
+} batchResult;
+
+int batchRun(const char *list, char **programs, int numPrograms, const batchConfig *cfg);
+
+#endif
@@ -0,0 +1,219 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bpred.h"
+#include "stats.h"
+
+int bpredEnabled = 0;
+
+static bpredState bp;
+static const char *kindNames[BPRED_KINDS] = {"none", "nt", "btfn", "bimodal", "gshare"};
+
+/**
+ * Parse KIND[:ENTRIES[:HISTORY]]. ENTRIES sizes the bimodal and gshare
+ * counter tables and must be a power of two. Returns 0 or -1.
+ */
+int bpredStateInit(bpredState *b, const char *spec) {
+   char *end;
+   int i;
+
+   memset(b, 0, sizeof(*b));
+   b->entries = BPRED_TABLE_ENTRIES;
+   b->historyBits = BPRED_HISTORY_BITS;
+   for (i = 0; i < BPRED_BTB_ENTRIES; i++)
+      b->btb[i].line = -1;
+   if (spec == NULL)
+      return 0;
+
+   for (b->kind = 0; b->kind < BPRED_KINDS; b->kind++) {
+      i = strlen(kindNames[b->kind]);
+      if (!strncmp(spec, kindNames[b->kind], i) && (spec[i] == '\0' || spec[i] == ':'))
+         break;
+   }
+   if (b->kind == BPRED_KINDS)
+      return -1;
+   end = (char *) spec + i;
+   if (*end == ':')
+      b->entries = strtol(end + 1, &end, 10);
+   if (*end == ':')
+      b->historyBits = strtol(end + 1, &end, 10);
+   if (*end != '\0' || b->entries <= 0 || (b->entries & (b->entries - 1))
+    || b->historyBits < 0 || b->historyBits > 30)
+      return -1;
+
+   b->bimodal = malloc(b->entries);
+   b->gshare = malloc(b->entries);
+   if (b->bimodal == NULL || b->gshare == NULL)
+      return -1;
+   memset(b->bimodal, 1, b->entries);
+   memset(b->gshare, 1, b->entries);
+
+   return 0;
+}
+
+void bpredStateFree(bpredState *b) {
+   free(b->bimodal);
+   free(b->gshare);
+   b->bimodal = NULL;
+   b->gshare = NULL;
+}
+
+/**
+ * The predictor that steers the engines, from the command line
+ */
+int bpredInit(const char *spec) {
+   if (bpredStateInit(&bp, spec) != 0)
+      return -1;
+   bpredEnabled = spec != NULL;
+
+   return 0;
+}
+
+void bpredFree(void) {
+   bpredStateFree(&bp);
+   bpredEnabled = 0;
+}
+
+static unsigned char *counter(bpredState *b, unsigned char *table, int index) {
+   return &table[index & (b->entries - 1)];
+}
+
+static int gshareIndex(bpredState *b, int line) {
+   return line ^ (b->history & ((1u << b->historyBits) - 1));
+}
+
+static int predictDirection(bpredState *b, int kind, int line, int target) {
+   switch (kind) {
+   case BPRED_BTFN:
+      return target <= line;
+   case BPRED_BIMODAL:
+      return *counter(b, b->bimodal, line) >= 2;
+   case BPRED_GSHARE:
+      return *counter(b, b->gshare, gshareIndex(b, line)) >= 2;
+   }
+   return 0;
+}
+
+static void train(unsigned char *c, int taken) {
+   if (taken && *c < 3)
+      (*c)++;
+   else if (!taken && *c > 0)
+      (*c)--;
+}
+
+/**
+ * Next line to fetch after line. Calls push their return line here, at
+ * fetch, so a JR $ra right behind its JAL still finds it.
+ */
+int bpredStatePredict(bpredState *b, int line) {
+   btbEntry *e = &b->btb[line & (BPRED_BTB_ENTRIES - 1)];
+
+   if (b->kind == BPRED_NONE || e->line != line)
+      return line + 1;
+
+   switch (e->kind) {
+   case BRANCH_COND:
+      return predictDirection(b, b->kind, line, e->target) ? e->target : line + 1;
+   case BRANCH_CALL:
+      b->ras[b->rasTop++ % BPRED_RAS_DEPTH] = line + 1;
+      return e->target;
+   case BRANCH_RETURN:
+      if (b->rasTop > 0)
+         return b->ras[--b->rasTop % BPRED_RAS_DEPTH];
+      return e->target;
+   }
+   return e->target;
+}
+
+/**
+ * Train on a control instruction leaving EX. target is where it goes when
+ * taken, predicted is the line fetch went to after it and inFlight the
+ * younger instructions a redirect squashes. Returns 1 on a mispredict.
+ */
+int bpredStateResolve(bpredState *b, int line, int kind, int taken, int target, int predicted, int inFlight) {
+   btbEntry *e = &b->btb[line & (BPRED_BTB_ENTRIES - 1)];
+   int k, mispredict = predicted != (taken ? target : line + 1);
+
+   b->control++;
+   if (mispredict) {
+      b->mispredicts++;
+      b->cyclesSaved -= inFlight;
+      b->flushesAvoided--;
+   }
+   if (taken) {
+      b->cyclesSaved += inFlight;
+      b->flushesAvoided++;
+   }
+
+   if (kind == BRANCH_COND) {
+      b->conditional++;
+      for (k = BPRED_NT; k < BPRED_KINDS; k++)
+         b->directionCorrect[k] += predictDirection(b, k, line, target) == taken;
+      train(counter(b, b->bimodal, line), taken);
+      train(counter(b, b->gshare, gshareIndex(b, line)), taken);
+      b->history = (b->history << 1) | taken;
+   }
+
+   e->line = line;
+   e->target = target;
+   e->kind = kind;
+
+   return mispredict;
+}
+
+static double percent(long part, long whole) {
+   return whole ? 100.0 * part / whole : 0.0;
+}
+
+void bpredStatePrintStats(bpredState *b, FILE *out) {
+   int k;
+
+   fprintf(out, "bpred %s: %ld control, %ld mispredicts (%.2f%% correct), "
+    "%ld flushes avoided, %ld cycles saved\n", kindNames[b->kind], b->control,
+    b->mispredicts, percent(b->control - b->mispredicts, b->control),
+    b->flushesAvoided, b->cyclesSaved);
+   fprintf(out, "bpred direction on %ld conditional:", b->conditional);
+   for (k = BPRED_NT; k < BPRED_KINDS; k++)
+      fprintf(out, " %s %.2f%%", kindNames[k], percent(b->directionCorrect[k], b->conditional));
+   fprintf(out, "\n");
+}
+
+/**
+ * Print the counters as a JSON object member, leading comma included
+ */
+void bpredStatePrintStatsJson(bpredState *b, FILE *out) {
+   int k;
+
+   fprintf(out, ", \"bpred\": {\"predictor\": \"%s\", \"control\": %ld, \"mispredicts\": %ld, "
+    "\"flushes_avoided\": %ld, \"cycles_saved\": %ld, \"conditional\": %ld, "
+    "\"direction_correct\": {", kindNames[b->kind], b->control, b->mispredicts,
+    b->flushesAvoided, b->cyclesSaved, b->conditional);
+   for (k = BPRED_NT; k < BPRED_KINDS; k++)
+      fprintf(out, "%s\"%s\": %ld", k > BPRED_NT ? ", " : "", kindNames[k],
+       b->directionCorrect[k]);
+   fprintf(out, "}}");
+}
+
+int bpredPredict(int line) {
+   return bpredStatePredict(&bp, line);
+}
+
+int bpredResolve(int line, int kind, int taken, int target, int predicted, int inFlight) {
+   return bpredStateResolve(&bp, line, kind, taken, target, predicted, inFlight);
+}
+
+void bpredPrintStats(FILE *out) {
+   bpredStatePrintStats(&bp, out);
+}
+
+/**
+ * Copy the shared predictor's counters into the stats registry
+ */
+void bpredPublishStats(void) {
+   statsSet("bpred.control", bp.control);
+   statsSet("bpred.mispredicts", bp.mispredicts);
+   statsSet("bpred.conditional", bp.conditional);
+}
+
+void bpredPrintStatsJson(FILE *out) {
+   bpredStatePrintStatsJson(&bp, out);
+}
@@ -0,0 +1,87 @@
+#ifndef BPRED_H
+#define BPRED_H
+
+#include <stdio.h>
+
+#define BPRED_NONE 0
+#define BPRED_NT 1
+#define BPRED_BTFN 2
+#define BPRED_BIMODAL 3
+#define BPRED_GSHARE 4
+#define BPRED_KINDS 5
+
+// What a resolved instruction was, as far as the BTB cares
+#define BRANCH_COND 0
+#define BRANCH_JUMP 1
+#define BRANCH_CALL 2
+#define BRANCH_RETURN 3
+#define BRANCH_INDIRECT 4
+
+#define BPRED_TABLE_ENTRIES 4096
+#define BPRED_HISTORY_BITS 12
+#define BPRED_BTB_ENTRIES 512
+#define BPRED_RAS_DEPTH 16
+
+typedef struct {
+   int line;       // instruction this entry is for, -1 when empty
+   int target;
+   int kind;
+} btbEntry;
+
+/**
+ * Branch predictor for the pipeline's fetch stage. Predictions are next
+ * line indices: the BTB says whether a line is a control instruction and
+ * where it goes, the direction predictor picks taken or not for
+ * conditional branches and the return address stack supplies JR $ra
+ * targets. The predictor given on the command line steers fetch; every
+ * direction predictor is also scored on each conditional branch so one
+ * run compares them all.
+ */
+typedef struct {
+   int kind;
+   int entries;
+   int historyBits;
+   unsigned char *bimodal;   // 2-bit counters
+   unsigned char *gshare;
+   unsigned int history;
+   btbEntry btb[BPRED_BTB_ENTRIES];
+   int ras[BPRED_RAS_DEPTH];
+   int rasTop;               // entries pushed, wraps over the oldest
+   long control;             // control instructions resolved
+   long mispredicts;         // resolved with a wrong next line
+   long flushesAvoided;      // taken transfers fetched down the right path
+   long cyclesSaved;         // squashed slots a no-predictor pipeline would add
+   long conditional;
+   long directionCorrect[BPRED_KINDS];
+} bpredState;
+
+extern int bpredEnabled;
+
+int bpredStateInit(bpredState *b, const char *spec);
+
+void bpredStateFree(bpredState *b);
+
+int bpredStatePredict(bpredState *b, int line);
+
+int bpredStateResolve(bpredState *b, int line, int kind, int taken, int target, int predicted,
+ int inFlight);
+
+void bpredStatePrintStats(bpredState *b, FILE *out);
+
+void bpredStatePrintStatsJson(bpredState *b, FILE *out);
+
+int bpredInit(const char *spec);
+
+void bpredFree(void);
+
+int bpredPredict(int line);
+
+int bpredResolve(int line, int kind, int taken, int target, int predicted, int inFlight);
+
+void bpredPrintStats(FILE *out);
+
+void bpredPrintStatsJson(FILE *out);
+
+void bpredPublishStats(void);
+
+#endif
@@ -0,0 +1,340 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cache.h"
+#include "stats.h"
+
+int cacheEnabled = 0;
+
+static cacheHierarchy caches = {.memLatency = CACHE_MEM_LATENCY};
+
+static int log2i(int n) {
+   int bits = 0;
+
+   while ((1 << bits) < n)
+      bits++;
+
+   return (1 << bits) == n ? bits : -1;
+}
+
+/**
+ * Parse SIZE:ASSOC:LINE[:lru|plru|random[:wb|wt[:LATENCY]]], SIZE may end
+ * in k or m. Everything must be a power of two. Only the L2 is ever
+ * reached by a miss, so LATENCY is refused unless refill says c is one.
+ * Returns 0 or -1.
+ */
+static int cacheConfigure(cache *c, const char *name, const char *spec, int refill) {
+   char *end;
+
+   memset(c, 0, sizeof(*c));
+   c->name = name;
+   c->writeBack = 1;
+   c->latency = CACHE_L2_LATENCY;
+   c->seed = 0x9E3779B9;
+
+   c->size = strtol(spec, &end, 10);
+   if (*end == 'k' || *end == 'K')
+      c->size <<= 10, end++;
+   else if (*end == 'm' || *end == 'M')
+      c->size <<= 20, end++;
+   if (*end++ != ':')
+      return -1;
+   c->assoc = strtol(end, &end, 10);
+   if (*end++ != ':')
+      return -1;
+   c->lineSize = strtol(end, &end, 10);
+
+   if (*end == ':') {
+      end++;
+      if (!strncmp(end, "lru", 3))
+         c->policy = CACHE_LRU, end += 3;
+      else if (!strncmp(end, "plru", 4))
+         c->policy = CACHE_PLRU, end += 4;
+      else if (!strncmp(end, "random", 6))
+         c->policy = CACHE_RANDOM, end += 6;
+      else
+         return -1;
+   }
+   if (*end == ':') {
+      end++;
+      if (!strncmp(end, "wb", 2))
+         c->writeBack = 1;
+      else if (!strncmp(end, "wt", 2))
+         c->writeBack = 0;
+      else
+         return -1;
+      end += 2;
+   }
+   if (*end == ':') {
+      if (!refill)
+         return -1;
+      c->latency = strtol(end + 1, &end, 10);
+   }
+   if (*end != '\0' || c->latency < 0)
+      return -1;
+
+   if (c->assoc <= 0 || c->assoc > 32 || log2i(c->assoc) < 0 || c->lineSize < 4
+    || (c->offsetBits = log2i(c->lineSize)) < 0 || log2i(c->size) < 0
+    || c->size < c->assoc * c->lineSize)
+      return -1;
+   c->sets = c->size / (c->assoc * c->lineSize);
+   c->setBits = log2i(c->sets);
+
+   c->lines = calloc((size_t) c->sets * c->assoc, sizeof(cacheLine));
+   c->plru = calloc(c->sets, sizeof(unsigned int));
+   if (c->lines == NULL || c->plru == NULL)
+      return -1;
+
+   return 0;
+}
+
+/**
+ * Set up the levels given, NULL leaves one out. The L1 caches miss to the
+ * L2 when there is one, otherwise to memory. Returns 0 or -1.
+ */
+int cacheHierarchyInit(cacheHierarchy *h, const char *l1iSpec, const char *l1dSpec,
+ const char *l2Spec, int latency) {
+   const char *specs[] = {l1iSpec, l1dSpec, l2Spec};
+   const char *names[] = {"l1i", "l1d", "l2"};
+   cache *levels[] = {&h->l1i, &h->l1d, &h->l2};
+   int i;
+
+   memset(h, 0, sizeof(*h));
+   h->memLatency = latency;
+   for (i = 0; i < 3; i++) {
+      if (specs[i] != NULL
+       && cacheConfigure(levels[i], names[i], specs[i], levels[i] == &h->l2) != 0)
+         return -1;
+   }
+
+   if (l2Spec != NULL) {
+      h->l1i.next = &h->l2;
+      h->l1d.next = &h->l2;
+   }
+
+   return 0;
+}
+
+void cacheHierarchyFree(cacheHierarchy *h) {
+   cache *levels[] = {&h->l1i, &h->l1d, &h->l2};
+   int i;
+
+   for (i = 0; i < 3; i++) {
+      free(levels[i]->lines);
+      free(levels[i]->plru);
+      memset(levels[i], 0, sizeof(cache));
+   }
+}
+
+/**
+ * The hierarchy the engines share, from the command line
+ */
+int cacheInit(const char *l1iSpec, const char *l1dSpec, const char *l2Spec, int latency) {
+   if (cacheHierarchyInit(&caches, l1iSpec, l1dSpec, l2Spec, latency) != 0)
+      return -1;
+   cacheEnabled = l1iSpec != NULL || l1dSpec != NULL || l2Spec != NULL;
+
+   return 0;
+}
+
+void cacheFree(void) {
+   cacheHierarchyFree(&caches);
+   cacheEnabled = 0;
+}
+
+/**
+ * Point the tree bits on the path to way away from it
+ */
+static void plruTouch(cache *c, int set, int way) {
+   unsigned int bits = c->plru[set];
+   int level, node = 1, dir;
+
+   for (level = log2i(c->assoc) - 1; level >= 0; level--) {
+      dir = (way >> level) & 1;
+      if (dir)
+         bits &= ~(1u << node);
+      else
+         bits |= 1u << node;
+      node = node * 2 + dir;
+   }
+   c->plru[set] = bits;
+}
+
+static int chooseVictim(cache *c, int set) {
+   cacheLine *ways = &c->lines[set * c->assoc];
+   int way, victim = 0, node = 1, level, dir;
+
+   for (way = 0; way < c->assoc; way++) {
+      if (!ways[way].valid)
+         return way;
+   }
+
+   if (c->policy == CACHE_RANDOM) {
+      c->seed ^= c->seed << 13;
+      c->seed ^= c->seed >> 17;
+      c->seed ^= c->seed << 5;
+      return c->seed & (c->assoc - 1);
+   }
+
+   if (c->policy == CACHE_PLRU) {
+      for (level = log2i(c->assoc) - 1; level >= 0; level--) {
+         dir = (c->plru[set] >> node) & 1;
+         victim = victim * 2 + dir;
+         node = node * 2 + dir;
+      }
+      return victim;
+   }
+
+   for (way = 1; way < c->assoc; way++) {
+      if (ways[way].lastUse < ways[victim].lastUse)
+         victim = way;
+   }
+   return victim;
+}
+
+/**
+ * Access one level, returning the cycles added by misses below it
+ */
+static int cacheAccess(cacheHierarchy *h, cache *c, unsigned int addr, int write) {
+   int set = (addr >> c->offsetBits) & (c->sets - 1), way, penalty = 0;
+   unsigned int tag = addr >> (c->offsetBits + c->setBits);
+   cacheLine *ways = &c->lines[set * c->assoc], *l;
+
+   for (way = 0; way < c->assoc; way++) {
+      if (ways[way].valid && ways[way].tag == tag)
+         break;
+   }
+
+   if (way < c->assoc) {
+      c->hits++;
+      l = &ways[way];
+      if (write && c->writeBack)
+         l->dirty = 1;
+      else if (write && c->next != NULL)
+         cacheAccess(h, c->next, addr, 1);
+   } else {
+      c->misses++;
+      if (write && !c->writeBack) {
+         if (c->next != NULL)
+            cacheAccess(h, c->next, addr, 1);
+         return 0;
+      }
+
+      penalty = c->next != NULL ? c->next->latency + cacheAccess(h, c->next, addr, 0)
+       : h->memLatency;
+
+      way = chooseVictim(c, set);
+      l = &ways[way];
+      if (l->valid) {
+         c->evictions++;
+         if (l->dirty) {
+            c->writebacks++;
+            if (c->next != NULL)
+               cacheAccess(h, c->next, (l->tag << (c->offsetBits + c->setBits))
+                | (set << c->offsetBits), 1);
+         }
+      }
+      l->tag = tag;
+      l->valid = 1;
+      l->dirty = write;
+   }
+
+   l->lastUse = ++c->tick;
+   if (c->policy == CACHE_PLRU)
+      plruTouch(c, set, way);
+
+   return penalty;
+}
+
+/**
+ * Entry points for the engines: each returns the stall cycles to add.
+ * Without an L1 every access pays the L2 latency.
+ */
+int cacheHierarchyFetch(cacheHierarchy *h, unsigned int addr) {
+   if (h->l1i.lines != NULL)
+      return cacheAccess(h, &h->l1i, addr, 0);
+   return h->l2.lines != NULL ? h->l2.latency + cacheAccess(h, &h->l2, addr, 0) : 0;
+}
+
+int cacheHierarchyRead(cacheHierarchy *h, unsigned int addr) {
+   if (h->l1d.lines != NULL)
+      return cacheAccess(h, &h->l1d, addr, 0);
+   return h->l2.lines != NULL ? h->l2.latency + cacheAccess(h, &h->l2, addr, 0) : 0;
+}
+
+int cacheHierarchyWrite(cacheHierarchy *h, unsigned int addr) {
+   if (h->l1d.lines != NULL)
+      return cacheAccess(h, &h->l1d, addr, 1);
+   return h->l2.lines != NULL ? h->l2.latency + cacheAccess(h, &h->l2, addr, 1) : 0;
+}
+
+int cacheFetch(unsigned int addr) {
+   return cacheHierarchyFetch(&caches, addr);
+}
+
+int cacheRead(unsigned int addr) {
+   return cacheHierarchyRead(&caches, addr);
+}
+
+int cacheWrite(unsigned int addr) {
+   return cacheHierarchyWrite(&caches, addr);
+}
+
+void cacheHierarchyPrintStats(cacheHierarchy *h, FILE *out) {
+   cache *levels[] = {&h->l1i, &h->l1d, &h->l2};
+   int i;
+
+   for (i = 0; i < 3; i++) {
+      if (levels[i]->lines != NULL)
+         fprintf(out, "%s: %ld hits, %ld misses, %ld evictions, %ld writebacks\n",
+          levels[i]->name, levels[i]->hits, levels[i]->misses,
+          levels[i]->evictions, levels[i]->writebacks);
+   }
+}
+
+/**
+ * Print the per-level counters as a JSON object member, leading comma
+ * included, for printStatsJson
+ */
+void cacheHierarchyPrintStatsJson(cacheHierarchy *h, FILE *out) {
+   cache *levels[] = {&h->l1i, &h->l1d, &h->l2};
+   int i, first = 1;
+
+   fprintf(out, ", \"caches\": {");
+   for (i = 0; i < 3; i++) {
+      if (levels[i]->lines == NULL)
+         continue;
+      fprintf(out, "%s\"%s\": {\"hits\": %ld, \"misses\": %ld, \"evictions\": %ld, "
+       "\"writebacks\": %ld}", first ? "" : ", ", levels[i]->name, levels[i]->hits,
+       levels[i]->misses, levels[i]->evictions, levels[i]->writebacks);
+      first = 0;
+   }
+   fprintf(out, "}");
+}
+
+/**
+ * Copy the shared hierarchy's counters into the stats registry
+ */
+void cachePublishStats(void) {
+   cache *levels[] = {&caches.l1i, &caches.l1d, &caches.l2};
+   char name[STATS_NAME_LEN];
+   int i;
+
+   for (i = 0; i < 3; i++) {
+      if (levels[i]->lines == NULL)
+         continue;
+      snprintf(name, sizeof(name), "%s.accesses", levels[i]->name);
+      statsSet(name, levels[i]->hits + levels[i]->misses);
+      snprintf(name, sizeof(name), "%s.misses", levels[i]->name);
+      statsSet(name, levels[i]->misses);
+      snprintf(name, sizeof(name), "%s.writebacks", levels[i]->name);
+      statsSet(name, levels[i]->writebacks);
+   }
+}
+
+void cachePrintStats(FILE *out) {
+   cacheHierarchyPrintStats(&caches, out);
+}
+
+void cachePrintStatsJson(FILE *out) {
+   cacheHierarchyPrintStatsJson(&caches, out);
+}
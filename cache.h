@@ -0,0 +1,94 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdio.h>
+
+#define CACHE_LRU 0
+#define CACHE_PLRU 1
+#define CACHE_RANDOM 2
+
+#define CACHE_L2_LATENCY 10
+#define CACHE_MEM_LATENCY 100
+
+typedef struct {
+   unsigned int tag;
+   int valid;
+   int dirty;
+   unsigned long lastUse;   // LRU timestamp
+} cacheLine;
+
+/**
+ * One cache level. Misses are filled from next (NULL means memory), and
+ * latency is what an access that reaches this level adds to the cycle
+ * count. Write-back caches allocate on a write miss and write dirty
+ * victims to the next level; write-through caches pass every write on and
+ * do not allocate.
+ */
+typedef struct cache {
+   const char *name;
+   int size;
+   int assoc;
+   int lineSize;
+   int policy;
+   int writeBack;
+   int latency;
+   int sets;
+   int offsetBits;
+   int setBits;
+   cacheLine *lines;        // sets * assoc, a set's ways are contiguous
+   unsigned int *plru;      // tree bits per set, node n is bit n
+   unsigned long tick;
+   unsigned int seed;
+   struct cache *next;
+   long hits;
+   long misses;
+   long evictions;
+   long writebacks;
+} cache;
+
+/**
+ * An L1I/L1D/L2 set with its memory latency. The engines share the one
+ * built from the command line; timing models may build their own.
+ */
+typedef struct {
+   cache l1i;
+   cache l1d;
+   cache l2;
+   int memLatency;
+} cacheHierarchy;
+
+extern int cacheEnabled;
+
+int cacheHierarchyInit(cacheHierarchy *h, const char *l1i, const char *l1d, const char *l2,
+ int memLatency);
+
+void cacheHierarchyFree(cacheHierarchy *h);
+
+int cacheHierarchyFetch(cacheHierarchy *h, unsigned int addr);
+
+int cacheHierarchyRead(cacheHierarchy *h, unsigned int addr);
+
+int cacheHierarchyWrite(cacheHierarchy *h, unsigned int addr);
+
+void cacheHierarchyPrintStats(cacheHierarchy *h, FILE *out);
+
+void cacheHierarchyPrintStatsJson(cacheHierarchy *h, FILE *out);
+
+
+int cacheInit(const char *l1i, const char *l1d, const char *l2, int memLatency);
+
+void cacheFree(void);
+
+int cacheFetch(unsigned int addr);
+
+int cacheRead(unsigned int addr);
+
+int cacheWrite(unsigned int addr);
+
+void cachePrintStats(FILE *out);
+
+void cachePrintStatsJson(FILE *out);
+
+void cachePublishStats(void);
+
+#endif
@@ -0,0 +1,102 @@
+#include <string.h>
+#include "image.h"
+
+/**
+ * Write a program image. Only defined labels go in the symbol section.
+ * Returns 0, or -1 if a write failed.
+ */
+int imageWrite(FILE *out, const line *prog, int numLines, const int *data,
+ int dataWords, const symtab *t) {
+   imageHeader hdr;
+   imageSymbol sym;
+   unsigned int name = 0;
+   int i;
+
+   memset(&hdr, 0, sizeof(hdr));
+   hdr.magic = IMAGE_MAGIC;
+   hdr.version = IMAGE_VERSION;
+   hdr.textOffset = sizeof(hdr);
+   hdr.textCount = numLines;
+   hdr.dataOffset = hdr.textOffset + numLines * sizeof(line);
+   hdr.dataCount = dataWords;
+   hdr.symOffset = hdr.dataOffset + dataWords * sizeof(int);
+   for (i = 0; i < t->count; i++) {
+      if (t->entries[i].defined) {
+         hdr.symCount++;
+         hdr.strSize += t->entries[i].len + 1;
+      }
+   }
+   hdr.strOffset = hdr.symOffset + hdr.symCount * sizeof(imageSymbol);
+
+   fwrite(&hdr, sizeof(hdr), 1, out);
+   fwrite(prog, sizeof(line), numLines, out);
+   fwrite(data, sizeof(int), dataWords, out);
+   for (i = 0; i < t->count; i++) {
+      if (t->entries[i].defined) {
+         sym.name = name;
+         sym.len = t->entries[i].len;
+         sym.loc = t->entries[i].loc;
+         fwrite(&sym, sizeof(sym), 1, out);
+         name += sym.len + 1;
+      }
+   }
+   for (i = 0; i < t->count; i++) {
+      if (t->entries[i].defined)
+         fwrite(t->entries[i].symbol, 1, t->entries[i].len + 1, out);
+   }
+
+   return ferror(out) ? -1 : 0;
+}
+
+static int sectionFits(size_t len, unsigned int offset, unsigned int count,
+ size_t size) {
+   return offset <= len && count <= (len - offset) / size;
+}
+
+/**
+ * Return the header if buf holds a well formed image, NULL otherwise (for
+ * instance when it is assembly source).
+ */
+const imageHeader *imageCheck(const void *buf, size_t len) {
+   const imageHeader *hdr = buf;
+
+   if (len < sizeof(*hdr) || hdr->magic != IMAGE_MAGIC
+    || hdr->version != IMAGE_VERSION)
+      return NULL;
+   if (!sectionFits(len, hdr->textOffset, hdr->textCount, sizeof(line))
+    || !sectionFits(len, hdr->dataOffset, hdr->dataCount, sizeof(int))
+    || !sectionFits(len, hdr->symOffset, hdr->symCount, sizeof(imageSymbol))
+    || !sectionFits(len, hdr->strOffset, hdr->strSize, 1))
+      return NULL;
+
+   return hdr;
+}
+
+/**
+ * Copy a checked image into memory: text into mem->text, data from
+ * MEM_DATA_BASE, and, if t is not NULL, its labels into the symbol table.
+ * Returns the number of text lines, or -1 if the text does not fit in
+ * progSize lines.
+ */
+int imageLoad(const imageHeader *hdr, memory *mem, int progSize, symtab *t) {
+   const char *base = (const char *) hdr;
+   const int *data = (const int *) (base + hdr->dataOffset);
+   const imageSymbol *syms = (const imageSymbol *) (base + hdr->symOffset);
+   const char *names = base + hdr->strOffset;
+   unsigned int i;
+
+   if (hdr->textCount > (unsigned int) progSize)
+      return -1;
+
+   memcpy(mem->text, base + hdr->textOffset, hdr->textCount * sizeof(line));
+   mem->textLines = hdr->textCount;
+   for (i = 0; i < hdr->dataCount; i++)
+      memStoreWord(mem, MEM_DATA_BASE + i * 4, data[i]);
+
+   for (i = 0; t != NULL && i < hdr->symCount; i++) {
+      if (syms[i].name < hdr->strSize && syms[i].len < hdr->strSize - syms[i].name)
+         symtabAdd(t, names + syms[i].name, syms[i].len, syms[i].loc);
+   }
+
+   return hdr->textCount;
+}
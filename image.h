@@ -0,0 +1,45 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "simulator.h"
+#include "symtab.h"
+#include "memory.h"
+
+#define IMAGE_MAGIC 0x5350494D  // "MIPS" read as little endian
+#define IMAGE_VERSION 1
+
+/**
+ * Pre-assembled program image: an imageHeader followed by the sections it
+ * points at, all native endian. Text is stored as the simulator's own line
+ * records, so loading it is a copy, and data as words loaded from
+ * MEM_DATA_BASE. Symbols name offsets into the string section.
+ */
+typedef struct {
+   unsigned int magic;
+   unsigned int version;
+   unsigned int textOffset;
+   unsigned int textCount;    // line records
+   unsigned int dataOffset;
+   unsigned int dataCount;    // words
+   unsigned int symOffset;
+   unsigned int symCount;     // imageSymbol records
+   unsigned int strOffset;
+   unsigned int strSize;
+} imageHeader;
+
+typedef struct {
+   unsigned int name;         // offset into the string section
+   unsigned int len;
+   int loc;
+} imageSymbol;
+
+int imageWrite(FILE *out, const line *prog, int numLines, const int *data,
+ int dataWords, const symtab *t);
+
+const imageHeader *imageCheck(const void *buf, size_t len);
+
+int imageLoad(const imageHeader *hdr, memory *mem, int progSize, symtab *t);
+
+#endif
@@ -0,0 +1,637 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "jit.h"
+#include "threaded.h"
+#include "trace.h"
+#include "cache.h"
+
+/**
+ * Basic-block translator for the functional engine. Blocks start at any
+ * line and end at BEQ/BNE/J/JAL/JR, before a SYSCALL (which is always left
+ * to the interpreter) or after JIT_MAX_BLOCK instructions. Translated code
+ * keeps the MIPS register file in rbx, the memory in r12 and the
+ * jitContext in r13, so blocks can jump straight into each other once a
+ * static successor has been translated. LW and SW call out to the memory
+ * fast paths; the stack is 16-byte aligned inside blocks for that.
+ *
+ * Counters are not updated per instruction. Every exit adds the totals for
+ * the path it ends, computed at translation time with the same rules as
+ * runCommand (instExec only counts a step whose next line is > 0), so the
+ * results match the interpreter exactly.
+ */
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define JIT_X86_64
+#include <sys/mman.h>
+#endif
+
+enum {
+   EXIT_END,     // ctx.next holds the line to continue at
+   EXIT_CHAIN,   // static successor not linked yet, rel32 to patch in ctx.patch
+   EXIT_BUDGET,  // not enough budget left to run the whole block
+   EXIT_SMC      // a SW wrote line ctx.smcAddr of the text segment
+};
+
+typedef struct {
+   int next;
+   long memRefs;
+   long clockCycles;
+   long instExec;
+   long budget;
+   int smcAddr;
+   unsigned char *patch;
+} jitContext;
+
+#ifdef JIT_X86_64
+
+#define CTX(field) ((int) offsetof(jitContext, field))
+#define REG(r) ((r) * 4)
+#define EAX 0
+#define ECX 1
+#define EDX 2
+
+typedef int (*jitEntryFn)(int *regs, memory *mem, jitContext *ctx, unsigned char *code);
+
+typedef struct {
+   int insts;
+   int cycles;
+   int refs;    // LWs and SWs since block start
+} blockCounts;
+
+typedef struct {
+   unsigned char *site;
+   blockCounts counts;
+   int lineNum;
+} smcExit;
+
+static unsigned char *codeBase = NULL;
+static unsigned char *codeStart, *codePtr, *codeEnd;
+static unsigned char *exitCode;
+static jitEntryFn jitEnter;
+
+static unsigned char **blockEntry = NULL;
+static int *blockLen = NULL;    // 0 = not translated, -1 = left to the interpreter
+static int blockLines = 0;
+static int generation = 0;
+
+static void emit8(int b) {
+   *codePtr++ = (unsigned char) b;
+}
+
+static void emit32(int v) {
+   memcpy(codePtr, &v, 4);
+   codePtr += 4;
+}
+
+static void emit64(unsigned long v) {
+   memcpy(codePtr, &v, 8);
+   codePtr += 8;
+}
+
+static void patchRel32(unsigned char *site, unsigned char *target) {
+   int rel = (int) (target - (site + 4));
+
+   memcpy(site, &rel, 4);
+}
+
+/**
+ * mov host, [rbx + reg*4]
+ */
+static void loadReg(int host, int reg) {
+   emit8(0x8B);
+   emit8(0x83 | host << 3);
+   emit32(REG(reg));
+}
+
+/**
+ * mov [rbx + reg*4], host
+ */
+static void storeReg(int host, int reg) {
+   emit8(0x89);
+   emit8(0x83 | host << 3);
+   emit32(REG(reg));
+}
+
+/**
+ * mov dword [rbx + reg*4], imm32
+ */
+static void storeRegImm(int reg, int imm) {
+   emit8(0xC7);
+   emit8(0x83);
+   emit32(REG(reg));
+   emit32(imm);
+}
+
+/**
+ * add qword [r13 + off], imm32 (the counters); mov dword [r13 + off], imm32
+ */
+static void ctxAdd(int off, int imm) {
+   emit8(0x49);
+   emit8(0x81);
+   emit8(0x45);
+   emit8(off);
+   emit32(imm);
+}
+
+static void ctxMov(int off, int imm) {
+   emit8(0x41);
+   emit8(0xC7);
+   emit8(0x45);
+   emit8(off);
+   emit32(imm);
+}
+
+/**
+ * mov eax, imm32; jmp exitCode
+ */
+static void emitReturn(int exitReason) {
+   emit8(0xB8);
+   emit32(exitReason);
+   emit8(0xE9);
+   emit32(0);
+   patchRel32(codePtr - 4, exitCode);
+}
+
+/**
+ * Fold the counters for everything run on this path into the context
+ */
+static void emitCounters(blockCounts *c, int exec) {
+   if (c->cycles)
+      ctxAdd(CTX(clockCycles), c->cycles);
+   if (c->refs)
+      ctxAdd(CTX(memRefs), c->refs);
+   if (exec)
+      ctxAdd(CTX(instExec), exec);
+
+   //sub qword [r13 + budget], insts
+   emit8(0x49);
+   emit8(0x81);
+   emit8(0x6D);
+   emit8(CTX(budget));
+   emit32(c->insts);
+}
+
+/**
+ * Leave the block for a statically known line. Successors inside the text
+ * segment are jumped to directly, either now or once the dispatcher has
+ * translated them and patched the jump.
+ */
+static void emitStaticExit(blockCounts *c, int exec, int target, int numLines) {
+   unsigned char *site;
+
+   emitCounters(c, exec);
+   ctxMov(CTX(next), target);
+
+   if (target < 0 || target >= numLines) {
+      emitReturn(EXIT_END);
+      return;
+   }
+
+   emit8(0xE9);
+   site = codePtr;
+   emit32(0);
+   if (blockLen[target] > 0) {
+      patchRel32(site, blockEntry[target]);
+      return;
+   }
+
+   //Chain stub: hand the patch site to the dispatcher
+   patchRel32(site, codePtr);
+   emit8(0x48);
+   emit8(0xB8);
+   emit64((unsigned long) site);
+   emit8(0x49);
+   emit8(0x89);
+   emit8(0x45);
+   emit8(CTX(patch));
+   emitReturn(EXIT_CHAIN);
+}
+
+static int jitLoadWord(memory *mem, unsigned int addr) {
+   return memLoadWord(mem, addr);
+}
+
+static int jitStoreWord(memory *mem, unsigned int addr, int val) {
+   return memStoreWord(mem, addr, val);
+}
+
+/**
+ * esi = eax; rdi = r12 (the memory); call helper. Leaves the result in eax.
+ */
+static void emitMemCall(void *helper) {
+   emit8(0x89);
+   emit8(0xC6);
+   emit8(0x4C);
+   emit8(0x89);
+   emit8(0xE7);
+   emit8(0x48);
+   emit8(0xB8);
+   emit64((unsigned long) helper);
+   emit8(0xFF);
+   emit8(0xD0);
+}
+
+static int isTerminator(int handler) {
+   return handler == UOP_BEQ || handler == UOP_BNE || handler == UOP_J
+    || handler == UOP_JAL || handler == UOP_JR;
+}
+
+/**
+ * Count the instructions of the block starting at start, decoding stale
+ * entries on the way. Returns 0 when the block cannot be translated.
+ */
+static int scanBlock(uop *ops, line *prog, int numLines, int start) {
+   int k, n = 0;
+
+   for (k = start; k < numLines && n < JIT_MAX_BLOCK; k++) {
+      if (ops[k].handler == UOP_UNDECODED)
+         predecodeLine(&prog[k], k, &ops[k]);
+      if (ops[k].handler == UOP_SYSCALL)
+         break;
+      n++;
+      if (isTerminator(ops[k].handler))
+         break;
+   }
+
+   return n;
+}
+
+static unsigned char *translate(uop *ops, line *prog, int numLines, int start) {
+   static smcExit smcExits[JIT_MAX_BLOCK];
+   int n, k, numSmc = 0, target, pc;
+   unsigned char *entry, *bail, *taken;
+   blockCounts c = {0, 0, 0};
+   uop *op;
+
+   n = scanBlock(ops, prog, numLines, start);
+   if (n == 0) {
+      blockLen[start] = -1;
+      return NULL;
+   }
+
+   if (codeEnd - codePtr < JIT_MAX_BLOCK * 192 + 512)
+      jitFlush();
+
+   entry = codePtr;
+
+   //cmp qword [r13 + budget], n; jl bail
+   emit8(0x49);
+   emit8(0x81);
+   emit8(0x7D);
+   emit8(CTX(budget));
+   emit32(n);
+   emit8(0x0F);
+   emit8(0x8C);
+   bail = codePtr;
+   emit32(0);
+
+   for (k = start; k < start + n; k++) {
+      op = &ops[k];
+      pc = k * 4 + INITIAL_PC;
+      c.insts++;
+      c.cycles += op->cycles;
+
+      switch (op->handler) {
+      case UOP_AND:
+      case UOP_OR:
+      case UOP_ADD:
+      case UOP_ADDU:
+      case UOP_SUB:
+         loadReg(EAX, op->rs);
+         loadReg(ECX, op->rt);
+         emit8(op->handler == UOP_AND ? 0x21 : op->handler == UOP_OR ? 0x09
+          : op->handler == UOP_SUB ? 0x29 : 0x01);
+         emit8(0xC8);
+         storeReg(EAX, op->rd);
+         break;
+      case UOP_SLT:
+      case UOP_SLTU:
+         loadReg(EAX, op->rs);
+         loadReg(ECX, op->rt);
+         emit8(0x39);
+         emit8(0xC8);
+         emit8(0x0F);
+         emit8(op->handler == UOP_SLT ? 0x9C : 0x92);
+         emit8(0xC0);
+         emit8(0x0F);
+         emit8(0xB6);
+         emit8(0xC0);
+         storeReg(EAX, op->rd);
+         break;
+      case UOP_ORI:
+      case UOP_ADDI:
+      case UOP_ADDIU:
+         loadReg(EAX, op->rs);
+         emit8(op->handler == UOP_ORI ? 0x0D : op->handler == UOP_ADDI ? 0x05 : 0x25);
+         emit32(op->imm);
+         storeReg(EAX, op->rt);
+         break;
+      case UOP_SLTI:
+      case UOP_SLTIU:
+         loadReg(EAX, op->rs);
+         emit8(0x3D);
+         emit32(op->imm);
+         emit8(0x0F);
+         emit8(op->handler == UOP_SLTI ? 0x9C : 0x92);
+         emit8(0xC0);
+         emit8(0x0F);
+         emit8(0xB6);
+         emit8(0xC0);
+         storeReg(EAX, op->rt);
+         break;
+      case UOP_SLL:
+      case UOP_SRL:
+      case UOP_SRA:
+         //SRL is an arithmetic shift and SRA a logical one, as in runCommand
+         loadReg(EAX, op->rt);
+         emit8(0xC1);
+         emit8(op->handler == UOP_SLL ? 0xE0 : op->handler == UOP_SRL ? 0xF8 : 0xE8);
+         emit8(op->shamt);
+         storeReg(EAX, op->rd);
+         break;
+      case UOP_LUI:
+         storeRegImm(op->rt, op->imm);
+         break;
+      case UOP_LW:
+         //eax = memLoadWord(mem, regs[rs] + imm)
+         loadReg(EAX, op->rs);
+         emit8(0x05);
+         emit32(op->imm);
+         emitMemCall((void *) jitLoadWord);
+         storeReg(EAX, op->rt);
+         c.refs++;
+         break;
+      case UOP_SW:
+         //eax = memStoreWord(mem, regs[rs] + imm, regs[rt]), leave if it hit text
+         loadReg(EAX, op->rs);
+         emit8(0x05);
+         emit32(op->imm);
+         loadReg(EDX, op->rt);
+         emitMemCall((void *) jitStoreWord);
+         c.refs++;
+         emit8(0x85);
+         emit8(0xC0);
+         emit8(0x0F);
+         emit8(0x89);
+         smcExits[numSmc].site = codePtr;
+         smcExits[numSmc].counts = c;
+         smcExits[numSmc].lineNum = k;
+         numSmc++;
+         emit32(0);
+         break;
+      case UOP_BEQ:
+      case UOP_BNE:
+         loadReg(EAX, op->rs);
+         emit8(0x3B);
+         emit8(0x83);
+         emit32(REG(op->rt));
+         emit8(0x0F);
+         emit8(op->handler == UOP_BEQ ? 0x84 : 0x85);
+         taken = codePtr;
+         emit32(0);
+         emitStaticExit(&c, c.insts - 1 + (k + 1 > 0), k + 1, numLines);
+         patchRel32(taken, codePtr);
+         target = op->target;
+         emitStaticExit(&c, c.insts - 1 + (target > 0), target, numLines);
+         break;
+      case UOP_JAL:
+         storeRegImm(31, pc + 8);
+         //fall through
+      case UOP_J:
+         target = op->target;
+         emitStaticExit(&c, c.insts - 1 + (target > 0), target, numLines);
+         break;
+      case UOP_JR:
+         //eax = (regs[rs] - 4 - INITIAL_PC) / 4, rounding toward zero
+         loadReg(EAX, op->rs);
+         emit8(0x2D);
+         emit32(4 + INITIAL_PC);
+         storeRegImm(31, pc - 4);
+         emit8(0x8D);
+         emit8(0x48);
+         emit8(0x03);
+         emit8(0x85);
+         emit8(0xC0);
+         emit8(0x0F);
+         emit8(0x48);
+         emit8(0xC1);
+         emit8(0xC1);
+         emit8(0xF8);
+         emit8(0x02);
+         //ctx.next = eax; ctx.instExec += eax > 0 (rcx, zero extended)
+         emit8(0x41);
+         emit8(0x89);
+         emit8(0x45);
+         emit8(CTX(next));
+         emit8(0x31);
+         emit8(0xC9);
+         emit8(0x85);
+         emit8(0xC0);
+         emit8(0x0F);
+         emit8(0x9F);
+         emit8(0xC1);
+         emit8(0x49);
+         emit8(0x01);
+         emit8(0x4D);
+         emit8(CTX(instExec));
+         emitCounters(&c, c.insts - 1);
+         emitReturn(EXIT_END);
+         break;
+      default:
+         break;
+      }
+   }
+
+   //Ran off the end of the block without a branch
+   if (!isTerminator(ops[start + n - 1].handler))
+      emitStaticExit(&c, c.insts, start + n, numLines);
+
+   patchRel32(bail, codePtr);
+   ctxMov(CTX(next), start);
+   emitReturn(EXIT_BUDGET);
+
+   for (k = 0; k < numSmc; k++) {
+      patchRel32(smcExits[k].site, codePtr);
+      //ctx.smcAddr = eax
+      emit8(0x41);
+      emit8(0x89);
+      emit8(0x45);
+      emit8(CTX(smcAddr));
+      emitCounters(&smcExits[k].counts, smcExits[k].counts.insts);
+      ctxMov(CTX(next), smcExits[k].lineNum + 1);
+      emitReturn(EXIT_SMC);
+   }
+
+   blockEntry[start] = entry;
+   blockLen[start] = n;
+
+   return entry;
+}
+
+/**
+ * Map the code cache and emit the entry/exit trampolines
+ */
+int jitInit(void) {
+   if (codeBase != NULL)
+      return 0;
+
+   codeBase = mmap(NULL, JIT_CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (codeBase == MAP_FAILED) {
+      codeBase = NULL;
+      return -1;
+   }
+   codePtr = codeBase;
+   codeEnd = codeBase + JIT_CACHE_SIZE;
+
+   //push rbx; push r12; push r13; mov rbx, rdi; mov r12, rsi; mov r13, rdx; jmp rcx
+   jitEnter = (jitEntryFn) codePtr;
+   emit8(0x53);
+   emit8(0x41);
+   emit8(0x54);
+   emit8(0x41);
+   emit8(0x55);
+   emit8(0x48);
+   emit8(0x89);
+   emit8(0xFB);
+   emit8(0x49);
+   emit8(0x89);
+   emit8(0xF4);
+   emit8(0x49);
+   emit8(0x89);
+   emit8(0xD5);
+   emit8(0xFF);
+   emit8(0xE1);
+
+   //pop r13; pop r12; pop rbx; ret
+   exitCode = codePtr;
+   emit8(0x41);
+   emit8(0x5D);
+   emit8(0x41);
+   emit8(0x5C);
+   emit8(0x5B);
+   emit8(0xC3);
+
+   codeStart = codePtr;
+
+   return 0;
+}
+
+/**
+ * Throw away every translated block
+ */
+void jitFlush(void) {
+   if (codeBase == NULL)
+      return;
+
+   codePtr = codeStart;
+   if (blockLines) {
+      memset(blockEntry, 0, blockLines * sizeof(*blockEntry));
+      memset(blockLen, 0, blockLines * sizeof(*blockLen));
+   }
+   generation++;
+}
+
+static int setupBlocks(int numLines) {
+   if (numLines == blockLines)
+      return 0;
+
+   free(blockEntry);
+   free(blockLen);
+   blockEntry = calloc(numLines, sizeof(*blockEntry));
+   blockLen = calloc(numLines, sizeof(*blockLen));
+   if (blockEntry == NULL || blockLen == NULL) {
+      blockLines = 0;
+      return -1;
+   }
+   blockLines = numLines;
+   jitFlush();
+
+   return 0;
+}
+
+/**
+ * Same contract as runThreaded. Runs translated blocks where it can and
+ * single-steps the interpreter for SYSCALLs, untranslatable lines and the
+ * tail of a --max-insts budget too short for a whole block. Traced runs
+ * and runs with a cache model go to the interpreter, which feeds both.
+ */
+int runJit(uop *ops, memory *mem, int *regs, int numLines, int i,
+ long maxSteps, long *memRefs, long *clockCycles, long *instExec) {
+   long remaining = maxSteps < 0 ? LONG_MAX : maxSteps;
+   line *prog = mem->text;
+   int reason, gen, wasStore;
+   unsigned char *code;
+   jitContext ctx;
+   uop *op;
+
+   if (traceEnabled || cacheEnabled || jitInit() != 0 || setupBlocks(numLines) != 0)
+      return runThreaded(ops, mem, regs, numLines, i, maxSteps, memRefs,
+       clockCycles, instExec);
+
+   ctx.memRefs = *memRefs;
+   ctx.clockCycles = *clockCycles;
+   ctx.instExec = *instExec;
+
+   while (i >= 0 && i < numLines && remaining > 0) {
+      code = blockLen[i] > 0 ? blockEntry[i] : NULL;
+      if (blockLen[i] == 0)
+         code = translate(ops, prog, numLines, i);
+
+      if (code == NULL || blockLen[i] > remaining) {
+         op = &ops[i];
+         if (op->handler == UOP_UNDECODED)
+            predecodeLine(&prog[i], i, op);
+         wasStore = op->handler == UOP_SW;
+         i = runThreaded(ops, mem, regs, numLines, i, 1, &ctx.memRefs,
+          &ctx.clockCycles, &ctx.instExec);
+         remaining--;
+         if (wasStore && memTextLine(mem, regs[op->rs] + op->imm) >= 0)
+            jitFlush();
+         continue;
+      }
+
+      ctx.budget = remaining;
+      reason = jitEnter(regs, mem, &ctx, code);
+      remaining = ctx.budget;
+      i = ctx.next;
+
+      if (reason == EXIT_CHAIN) {
+         gen = generation;
+         if (blockLen[i] == 0)
+            translate(ops, prog, numLines, i);
+         if (gen == generation && blockLen[i] > 0)
+            patchRel32(ctx.patch, blockEntry[i]);
+      } else if (reason == EXIT_SMC) {
+         ops[ctx.smcAddr].handler = UOP_UNDECODED;
+         jitFlush();
+      }
+   }
+
+   *memRefs = ctx.memRefs;
+   *clockCycles = ctx.clockCycles;
+   *instExec = ctx.instExec;
+
+   return i;
+}
+
+#else
+
+int jitInit(void) {
+   return -1;
+}
+
+void jitFlush(void) {
+}
+
+/**
+ * No translator for this host, run the threaded interpreter
+ */
+int runJit(uop *ops, memory *mem, int *regs, int numLines, int i,
+ long maxSteps, long *memRefs, long *clockCycles, long *instExec) {
+   return runThreaded(ops, mem, regs, numLines, i, maxSteps, memRefs,
+    clockCycles, instExec);
+}
+
+#endif
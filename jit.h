@@ -0,0 +1,18 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "simulator.h"
+#include "predecode.h"
+#include "memory.h"
+
+#define JIT_CACHE_SIZE (16 << 20)
+#define JIT_MAX_BLOCK 256
+
+int jitInit(void);
+
+void jitFlush(void);
+
+int runJit(uop *ops, memory *mem, int *regs, int numLines, int i,
+ long maxSteps, long *memRefs, long *clockCycles, long *instExec);
+
+#endif
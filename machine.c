@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "machine.h"
+#include "assembler.h"
+#include "image.h"
+#include "trace.h"
+#include "snapshot.h"
+
+/**
+ * Assemble path, copy it in when it is a binary image or restore it when
+ * it is a snapshot, and predecode it. Returns the number of text lines or
+ * a MACHINE_ERR code; the program is in memory only on success, but
+ * machineFree is always safe to call.
+ */
+int machineLoad(machine *m, const char *path) {
+   asmSource source;
+   const imageHeader *image;
+   int numLines;
+
+   symtabInit(&m->symbolTable);
+   m->assembledLines = NULL;
+   m->decodedLines = NULL;
+   m->sourceLines = NULL;
+   memInit(&m->mainMemory, NULL, 0);
+   m->textLines = 0;
+   memset(&m->resume, 0, sizeof(m->resume));
+   machineReset(m);
+   if (sourceOpen(path, &source) != 0)
+      return MACHINE_ERR_OPEN;
+
+   if (snapshotCheck(source.text, source.len) != NULL) {
+      sourceClose(&source);
+      if ((numLines = snapshotLoad(m, path)) < 0)
+         return numLines;
+   } else {
+      //Source text is sized by its line count, then trimmed to what it assembled to
+      image = imageCheck(source.text, source.len);
+      numLines = image != NULL ? (int) image->textCount : sourceLineCount(source.text, source.len);
+      if (machineText(m, numLines) != 0) {
+         sourceClose(&source);
+         return MACHINE_ERR_SIZE;
+      }
+      if (image != NULL)
+         numLines = imageLoad(image, &m->mainMemory, numLines, &m->symbolTable);
+      else
+         numLines = assembleMapped(source.text, source.len, m->assembledLines, numLines,
+          &m->symbolTable, m->sourceLines);
+      sourceClose(&source);
+      if (numLines < 0 || machineText(m, numLines) != 0)
+         return MACHINE_ERR_SIZE;
+   }
+
+   m->textLines = numLines;
+   m->mainMemory.textLines = numLines;
+   if ((m->decodedLines = calloc(numLines + 1, sizeof(uop))) == NULL)
+      return MACHINE_ERR_SIZE;
+   predecode(m->assembledLines, numLines, m->decodedLines);
+
+   return numLines;
+}
+
+/**
+ * Size m's program text, and the source line of each text line, for lines
+ * instructions. New lines start out zeroed and existing ones are kept, so
+ * the text can be sized for the most a source could need and trimmed once
+ * it is assembled. Returns 0, or -1 when there is no memory for it.
+ */
+int machineText(machine *m, int lines) {
+   line *text;
+   int *source;
+   int old = m->textLines;
+
+   //One spare entry, so an empty program still gets a buffer
+   if ((text = realloc(m->assembledLines, (lines + 1) * sizeof(line))) == NULL)
+      return -1;
+   m->assembledLines = text;
+   if ((source = realloc(m->sourceLines, (lines + 1) * sizeof(int))) == NULL)
+      return -1;
+   m->sourceLines = source;
+   if (lines > old) {
+      memset(text + old, 0, (lines + 1 - old) * sizeof(line));
+      memset(source + old, 0, (lines + 1 - old) * sizeof(int));
+   }
+   m->mainMemory.text = text;
+   m->textLines = lines;
+   return 0;
+}
+
+void machineFree(machine *m) {
+   memFree(&m->mainMemory);
+   symtabFree(&m->symbolTable);
+   free(m->assembledLines);
+   free(m->decodedLines);
+   free(m->sourceLines);
+   m->assembledLines = NULL;
+   m->decodedLines = NULL;
+   m->sourceLines = NULL;
+   m->mainMemory.text = NULL;
+}
+
+static void *duplicate(const void *src, size_t size) {
+   void *copy = malloc(size);
+
+   if (copy == NULL) {
+      perror("machine");
+      exit(1);
+   }
+   return memcpy(copy, src, size);
+}
+
+/**
+ * Make dst a private copy of src's program, registers and memory that can
+ * run ahead without disturbing it. The symbols stay behind.
+ */
+void machineFork(machine *dst, machine *src) {
+   *dst = *src;
+   symtabInit(&dst->symbolTable);
+   dst->assembledLines = duplicate(src->assembledLines, (src->textLines + 1) * sizeof(line));
+   dst->decodedLines = duplicate(src->decodedLines, (src->textLines + 1) * sizeof(uop));
+   dst->sourceLines = duplicate(src->sourceLines, (src->textLines + 1) * sizeof(int));
+   memInit(&dst->mainMemory, dst->assembledLines, src->textLines);
+   memCopy(&dst->mainMemory, &src->mainMemory);
+}
+
+void machineReset(machine *m) {
+   memset(m->registers, 0, sizeof(m->registers));
+   m->registers[28] = MEM_GP_INIT;
+   m->registers[29] = MEM_STACK_TOP;
+   m->registers[31] = INITIAL_PC;
+}
+
+/**
+ * Functional core: run one predecoded instruction of m and describe it in r
+ * for the timing models. Costs nothing but the architectural work; clock
+ * cycles come from whatever consumes r. Returns the line index of the
+ * next instruction, -1 when the program exits.
+ */
+int machineStep(machine *m, uop *op, long *memRefs, int lineNum, streamRecord *r) {
+   int pc = lineNum * 4 + INITIAL_PC, address, next = lineNum + 1;
+
+   if (op->handler == UOP_UNDECODED)
+      predecodeLine(&m->assembledLines[lineNum], lineNum, op);
+
+   if (traceEnabled)
+      traceInst(pc, m->assembledLines[lineNum].inst);
+   r->line = lineNum;
+   r->pc = pc;
+   r->inst = m->assembledLines[lineNum].inst;
+   r->op = *op;
+
+   switch (op->handler) {
+   case UOP_AND:
+      m->registers[op->rd] = m->registers[op->rs] & m->registers[op->rt];
+      break;
+   case UOP_OR:
+      m->registers[op->rd] = m->registers[op->rs] | m->registers[op->rt];
+      break;
+   case UOP_ORI:
+      m->registers[op->rt] = m->registers[op->rs] | op->imm;
+      break;
+   case UOP_ADD:
+      m->registers[op->rd] = m->registers[op->rs] + m->registers[op->rt];
+      break;
+   case UOP_ADDU:
+      m->registers[op->rd] = (unsigned) m->registers[op->rs] + (unsigned) m->registers[op->rt];
+      break;
+   case UOP_ADDI:
+      m->registers[op->rt] = m->registers[op->rs] + op->imm;
+      break;
+   case UOP_ADDIU:
+      m->registers[op->rt] = (unsigned) m->registers[op->rs] & (unsigned) op->imm;
+      break;
+   case UOP_SLL:
+      m->registers[op->rd] = m->registers[op->rt] << op->shamt;
+      break;
+   case UOP_SRL:
+      m->registers[op->rd] = m->registers[op->rt] >> op->shamt;
+      break;
+   case UOP_SRA:
+      m->registers[op->rd] = (unsigned) m->registers[op->rt] >> op->shamt;
+      break;
+   case UOP_SUB:
+      m->registers[op->rd] = m->registers[op->rs] - m->registers[op->rt];
+      break;
+   case UOP_SLT:
+      m->registers[op->rd] = m->registers[op->rs] < m->registers[op->rt] ? 1 : 0;
+      break;
+   case UOP_SLTI:
+      m->registers[op->rt] = m->registers[op->rs] < op->imm ? 1 : 0;
+      break;
+   case UOP_SLTU:
+      m->registers[op->rd] = (unsigned) m->registers[op->rs] < (unsigned) m->registers[op->rt] ? 1 : 0;
+      break;
+   case UOP_SLTIU:
+      m->registers[op->rt] = (unsigned) m->registers[op->rs] < (unsigned) op->imm ? 1 : 0;
+      break;
+   case UOP_BEQ:
+      if (m->registers[op->rs] == m->registers[op->rt])
+         next = op->target;
+      break;
+   case UOP_BNE:
+      if (m->registers[op->rs] != m->registers[op->rt])
+         next = op->target;
+      break;
+   case UOP_LUI:
+      m->registers[op->rt] = op->imm;
+      break;
+   case UOP_LW:
+      r->addr = m->registers[op->rs] + op->imm;
+      m->registers[op->rt] = memLoadWord(&m->mainMemory, r->addr);
+      *memRefs += 1;
+      break;
+   case UOP_SW:
+      r->addr = m->registers[op->rs] + op->imm;
+      address = memStoreWord(&m->mainMemory, r->addr, m->registers[op->rt]);
+      if (address >= 0)
+         m->decodedLines[address].handler = UOP_UNDECODED;
+      *memRefs += 1;
+      break;
+   case UOP_J:
+      next = op->target;
+      break;
+   case UOP_JR:
+      address = m->registers[op->rs] - 4;
+      m->registers[31] = pc - 4;
+      next = (address - INITIAL_PC) / 4;
+      break;
+   case UOP_JAL:
+      m->registers[31] = pc + 8;
+      next = op->target;
+      break;
+   case UOP_SYSCALL:
+      next = m->registers[2] == 10 ? -1 : lineNum;
+      break;
+   }
+
+   r->taken = next >= 0 && next != lineNum + 1;
+   r->next = next;
+   return next;
+}
@@ -0,0 +1,58 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include "simulator.h"
+#include "symtab.h"
+#include "memory.h"
+#include "predecode.h"
+#include "timing.h"
+
+#define MACHINE_ERR_OPEN -1   // machineLoad could not read the file
+#define MACHINE_ERR_SIZE -2   // there was no memory for the program's text
+
+/**
+ * Where a run picks up. A loaded program starts at line 0 with zeroed
+ * counters; a restored snapshot (snapshot.c) carries on from where it was
+ * taken, with the engine's own state when it was taken mid-pipeline.
+ */
+typedef struct {
+   int pc;                   // line to run next
+   long instExec;
+   long memRefs;
+   long cycles;
+   long fetched;             // pipeline only
+   int engine;               // SNAPSHOT_ENGINE_* that engineState belongs to
+   const void *engineState;
+   size_t engineSize;
+} machineResume;
+
+/**
+ * One simulated machine: a loaded program, its architectural state and
+ * its memory. Nothing here is shared, so separate machines can run on
+ * separate threads. The per line arrays hold textLines entries and are
+ * allocated when the program is loaded.
+ */
+typedef struct {
+   symtab symbolTable;
+   line *assembledLines;
+   uop *decodedLines;
+   memory mainMemory;
+   int registers[NUM_REGISTERS];
+   int textLines;
+   int *sourceLines;   // 1-based .asm line of each text line, 0 when not assembled here
+   machineResume resume;
+} machine;
+
+int machineLoad(machine *m, const char *path);
+
+int machineText(machine *m, int lines);
+
+void machineFree(machine *m);
+
+void machineFork(machine *dst, machine *src);
+
+void machineReset(machine *m);
+
+int machineStep(machine *m, uop *op, long *memRefs, int lineNum, streamRecord *r);
+
+#endif
@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "memory.h"
+
+void memInit(memory *m, line *text, int textLines) {
+   memset(m->tables, 0, sizeof(m->tables));
+   m->text = text;
+   m->textLines = textLines;
+   m->pagesAllocated = 0;
+   m->backing = NULL;
+   m->backingLen = 0;
+}
+
+void memFree(memory *m) {
+   int i, j;
+
+   for (i = 0; i < 1 << MEM_DIR_BITS; i++) {
+      if (m->tables[i] == NULL)
+         continue;
+      for (j = 0; j < 1 << MEM_TABLE_BITS; j++) {
+         if (!memBacked(m, m->tables[i]->pages[j]))
+            free(m->tables[i]->pages[j]);
+      }
+      free(m->tables[i]);
+   }
+   if (m->backing != NULL)
+      munmap(m->backing, m->backingLen);
+   memInit(m, m->text, m->textLines);
+}
+
+/**
+ * Slow path of a store: allocate the zeroed page (and its table) holding
+ * addr. Running out of host memory ends the simulation.
+ */
+unsigned char *memPageAlloc(memory *m, unsigned int addr) {
+   memTable **t = &m->tables[addr >> (MEM_TABLE_BITS + MEM_PAGE_BITS)];
+   unsigned char **page;
+
+   if (*t == NULL && (*t = calloc(1, sizeof(memTable))) == NULL) {
+      perror("memory table");
+      exit(1);
+   }
+
+   page = &(*t)->pages[(addr >> MEM_PAGE_BITS) & ((1 << MEM_TABLE_BITS) - 1)];
+   if (*page == NULL) {
+      if ((*page = calloc(1, MEM_PAGE_SIZE)) == NULL) {
+         perror("memory page");
+         exit(1);
+      }
+      m->pagesAllocated++;
+   }
+
+   return *page;
+}
+
+/**
+ * Fill dst, freshly initialised, with a copy of every page of src. The
+ * copies are all on the heap, pages src has in a snapshot mapping too.
+ */
+void memCopy(memory *dst, memory *src) {
+   unsigned int addr;
+   int i, j;
+
+   for (i = 0; i < 1 << MEM_DIR_BITS; i++) {
+      if (src->tables[i] == NULL)
+         continue;
+      for (j = 0; j < 1 << MEM_TABLE_BITS; j++) {
+         if (src->tables[i]->pages[j] == NULL)
+            continue;
+         addr = (unsigned int) i << (MEM_TABLE_BITS + MEM_PAGE_BITS) | (unsigned int) j << MEM_PAGE_BITS;
+         memcpy(memPageAlloc(dst, addr), src->tables[i]->pages[j], MEM_PAGE_SIZE);
+      }
+   }
+}
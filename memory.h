@@ -0,0 +1,102 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <string.h>
+#include "simulator.h"
+
+#define MEM_PAGE_BITS 12
+#define MEM_PAGE_SIZE (1 << MEM_PAGE_BITS)
+#define MEM_TABLE_BITS 10
+#define MEM_DIR_BITS (32 - MEM_TABLE_BITS - MEM_PAGE_BITS)
+
+#define MEM_DATA_BASE 0x10000000
+#define MEM_GP_INIT 0x10008000
+#define MEM_STACK_TOP 0x7FFFEFFC
+
+/**
+ * 32-bit byte addressed memory. The text segment is the assembled program
+ * itself, word addressed from INITIAL_PC, so stores into it still reach
+ * the code. Everything else (data from MEM_DATA_BASE, the stack growing
+ * down from MEM_STACK_TOP) lives in 4 KiB pages behind a two level table
+ * and is allocated the first time it is written; unwritten memory reads as
+ * zero. There is no address error exception, so word accesses ignore the
+ * low two address bits.
+ */
+typedef struct {
+   unsigned char *pages[1 << MEM_TABLE_BITS];
+} memTable;
+
+typedef struct {
+   memTable *tables[1 << MEM_DIR_BITS];
+   line *text;
+   int textLines;
+   long pagesAllocated;
+   unsigned char *backing;   // private mapping of a restored snapshot, NULL for none
+   size_t backingLen;        // pages inside it belong to the mapping, not the heap
+} memory;
+
+void memInit(memory *m, line *text, int textLines);
+
+void memFree(memory *m);
+
+/**
+ * Whether page lives in the snapshot mapping rather than on the heap
+ */
+static inline int memBacked(memory *m, unsigned char *page) {
+   return m->backing != NULL && page >= m->backing && page < m->backing + m->backingLen;
+}
+
+unsigned char *memPageAlloc(memory *m, unsigned int addr);
+
+void memCopy(memory *dst, memory *src);
+
+/**
+ * Text line holding addr, or -1 when addr is outside the text segment
+ */
+static inline int memTextLine(memory *m, unsigned int addr) {
+   unsigned int index = ((addr & ~3u) - INITIAL_PC) / 4;
+
+   return index < (unsigned int) m->textLines ? (int) index : -1;
+}
+
+static inline unsigned char *memPage(memory *m, unsigned int addr) {
+   memTable *t = m->tables[addr >> (MEM_TABLE_BITS + MEM_PAGE_BITS)];
+
+   return t == NULL ? NULL : t->pages[(addr >> MEM_PAGE_BITS) & ((1 << MEM_TABLE_BITS) - 1)];
+}
+
+static inline int memLoadWord(memory *m, unsigned int addr) {
+   unsigned char *page;
+   int lineNum, val;
+
+   addr &= ~3u;
+   if ((lineNum = memTextLine(m, addr)) >= 0)
+      return m->text[lineNum].inst;
+   if ((page = memPage(m, addr)) == NULL)
+      return 0;
+
+   memcpy(&val, page + (addr & (MEM_PAGE_SIZE - 1)), 4);
+   return val;
+}
+
+/**
+ * Store a word. Returns the text line written, or -1 for data, so callers
+ * can drop anything they decoded from that line.
+ */
+static inline int memStoreWord(memory *m, unsigned int addr, int val) {
+   unsigned char *page;
+   int lineNum;
+
+   addr &= ~3u;
+   if ((lineNum = memTextLine(m, addr)) >= 0) {
+      m->text[lineNum].inst = val;
+      return lineNum;
+   }
+   if ((page = memPage(m, addr)) == NULL)
+      page = memPageAlloc(m, addr);
+
+   memcpy(page + (addr & (MEM_PAGE_SIZE - 1)), &val, 4);
+   return -1;
+}
+
+#endif
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "assembler.h"
+#include "image.h"
+
+/**
+ * Standalone driver: assemble a file (or stdin for "-") in one pass and
+ * print each instruction word in hex, or with -o write a binary image the
+ * simulator can load without assembling.
+ */
+int main(int argc, char **argv) {
+   asmSource source;
+   symtab symbolTable;
+   line *prog;
+   FILE *out;
+   char *outPath = NULL, *path;
+   int numLines, progSize, opt;
+
+   while ((opt = getopt(argc, argv, "o:")) != -1) {
+      if (opt != 'o') {
+         optind = argc;
+         break;
+      }
+      outPath = optarg;
+   }
+   if (optind >= argc) {
+      fprintf(stderr, "usage: %s [-o image] file.asm|-\n", argv[0]);
+      return 1;
+   }
+   path = argv[optind];
+
+   if (sourceOpen(path, &source) != 0) {
+      perror(path);
+      return 1;
+   }
+
+   progSize = sourceLineCount(source.text, source.len);
+   prog = calloc(progSize, sizeof(line));
+   if (prog == NULL) {
+      perror("calloc");
+      return 1;
+   }
+
+   symtabInit(&symbolTable);
+   numLines = assemble(source.text, source.len, prog, progSize, &symbolTable);
+   sourceClose(&source);
+   if (numLines < 0) {
+      perror(path);
+      return 1;
+   }
+
+   if (outPath == NULL) {
+      printAssembled(numLines);
+   } else if ((out = fopen(outPath, "wb")) == NULL
+    || imageWrite(out, prog, numLines, NULL, 0, &symbolTable) != 0
+    || fclose(out) != 0) {
+      perror(outPath);
+      return 1;
+   }
+
+   free(prog);
+   symtabFree(&symbolTable);
+   return 0;
+}
@@ -0,0 +1,428 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ooo.h"
+#include "cache.h"
+#include "bpred.h"
+#include "trace.h"
+
+#define ROB_WAITING 0     // dispatched, sitting in a reservation station
+#define ROB_EXECUTING 1
+#define ROB_DONE 2
+
+#define LOAD_LATENCY 2    // address then memory, before any cache penalty
+
+/**
+ * Out-of-order timing model. Instructions are fetched along the predicted
+ * path, renamed onto ROB entries at dispatch, issue from a unified pool of
+ * reservation stations as soon as their operands are broadcast, and
+ * commit in order. Stores write memory at commit; loads wait for every
+ * older store address and take a matching store's data straight from the
+ * queue. Mispredicts are repaired when the branch commits, and a store
+ * into the text squashes and refetches everything younger, which may have
+ * been fetched before the store wrote it.
+ */
+typedef struct {
+   status s;          // decoded instruction, ALU results once it has executed
+   int line;
+   int dest;          // architectural register written, -1 for none
+   int state;
+   long doneCycle;
+   int tag[2];        // ROB index producing each source, -1 once val holds it
+   int val[2];
+   int value;         // result, the loaded word for a LW
+   int actualNext;    // line that really follows, known once executed
+   int exit;          // a SYSCALL that ends the program
+} robEntry;
+
+static oooConfig cfg;
+static oooStats stats;
+static int bucketWidth;
+static robEntry *rob;
+static int head, count;
+static int rsUsed, lsqUsed;
+static int map[NUM_REGISTERS];    // youngest in-flight writer, -1 for the register file
+static status fetchQueue[OOO_FETCH_QUEUE];
+static int fqHead, fqCount;
+static int fetchNext;
+static long fetchStallUntil;
+
+static robEntry *robAt(int k) {
+   return &rob[(head + k) % cfg.robSize];
+}
+
+static int isMemOp(status *s) {
+   return s->inst.type == LW_CODE || s->inst.type == SW_CODE;
+}
+
+/**
+ * Drop everything behind the committing instruction, go back to the
+ * register file for every source and fetch again from next
+ */
+static void flush(int next) {
+   int r;
+
+   stats.squashed += count + fqCount;
+   count = 0;
+   fqCount = 0;
+   rsUsed = 0;
+   lsqUsed = 0;
+   for (r = 0; r < NUM_REGISTERS; r++)
+      map[r] = -1;
+   fetchNext = next;
+}
+
+/**
+ * Retire up to width finished instructions from the head. Returns 1 when
+ * a SYSCALL exit or the instruction budget ends the run.
+ */
+static int commit(memory *mem, int *regs, long maxInsts, long *memRefs, long *instExec) {
+   robEntry *e;
+   int n, kind, index, patched;
+
+   for (n = 0; n < cfg.width && count > 0; n++) {
+      e = robAt(0);
+      if (e->state != ROB_DONE)
+         break;
+      patched = 0;
+      index = head;
+      head = (head + 1) % cfg.robSize;
+      count--;
+      stats.committed++;
+
+      if (traceEnabled)
+         traceInst(e->line * 4 + INITIAL_PC, e->s.inst.inst);
+      if (e->s.exec)
+         (*instExec)++;
+      if (e->dest >= 0 && e->s.writeBack)
+         regs[e->dest] = e->value;
+      if (e->dest >= 0 && map[e->dest] == index)
+         map[e->dest] = -1;
+      if (e->s.inst.type == LW_CODE) {
+         lsqUsed--;
+         *memRefs += 1;
+      } else if (e->s.inst.type == SW_CODE) {
+         //The store buffer hides the write latency, the cache still sees it
+         if (cacheEnabled)
+            cacheWrite(e->s.aluOut);
+         patched = memStoreWord(mem, e->s.aluOut, e->s.storeData) >= 0;
+         lsqUsed--;
+         *memRefs += 1;
+      }
+
+      kind = branchKind(&e->s);
+      if (bpredEnabled && kind >= 0 && !e->exit)
+         bpredResolve(e->line, kind, e->s.flush, kind == BRANCH_COND
+          ? e->line + (short) (e->s.inst.inst & 0xFFFF) : e->actualNext,
+          e->s.predicted, count + fqCount);
+
+      if (e->exit || (maxInsts >= 0 && *instExec >= maxInsts))
+         return 1;
+      if (e->actualNext != e->s.predicted) {
+         stats.mispredicts++;
+         flush(e->actualNext);
+         break;
+      }
+      if (patched && count + fqCount > 0) {
+         stats.textStores++;
+         flush(e->actualNext);
+         break;
+      }
+   }
+
+   return 0;
+}
+
+/**
+ * Finish whatever reaches its done cycle and broadcast the result to the
+ * reservation stations waiting on it
+ */
+static void complete(long now) {
+   robEntry *e, *w;
+   int k, j, index;
+
+   for (k = 0; k < count; k++) {
+      e = robAt(k);
+      if (e->state != ROB_EXECUTING || e->doneCycle > now)
+         continue;
+      e->state = ROB_DONE;
+      if (e->dest < 0)
+         continue;
+      index = (head + k) % cfg.robSize;
+      for (j = k + 1; j < count; j++) {
+         w = robAt(j);
+         if (w->tag[0] == index)
+            w->tag[0] = -1, w->val[0] = e->value;
+         if (w->tag[1] == index)
+            w->tag[1] = -1, w->val[1] = e->value;
+      }
+   }
+}
+
+/**
+ * Disambiguate a load at addr against the older stores. Returns -1 while
+ * one of them has no address yet, otherwise 1 with *value set from the
+ * youngest store to the same word, or 0 to go to memory.
+ */
+static int searchStores(int k, unsigned int addr, int *value) {
+   robEntry *o;
+   int j, found = 0;
+
+   for (j = 0; j < k; j++) {
+      o = robAt(j);
+      if (o->s.inst.type != SW_CODE)
+         continue;
+      if (o->state == ROB_WAITING)
+         return -1;
+      if (((unsigned int) o->s.aluOut & ~3u) == (addr & ~3u)) {
+         *value = o->s.storeData;
+         found = 1;
+      }
+   }
+
+   return found;
+}
+
+/**
+ * Issue up to width ready instructions, oldest first, within the ALU and
+ * memory port limits
+ */
+static void issue(memory *mem, long now) {
+   int k, issued = 0, alus = 0, ports = 0, extra, latency, forwarded, value = 0;
+   robEntry *e;
+   status s;
+
+   for (k = 0; k < count && issued < cfg.width; k++) {
+      e = robAt(k);
+      if (e->state != ROB_WAITING || e->tag[0] >= 0 || e->tag[1] >= 0)
+         continue;
+      if (isMemOp(&e->s) ? ports == cfg.memPorts : alus == cfg.alus) {
+         stats.unitBusy++;
+         continue;
+      }
+
+      extra = 0;
+      s = aluExecute(e->s, e->val[0], e->val[1], &extra);
+      latency = 1 + extra;
+      if (s.inst.type == LW_CODE) {
+         forwarded = searchStores(k, s.aluOut, &value);
+         if (forwarded < 0) {
+            stats.memOrder++;
+            continue;
+         }
+         latency = LOAD_LATENCY;
+         if (forwarded) {
+            stats.loadsForwarded++;
+         } else {
+            if (cacheEnabled)
+               latency += cacheRead(s.aluOut);
+            value = memLoadWord(mem, s.aluOut);
+         }
+      } else if (s.inst.type == SW_CODE) {
+         s.storeData = e->val[1];
+      } else {
+         value = s.aluOut;
+      }
+
+      if (isMemOp(&s))
+         ports++;
+      else
+         alus++;
+      issued++;
+      rsUsed--;
+      e->s = s;
+      e->value = value;
+      e->state = ROB_EXECUTING;
+      e->doneCycle = now + latency;
+      e->exit = s.flush && s.pc < 0;
+      e->actualNext = s.flush ? (s.pc - PROG_START) / 4 : e->line + 1;
+   }
+}
+
+/**
+ * Rename and dispatch up to width instructions from the fetch queue into
+ * the ROB, reservation stations and load/store queue
+ */
+static void dispatch(int *regs, long now) {
+   int n, j, r, index, src[2];
+   long *lost = NULL;
+   robEntry *e, *p;
+   status s;
+
+   for (n = 0; n < cfg.width; n++) {
+      if (fqCount == 0) {
+         lost = &stats.lostFetch;
+         break;
+      }
+      s = instructionDecode(fetchQueue[fqHead]);
+      if (count == cfg.robSize) {
+         lost = &stats.lostRobFull;
+         break;
+      }
+      if (!s.nop && rsUsed == cfg.rsSize) {
+         lost = &stats.lostRsFull;
+         break;
+      }
+      if (isMemOp(&s) && lsqUsed == cfg.lsqSize) {
+         lost = &stats.lostLsqFull;
+         break;
+      }
+      fqHead = (fqHead + 1) % OOO_FETCH_QUEUE;
+      fqCount--;
+
+      index = (head + count) % cfg.robSize;
+      e = &rob[index];
+      count++;
+      memset(e, 0, sizeof(*e));
+      e->s = s;
+      e->line = (s.pc - PROG_START) / 4;
+      e->dest = destRegister(&s);
+      e->actualNext = e->line + 1;
+      sourceRegisters(&s, &src[0], &src[1]);
+      for (j = 0; j < 2; j++) {
+         r = src[j];
+         e->tag[j] = -1;
+         if (r < 0)
+            continue;
+         if (map[r] < 0) {
+            e->val[j] = regs[r];
+         } else {
+            p = &rob[map[r]];
+            if (p->state == ROB_DONE)
+               e->val[j] = p->value;
+            else
+               e->tag[j] = map[r];
+         }
+      }
+      if (e->dest >= 0)
+         map[e->dest] = index;
+
+      if (s.nop) {
+         e->state = ROB_DONE;
+         e->doneCycle = now;
+      } else {
+         e->state = ROB_WAITING;
+         rsUsed++;
+      }
+      if (isMemOp(&s))
+         lsqUsed++;
+   }
+
+   if (lost != NULL)
+      *lost += cfg.width - n;
+}
+
+/**
+ * Fetch up to width lines along the predicted path into the fetch queue,
+ * ending the group at a predicted taken transfer or an I-cache miss
+ */
+static void fetch(memory *mem, long now) {
+   status *s;
+   int n, line, penalty;
+
+   if (now < fetchStallUntil)
+      return;
+   for (n = 0; n < cfg.width && fqCount < OOO_FETCH_QUEUE; n++) {
+      line = fetchNext;
+      if (line < 0 || line >= mem->textLines)
+         return;
+      s = &fetchQueue[(fqHead + fqCount++) % OOO_FETCH_QUEUE];
+      initStatus(s);
+      s->pc = PROG_START + line * 4;
+      s->inst = mem->text[line];
+      s->busy = 1;
+      s->predicted = bpredEnabled ? bpredPredict(line) : line + 1;
+      fetchNext = s->predicted;
+
+      penalty = cacheEnabled ? cacheFetch(line * 4 + INITIAL_PC) : 0;
+      if (penalty > 0) {
+         fetchStallUntil = now + 1 + penalty;
+         return;
+      }
+      if (s->predicted != line + 1)
+         return;
+   }
+}
+
+/**
+ * Run the program from line start until a SYSCALL exit commits, fetch runs
+ * off the end of the text, or *instExec reaches maxInsts. Returns -1 if the
+ * ROB cannot be allocated.
+ */
+int runOoo(memory *mem, int *regs, const oooConfig *config, int start, long maxInsts,
+ long *memRefs, long *clockCycles, long *instExec) {
+   long now;
+   int r;
+
+   cfg = *config;
+   memset(&stats, 0, sizeof(stats));
+   bucketWidth = (cfg.robSize + OOO_HISTOGRAM_BUCKETS) / OOO_HISTOGRAM_BUCKETS;
+   rob = malloc(cfg.robSize * sizeof(robEntry));
+   if (rob == NULL)
+      return -1;
+   head = count = rsUsed = lsqUsed = 0;
+   fqHead = fqCount = 0;
+   fetchNext = start;
+   fetchStallUntil = 0;
+   for (r = 0; r < NUM_REGISTERS; r++)
+      map[r] = -1;
+
+   for (now = 0; ; now++) {
+      stats.robOccupancy += count;
+      stats.histogram[count / bucketWidth]++;
+      if (commit(mem, regs, maxInsts, memRefs, instExec))
+         break;
+      complete(now);
+      issue(mem, now);
+      dispatch(regs, now);
+      fetch(mem, now);
+      if (count == 0 && fqCount == 0 && (fetchNext < 0 || fetchNext >= mem->textLines))
+         break;
+   }
+   stats.cycles = now + 1;
+   *clockCycles += stats.cycles;
+
+   free(rob);
+   rob = NULL;
+
+   return 0;
+}
+
+void oooPrintStats(FILE *out) {
+   int b;
+
+   fprintf(out, "ooo: width %d, rob %d, rs %d, lsq %d: IPC %.3f, rob occupancy %.2f\n",
+    cfg.width, cfg.robSize, cfg.rsSize, cfg.lsqSize,
+    stats.cycles ? (double) stats.committed / stats.cycles : 0.0,
+    stats.cycles ? (double) stats.robOccupancy / stats.cycles : 0.0);
+   fprintf(out, "ooo lost dispatch slots: fetch %ld, rob full %ld, rs full %ld, lsq full %ld\n",
+    stats.lostFetch, stats.lostRobFull, stats.lostRsFull, stats.lostLsqFull);
+   fprintf(out, "ooo: %ld unit busy, %ld memory order waits, %ld loads forwarded, "
+    "%ld mispredicts, %ld text stores, %ld squashed\n", stats.unitBusy, stats.memOrder,
+    stats.loadsForwarded, stats.mispredicts, stats.textStores, stats.squashed);
+   fprintf(out, "ooo rob occupancy (cycles):");
+   for (b = 0; b < OOO_HISTOGRAM_BUCKETS && b * bucketWidth <= cfg.robSize; b++)
+      fprintf(out, " %d-%d: %ld", b * bucketWidth, b * bucketWidth + bucketWidth - 1 < cfg.robSize
+       ? b * bucketWidth + bucketWidth - 1 : cfg.robSize, stats.histogram[b]);
+   fprintf(out, "\n");
+}
+
+/**
+ * Print the counters as a JSON object member, leading comma included
+ */
+void oooPrintStatsJson(FILE *out) {
+   int b;
+
+   fprintf(out, ", \"ooo\": {\"width\": %d, \"rob\": %d, \"rs\": %d, \"lsq\": %d, "
+    "\"ipc\": %.3f, \"committed\": %ld, \"lost\": {\"fetch\": %ld, \"rob_full\": %ld, "
+    "\"rs_full\": %ld, \"lsq_full\": %ld}, \"unit_busy\": %ld, \"memory_order\": %ld, "
+    "\"loads_forwarded\": %ld, \"mispredicts\": %ld, \"text_stores\": %ld, \"squashed\": %ld, "
+    "\"rob_occupancy\": %ld, \"rob_bucket\": %d, \"rob_histogram\": [",
+    cfg.width, cfg.robSize, cfg.rsSize, cfg.lsqSize,
+    stats.cycles ? (double) stats.committed / stats.cycles : 0.0, stats.committed,
+    stats.lostFetch, stats.lostRobFull, stats.lostRsFull, stats.lostLsqFull,
+    stats.unitBusy, stats.memOrder, stats.loadsForwarded, stats.mispredicts,
+    stats.textStores, stats.squashed, stats.robOccupancy, bucketWidth);
+   for (b = 0; b < OOO_HISTOGRAM_BUCKETS && b * bucketWidth <= cfg.robSize; b++)
+      fprintf(out, "%s%ld", b ? ", " : "", stats.histogram[b]);
+   fprintf(out, "]}");
+}
@@ -0,0 +1,52 @@
+#ifndef OOO_H
+#define OOO_H
+
+#include <stdio.h>
+#include "pipeline.h"
+#include "memory.h"
+
+#define OOO_ROB_SIZE 32
+#define OOO_RS_SIZE 16
+#define OOO_LSQ_SIZE 16
+#define OOO_MAX_ROB 1024
+#define OOO_FETCH_QUEUE 16
+#define OOO_HISTOGRAM_BUCKETS 8
+
+typedef struct {
+   int width;      // instructions fetched, dispatched, issued and committed per cycle
+   int robSize;
+   int rsSize;     // dispatched instructions waiting to issue
+   int lsqSize;    // LW/SW between dispatch and commit
+   int alus;       // ALU instructions issued per cycle
+   int memPorts;   // LW/SW issued per cycle
+} oooConfig;
+
+/**
+ * Counters for one run. Dispatch slots that went unused are charged to
+ * what stopped dispatch; the ROB histogram counts cycles by occupancy.
+ */
+typedef struct {
+   long cycles;
+   long committed;
+   long lostFetch;      // dispatch slots with the fetch queue empty
+   long lostRobFull;
+   long lostRsFull;
+   long lostLsqFull;
+   long unitBusy;       // ready instructions left waiting for an ALU or port
+   long memOrder;       // load issues held back by an older store's unknown address
+   long loadsForwarded; // loads satisfied from an older store in the LSQ
+   long mispredicts;
+   long textStores;     // committed stores into the text that squashed younger instructions
+   long squashed;
+   long robOccupancy;   // summed over cycles
+   long histogram[OOO_HISTOGRAM_BUCKETS];
+} oooStats;
+
+int runOoo(memory *mem, int *regs, const oooConfig *config, int start, long maxInsts,
+ long *memRefs, long *clockCycles, long *instExec);
+
+void oooPrintStats(FILE *out);
+
+void oooPrintStatsJson(FILE *out);
+
+#endif
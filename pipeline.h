@@ -0,0 +1,46 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "simulator.h"
+
+/**
+ * One instruction moving through the pipeline stages. The stage functions
+ * live in simulator.c; the out-of-order model (ooo.c) reuses the field
+ * extraction and ALU semantics through the functions below.
+ */
+typedef struct {
+   line inst;
+   int pc;
+   int rs;
+   int rt;
+   int rd;
+   int shamt;
+   int imm;
+   int opCode;
+   int funcCode;
+   int aluOut;
+   int storeData;   // rt for a SW, read in EX and stored in MEM
+   int predicted;   // line fetch went to after this one
+   int flush;
+   int busy;
+   int writeBack;
+   int exec;
+   int nop;
+   unsigned int seq;   // fetch order, for the stage log
+   int fetchPc;        // pc it was fetched from, pc follows a taken transfer
+   // LOGIC TO WRITE BACK
+} status;
+
+void initStatus(status *s);
+
+status instructionDecode(status s);
+
+status aluExecute(status s, int a, int b, int *extraCycles);
+
+int destRegister(status *s);
+
+void sourceRegisters(status *s, int *src1, int *src2);
+
+int branchKind(status *s);
+
+#endif
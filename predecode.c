@@ -0,0 +1,102 @@
+#include "predecode.h"
+
+const char *const uopNames[NUM_UOPS] = {
+   "undecoded", "and", "or", "ori", "add", "addu", "addi", "addiu", "sll", "srl", "sra", "sub",
+   "slt", "slti", "sltu", "sltiu", "beq", "bne", "lui", "lw", "sw", "j", "jr", "jal", "syscall",
+   "nop"
+};
+
+/**
+ * Decode one assembled line into a micro-op. Fields are extracted once here
+ * so the run loop never has to shift and mask the instruction word again.
+ */
+void predecodeLine(line *inst, int lineNum, uop *op) {
+   int address;
+
+   op->rs = (inst->inst >> 21) & 0x1F;
+   op->rt = (inst->inst >> 16) & 0x1F;
+   op->rd = (inst->inst >> 11) & 0x1F;
+   op->shamt = (inst->inst >> 6) & 0x1F;
+   op->imm = inst->inst & 0xFFFF;
+   op->target = lineNum + 1;
+   op->cycles = 4;
+
+   if (inst->type == AND_CODE) {
+      op->handler = UOP_AND;
+   } else if (inst->type == OR_CODE) {
+      op->handler = UOP_OR;
+   } else if (inst->type == ORI_CODE) {
+      op->handler = UOP_ORI;
+      op->imm = (short) op->imm;
+   } else if (inst->type == ADD_CODE) {
+      op->handler = UOP_ADD;
+   } else if (inst->type == ADDU_CODE) {
+      op->handler = UOP_ADDU;
+   } else if (inst->type == ADDI_CODE) {
+      op->handler = UOP_ADDI;
+      op->imm = (short) op->imm;
+   } else if (inst->type == ADDIU_CODE) {
+      op->handler = UOP_ADDIU;
+   } else if (inst->type == SLL_CODE) {
+      op->handler = UOP_SLL;
+      op->cycles = op->shamt + 5;
+   } else if (inst->type == SRL_CODE) {
+      op->handler = UOP_SRL;
+      op->cycles = op->shamt + 5;
+   } else if (inst->type == SRA_CODE) {
+      op->handler = UOP_SRA;
+      op->cycles = op->shamt + 5;
+   } else if (inst->type == SUB_CODE) {
+      op->handler = UOP_SUB;
+   } else if (inst->type == SLT_CODE) {
+      op->handler = UOP_SLT;
+   } else if (inst->type == SLTI_CODE) {
+      op->handler = UOP_SLTI;
+   } else if (inst->type == SLTU_CODE) {
+      op->handler = UOP_SLTU;
+   } else if (inst->type == SLTIU_CODE) {
+      op->handler = UOP_SLTIU;
+   } else if (inst->type == BEQ_CODE || inst->type == BNE_CODE) {
+      op->handler = inst->type == BEQ_CODE ? UOP_BEQ : UOP_BNE;
+      address = op->imm;
+      if (address & 0x8000)
+         address += 0xFFFF0000;
+      op->target = lineNum + address;
+      op->cycles = 3;
+   } else if (inst->type == LUI_CODE) {
+      op->handler = UOP_LUI;
+      op->imm = (op->imm << 16) & 0xFFFF0000;
+   } else if (inst->type == LW_CODE) {
+      op->handler = UOP_LW;
+      op->imm = (short) op->imm;
+      op->cycles = 5;
+   } else if (inst->type == SW_CODE) {
+      op->handler = UOP_SW;
+      op->imm = (short) op->imm;
+   } else if (inst->type == J_CODE || inst->type == JAL_CODE) {
+      op->handler = inst->type == J_CODE ? UOP_J : UOP_JAL;
+      op->target = ((inst->inst & 0x1FFFFFF) * 4 - INITIAL_PC) / 4;
+      op->cycles = 3;
+   } else if (inst->type == JR_CODE) {
+      op->handler = UOP_JR;
+      op->cycles = 3;
+   } else if (inst->type == SYSCALL_CODE) {
+      op->handler = UOP_SYSCALL;
+      op->target = lineNum;
+      op->cycles = 0;
+   } else {
+      op->handler = UOP_NOP;
+      op->cycles = 0;
+   }
+}
+
+/**
+ * Predecode the whole text segment
+ */
+void predecode(line *prog, int numLines, uop *ops) {
+   int i;
+
+   for (i = 0; i < numLines; i++) {
+      predecodeLine(&prog[i], i, &ops[i]);
+   }
+}
@@ -0,0 +1,57 @@
+#ifndef PREDECODE_H
+#define PREDECODE_H
+
+#include "simulator.h"
+
+/**
+ * Handler ids for predecoded instructions. UOP_UNDECODED marks an entry
+ * that has to be decoded again before it runs (e.g. after a SW into text).
+ */
+enum {
+   UOP_UNDECODED = 0,
+   UOP_AND,
+   UOP_OR,
+   UOP_ORI,
+   UOP_ADD,
+   UOP_ADDU,
+   UOP_ADDI,
+   UOP_ADDIU,
+   UOP_SLL,
+   UOP_SRL,
+   UOP_SRA,
+   UOP_SUB,
+   UOP_SLT,
+   UOP_SLTI,
+   UOP_SLTU,
+   UOP_SLTIU,
+   UOP_BEQ,
+   UOP_BNE,
+   UOP_LUI,
+   UOP_LW,
+   UOP_SW,
+   UOP_J,
+   UOP_JR,
+   UOP_JAL,
+   UOP_SYSCALL,
+   UOP_NOP,
+   NUM_UOPS
+};
+
+typedef struct {
+   int handler;
+   int rs;
+   int rt;
+   int rd;
+   int shamt;
+   int imm;      // operand ready to use (sign/zero extended per instruction)
+   int target;   // line index of a taken branch or jump
+   int cycles;   // clock cycles charged by the functional engine
+} uop;
+
+extern const char *const uopNames[NUM_UOPS];
+
+void predecodeLine(line *inst, int lineNum, uop *op);
+
+void predecode(line *prog, int numLines, uop *ops);
+
+#endif
@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+#include "assembler.h"
+
+int profileEnabled = 0;
+profileCounters *profileLines;
+
+/**
+ * Start profiling a program of lines text lines. Returns 0, or -1 when
+ * there is no memory for the counters.
+ */
+int profileInit(int lines) {
+   if ((profileLines = calloc(lines + 1, sizeof(profileCounters))) == NULL)
+      return -1;
+   profileEnabled = 1;
+   return 0;
+}
+
+static int byCycles(const void *a, const void *b) {
+   int i = *(const int *) a, j = *(const int *) b;
+   const profileCounters *x = &profileLines[i], *y = &profileLines[j];
+
+   if (x->cycles != y->cycles)
+      return x->cycles < y->cycles ? 1 : -1;
+   if (x->execs != y->execs)
+      return x->execs < y->execs ? 1 : -1;
+   return i - j;
+}
+
+/**
+ * For each text line, the text label at or before it (-1 for none), so
+ * addresses can be shown as label+offset
+ */
+static void lineLabels(const machine *m, int *labels) {
+   const symbolEntry *e;
+   int i, line;
+
+   for (i = 0; i < m->textLines; i++)
+      labels[i] = -1;
+   for (i = 0; i < m->symbolTable.count; i++) {
+      e = &m->symbolTable.entries[i];
+      line = (e->loc - INITIAL_PC) / 4;
+      if (e->defined && e->loc >= INITIAL_PC && line < m->textLines
+       && (labels[line] < 0 || m->symbolTable.entries[labels[line]].loc != e->loc))
+         labels[line] = i;
+   }
+   for (i = 1; i < m->textLines; i++) {
+      if (labels[i] < 0)
+         labels[i] = labels[i - 1];
+   }
+}
+
+static void printSymbol(FILE *out, const machine *m, const int *labels, int line, int width) {
+   const symbolEntry *e;
+   char name[64];
+   int off;
+
+   if (labels[line] < 0) {
+      fprintf(out, "%-*s", width, "");
+      return;
+   }
+   e = &m->symbolTable.entries[labels[line]];
+   off = line * 4 + INITIAL_PC - e->loc;
+   if (off)
+      snprintf(name, sizeof(name), "%.*s+%d", e->len, e->symbol, off);
+   else
+      snprintf(name, sizeof(name), "%.*s", e->len, e->symbol);
+   fprintf(out, "%-*s", width, name);
+}
+
+static void printCounters(FILE *out, const profileCounters *c) {
+   fprintf(out, "%10ld %10ld %8ld %8ld %8ld |", c->cycles, c->execs, c->stalls, c->flushes,
+    c->misses);
+}
+
+/**
+ * Flat profile: every instruction that ran or was charged cycles, hottest
+ * first. order is scratch space for one entry per text line.
+ */
+static void flatProfile(FILE *out, const machine *m, const int *labels, int *order) {
+   const profileCounters *c;
+   long totalCycles = 0, totalExecs = 0;
+   int count = 0, i;
+
+   for (i = 0; i < m->textLines; i++) {
+      totalCycles += profileLines[i].cycles;
+      totalExecs += profileLines[i].execs;
+      if (profileLines[i].cycles || profileLines[i].execs)
+         order[count++] = i;
+   }
+   qsort(order, count, sizeof(int), byCycles);
+
+   fprintf(out, "Flat profile: %ld clock cycles, %ld instructions\n\n", totalCycles, totalExecs);
+   fprintf(out, "%7s %10s %10s %7s %8s %8s %8s  %-10s %s\n", "%cycles", "cycles", "execs",
+    "CPI", "stalls", "flushes", "misses", "address", "symbol");
+   for (i = 0; i < count; i++) {
+      c = &profileLines[order[i]];
+      fprintf(out, "%7.2f %10ld %10ld %7.2f %8ld %8ld %8ld  0x%08X ",
+       totalCycles ? 100.0 * c->cycles / totalCycles : 0.0, c->cycles, c->execs,
+       c->execs ? (double) c->cycles / c->execs : 0.0, c->stalls, c->flushes, c->misses,
+       order[i] * 4 + INITIAL_PC);
+      printSymbol(out, m, labels, order[i], 20);
+      if (m->sourceLines[order[i]])
+         fprintf(out, " line %d", m->sourceLines[order[i]]);
+      fprintf(out, "\n");
+   }
+}
+
+/**
+ * Annotated listing: the source with each instruction's counters beside
+ * the line it was assembled from. Programs loaded from an image or a
+ * snapshot have no source, so their text is listed by address instead.
+ */
+static void annotatedListing(FILE *out, const machine *m, const int *labels, const char *source) {
+   asmSource src;
+   const char *p, *end, *eol;
+   int i, srcLine = 0;
+
+   fprintf(out, "\nAnnotated listing\n\n%10s %10s %8s %8s %8s |\n", "cycles", "execs", "stalls",
+    "flushes", "misses");
+
+   if (m->textLines == 0 || m->sourceLines[0] == 0 || source == NULL || !strcmp(source, "-")
+    || sourceOpen(source, &src) != 0) {
+      for (i = 0; i < m->textLines; i++) {
+         printCounters(out, &profileLines[i]);
+         fprintf(out, " 0x%08X  %08X  ", i * 4 + INITIAL_PC, m->assembledLines[i].inst);
+         printSymbol(out, m, labels, i, 0);
+         fprintf(out, "\n");
+      }
+      return;
+   }
+
+   i = 0;
+   for (p = src.text, end = src.text + src.len; p < end; p = eol + 1) {
+      if ((eol = memchr(p, '\n', end - p)) == NULL)
+         eol = end;
+      srcLine++;
+      if (i < m->textLines && m->sourceLines[i] == srcLine)
+         printCounters(out, &profileLines[i++]);
+      else
+         fprintf(out, "%48s |", "");
+      fprintf(out, " %5d: %.*s\n", srcLine, (int) (eol - p), p);
+   }
+   sourceClose(&src);
+}
+
+/**
+ * Write the flat profile and annotated listing of m to path ("-" for
+ * stdout). source is the file m was loaded from. Returns 0 or -1.
+ */
+int profileWrite(const char *path, machine *m, const char *source) {
+   FILE *out = strcmp(path, "-") ? fopen(path, "w") : stdout;
+   int *labels, err;
+
+   if (out == NULL)
+      return -1;
+   //A label and a sort slot per text line
+   if ((labels = malloc((m->textLines + 1) * 2 * sizeof(int))) == NULL) {
+      if (out != stdout)
+         fclose(out);
+      return -1;
+   }
+   lineLabels(m, labels);
+   flatProfile(out, m, labels, labels + m->textLines + 1);
+   annotatedListing(out, m, labels, source);
+   free(labels);
+
+   if (out == stdout)
+      return fflush(out) != 0 ? -1 : 0;
+   err = ferror(out);
+   return fclose(out) != 0 || err ? -1 : 0;
+}
@@ -0,0 +1,53 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include "machine.h"
+
+/**
+ * Per-instruction counters, one entry per text line in a flat array that
+ * runs parallel to assembledLines
+ */
+typedef struct {
+   long execs;     // times the instruction executed
+   long cycles;    // clock cycles charged to it
+   long stalls;    // cycles it waited on a load-use interlock
+   long flushes;   // redirects it caused (taken or mispredicted transfers)
+   long misses;    // cache accesses of its that paid a miss penalty
+} profileCounters;
+
+extern int profileEnabled;
+extern profileCounters *profileLines;
+
+int profileInit(int lines);
+
+int profileWrite(const char *path, machine *m, const char *source);
+
+/**
+ * The hooks. Callers check profileEnabled first, as with traceEnabled, so
+ * an unprofiled run pays for one predictable branch. line is trusted to be
+ * a text line.
+ */
+static inline void profileExec(int line, long cycles) {
+   profileLines[line].execs++;
+   profileLines[line].cycles += cycles;
+}
+
+static inline void profileCycles(int line, long cycles) {
+   profileLines[line].cycles += cycles;
+}
+
+static inline void profileStall(int line) {
+   profileLines[line].stalls++;
+}
+
+static inline void profileFlush(int line) {
+   profileLines[line].flushes++;
+}
+
+static inline void profileMiss(int line, int penalty) {
+   if (penalty > 0)
+      profileLines[line].misses++;
+}
+
+#endif
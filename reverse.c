@@ -0,0 +1,190 @@
+#include <stdlib.h>
+#include <string.h>
+#include "reverse.h"
+#include "trace.h"
+
+void reverseInit(reverseLog *rl) {
+   memset(rl, 0, sizeof(*rl));
+}
+
+void reverseFree(reverseLog *rl) {
+   free(rl->log);
+   free(rl->cps);
+   reverseInit(rl);
+}
+
+/**
+ * The register an instruction writes in machineStep, -1 for none
+ */
+static int uopDest(const uop *op) {
+   switch (op->handler) {
+   case UOP_AND: case UOP_OR: case UOP_ADD: case UOP_ADDU: case UOP_SUB:
+   case UOP_SLT: case UOP_SLTU: case UOP_SLL: case UOP_SRL: case UOP_SRA:
+      return op->rd;
+   case UOP_ORI: case UOP_ADDI: case UOP_ADDIU: case UOP_SLTI: case UOP_SLTIU:
+   case UOP_LUI: case UOP_LW:
+      return op->rt;
+   case UOP_JR: case UOP_JAL:
+      return 31;
+   }
+   return -1;
+}
+
+static uop *decoded(machine *m, int pc) {
+   uop *op = &m->decodedLines[pc];
+
+   if (op->handler == UOP_UNDECODED)
+      predecodeLine(&m->assembledLines[pc], pc, op);
+
+   return op;
+}
+
+/**
+ * Log what the step about to run at pos->pc overwrites, taking a
+ * checkpoint first when one is due. Called before every step while
+ * reverse execution is on. Returns 0, or -1 when there is no memory left
+ * to grow the history.
+ */
+int reverseRecord(reverseLog *rl, machine *m, const reversePos *pos) {
+   reverseCheckpoint *cp, *cps;
+   undoEntry *e, *log;
+   uop *op = decoded(m, pos->pc);
+   int dest;
+
+   if (rl->step % REVERSE_INTERVAL == 0
+    && (rl->numCps == 0 || rl->cps[rl->numCps - 1].step != rl->step)) {
+      if (rl->numCps == rl->cpCap) {
+         cps = realloc(rl->cps, (rl->cpCap ? rl->cpCap * 2 : 64) * sizeof(reverseCheckpoint));
+         if (cps == NULL)
+            return -1;
+         rl->cps = cps;
+         rl->cpCap = rl->cpCap ? rl->cpCap * 2 : 64;
+      }
+      cp = &rl->cps[rl->numCps++];
+      cp->step = rl->step;
+      cp->pc = pos->pc;
+      memcpy(cp->registers, m->registers, sizeof(cp->registers));
+      cp->instExec = pos->instExec;
+      cp->memRefs = pos->memRefs;
+      cp->cycles = pos->cycles;
+      cp->undoLen = rl->logLen;
+      cp->written = 0;
+   }
+
+   if (op->handler == UOP_SW) {
+      if (rl->logLen == rl->logCap) {
+         log = realloc(rl->log, (rl->logCap ? rl->logCap * 2 : 1024) * sizeof(undoEntry));
+         if (log == NULL)
+            return -1;
+         rl->log = log;
+         rl->logCap = rl->logCap ? rl->logCap * 2 : 1024;
+      }
+      e = &rl->log[rl->logLen++];
+      e->step = rl->step;
+      e->addr = (m->registers[op->rs] + op->imm) & ~3u;
+      e->old = memLoadWord(&m->mainMemory, e->addr);
+   } else if ((dest = uopDest(op)) >= 0) {
+      rl->cps[rl->numCps - 1].written |= 1u << dest;
+   }
+   rl->step++;
+   return 0;
+}
+
+/**
+ * Run one step forward again, logging it. Clock cycles replayed this way
+ * are the fixed costs; the caches and timing models are not fed twice.
+ */
+static void replayStep(reverseLog *rl, machine *m, reversePos *pos) {
+   streamRecord r;
+
+   //A replay never logs past where the history already reached, so it has the room
+   reverseRecord(rl, m, pos);
+   pos->pc = machineStep(m, &m->decodedLines[pos->pc], &pos->memRefs, pos->pc, &r);
+   pos->cycles += r.op.cycles;
+   pos->instExec++;
+}
+
+/**
+ * Put m and pos where they were before step target ran. Going back
+ * restores the checkpoint at or before target, undoes the memory writes
+ * made since it and replays the rest; going forward just replays.
+ */
+void reverseGoto(reverseLog *rl, machine *m, long target, reversePos *pos) {
+   reverseCheckpoint *cp;
+   undoEntry *e;
+   long idx;
+   int line, tracing = traceEnabled;
+
+   if (target < 0)
+      target = 0;
+   traceEnabled = 0;
+   if (target < rl->step && rl->numCps > 0) {
+      idx = target / REVERSE_INTERVAL;
+      if (idx >= rl->numCps)
+         idx = rl->numCps - 1;
+      cp = &rl->cps[idx];
+      while (rl->logLen > cp->undoLen) {
+         e = &rl->log[--rl->logLen];
+         if ((line = memStoreWord(&m->mainMemory, e->addr, e->old)) >= 0)
+            m->decodedLines[line].handler = UOP_UNDECODED;
+      }
+      memcpy(m->registers, cp->registers, sizeof(m->registers));
+      pos->pc = cp->pc;
+      pos->instExec = cp->instExec;
+      pos->memRefs = cp->memRefs;
+      pos->cycles = cp->cycles;
+      cp->written = 0;
+      rl->numCps = idx + 1;
+      rl->step = cp->step;
+   }
+
+   while (rl->step < target && pos->pc >= 0 && pos->pc < m->textLines)
+      replayStep(rl, m, pos);
+   traceEnabled = tracing;
+}
+
+/**
+ * Go back to just before the last step that wrote reg. Returns that step,
+ * or -1 (leaving everything where it was) when nothing wrote it.
+ */
+long reverseLastRegWrite(reverseLog *rl, machine *m, int reg, reversePos *pos) {
+   long idx, end, found = -1;
+   int tracing = traceEnabled;
+
+   for (idx = rl->numCps - 1; idx >= 0 && !(rl->cps[idx].written & (1u << reg)); idx--)
+      ;
+   if (idx < 0)
+      return -1;
+
+   //The write is somewhere in this interval, replay it to find the step
+   end = idx + 1 < rl->numCps ? rl->cps[idx + 1].step : rl->step;
+   reverseGoto(rl, m, rl->cps[idx].step, pos);
+   traceEnabled = 0;
+   while (rl->step < end) {
+      if (uopDest(decoded(m, pos->pc)) == reg)
+         found = rl->step;
+      replayStep(rl, m, pos);
+   }
+   traceEnabled = tracing;
+   reverseGoto(rl, m, found, pos);
+
+   return found;
+}
+
+/**
+ * Go back to just before the last store to the word holding addr. Returns
+ * that step, or -1 (leaving everything where it was) when there was none.
+ */
+long reverseLastMemWrite(reverseLog *rl, machine *m, unsigned int addr, reversePos *pos) {
+   long i, step;
+
+   for (i = rl->logLen - 1; i >= 0; i--) {
+      if (rl->log[i].addr == (addr & ~3u)) {
+         step = rl->log[i].step;
+         reverseGoto(rl, m, step, pos);
+         return step;
+      }
+   }
+
+   return -1;
+}
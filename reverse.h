@@ -0,0 +1,73 @@
+#ifndef REVERSE_H
+#define REVERSE_H
+
+#include "machine.h"
+
+#define REVERSE_INTERVAL 4096   // steps between checkpoints, the most a step back replays
+
+/**
+ * A memory word a step overwrote. Register writes are not logged; the
+ * checkpoints carry the register file instead.
+ */
+typedef struct {
+   long step;
+   unsigned int addr;
+   int old;
+} undoEntry;
+
+/**
+ * Engine state before step `step`, taken every REVERSE_INTERVAL steps.
+ * written marks the registers the steps up to the next checkpoint wrote,
+ * so a search for the last write of a register can skip whole intervals.
+ */
+typedef struct {
+   long step;
+   int pc;
+   int registers[NUM_REGISTERS];
+   long instExec;
+   long memRefs;
+   long cycles;
+   long undoLen;          // memory writes logged before this checkpoint
+   unsigned int written;
+} reverseCheckpoint;
+
+/**
+ * Execution history of the functional engine: periodic checkpoints plus an
+ * undo log of memory writes. Going back restores the checkpoint at or
+ * before the target, undoes the memory writes since, and replays at most
+ * REVERSE_INTERVAL steps forward.
+ */
+typedef struct {
+   undoEntry *log;
+   long logLen;
+   long logCap;
+   reverseCheckpoint *cps;
+   long numCps;
+   long cpCap;
+   long step;             // steps executed since the program started
+} reverseLog;
+
+/**
+ * Engine position the history moves: the line to run next and the
+ * counters the engine keeps
+ */
+typedef struct {
+   int pc;
+   long instExec;
+   long memRefs;
+   long cycles;
+} reversePos;
+
+void reverseInit(reverseLog *rl);
+
+void reverseFree(reverseLog *rl);
+
+int reverseRecord(reverseLog *rl, machine *m, const reversePos *pos);
+
+void reverseGoto(reverseLog *rl, machine *m, long target, reversePos *pos);
+
+long reverseLastRegWrite(reverseLog *rl, machine *m, int reg, reversePos *pos);
+
+long reverseLastMemWrite(reverseLog *rl, machine *m, unsigned int addr, reversePos *pos);
+
+#endif
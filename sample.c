@@ -0,0 +1,394 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sample.h"
+
+#define SAMPLE_WARMUP 2000   // default detailed warmup, enough to fill the pipeline and settle it
+
+long *bbvCounts;   // one count per text line, for the leader of each block
+int bbvLeader = -1;
+
+static sampleSpec spec;
+static long baseInsts, baseCycles;   // where a resumed run's clock already stood
+static sampleWindow *windows;
+static int numWindows, windowCap;
+static int bbvLines;
+static double (*projection)[SAMPLE_BBV_DIMS];   // a direction per text line
+static double (*vectors)[SAMPLE_BBV_DIMS];   // one projected vector per profiled interval
+static long *vectorInsts;
+static int numVectors, vectorCap;
+
+//Two-sided 95% points of Student's t for 1 to 30 degrees of freedom
+static const double tTable[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306,
+ 2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086, 2.080,
+ 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+
+/**
+ * Parse periodic:PERIOD:WINDOW[:WARMUP] or bbv:INTERVAL:CLUSTERS[:WARMUP]
+ * into s. WARMUP defaults to SAMPLE_WARMUP, cut down when a periodic
+ * window would not fit in its period. Returns 0 or -1.
+ */
+int sampleParse(const char *text, sampleSpec *s) {
+   char *end;
+
+   memset(s, 0, sizeof(*s));
+   s->warmup = -1;
+   if (!strncmp(text, "periodic:", 9)) {
+      s->mode = SAMPLE_PERIODIC;
+      s->period = strtol(text + 9, &end, 10);
+      if (*end != ':')
+         return -1;
+      s->window = strtol(end + 1, &end, 10);
+   } else if (!strncmp(text, "bbv:", 4)) {
+      s->mode = SAMPLE_BBV;
+      s->window = strtol(text + 4, &end, 10);
+      if (*end != ':')
+         return -1;
+      s->clusters = strtol(end + 1, &end, 10);
+      if (s->clusters < 1 || s->clusters > SAMPLE_MAX_CLUSTERS)
+         return -1;
+   } else {
+      return -1;
+   }
+   if (*end == ':') {
+      s->warmup = strtol(end + 1, &end, 10);
+      if (s->warmup < 0)
+         return -1;
+   }
+   if (*end != '\0' || s->window < 1)
+      return -1;
+
+   if (s->mode == SAMPLE_PERIODIC) {
+      if (s->period < s->window)
+         return -1;
+      if (s->warmup < 0)
+         s->warmup = s->period - s->window < SAMPLE_WARMUP ? s->period - s->window : SAMPLE_WARMUP;
+      if (s->warmup > s->period - s->window)
+         return -1;
+   } else if (s->warmup < 0) {
+      s->warmup = SAMPLE_WARMUP;
+   }
+
+   return 0;
+}
+
+/**
+ * Start a sampled run of a lines long program at instructions and cycles,
+ * non-zero when it resumes a snapshot. Basic block vectors are projected
+ * onto fixed pseudo-random directions, so runs are repeatable.
+ */
+void sampleInit(const sampleSpec *s, int lines, long instructions, long cycles) {
+   unsigned long long seed = 0x5EED;
+   int i, d;
+
+   spec = *s;
+   baseInsts = instructions;
+   baseCycles = cycles;
+   numWindows = 0;
+   numVectors = 0;
+   bbvLeader = -1;
+   if (spec.mode != SAMPLE_BBV)
+      return;
+   bbvLines = lines;
+   bbvCounts = calloc(lines + 1, sizeof(*bbvCounts));
+   projection = malloc((lines + 1) * sizeof(*projection));
+   if (bbvCounts == NULL || projection == NULL) {
+      perror("sample");
+      exit(1);
+   }
+   for (i = 0; i < lines; i++) {
+      for (d = 0; d < SAMPLE_BBV_DIMS; d++) {
+         seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+         projection[i][d] = (double) (seed >> 11) / (1ULL << 53) * 2 - 1;
+      }
+   }
+}
+
+void sampleFree(void) {
+   free(windows);
+   free(vectors);
+   free(vectorInsts);
+   free(bbvCounts);
+   free(projection);
+   bbvCounts = NULL;
+   projection = NULL;
+   windows = NULL;
+   vectors = NULL;
+   vectorInsts = NULL;
+   windowCap = vectorCap = 0;
+}
+
+/**
+ * Grow an array of cap elements of size bytes to hold one more than used.
+ * Running out of host memory ends the simulation.
+ */
+static void *grow(void *array, int used, int *cap, size_t size) {
+   if (used < *cap)
+      return array;
+   *cap = *cap ? *cap * 2 : 64;
+   if ((array = realloc(array, *cap * size)) == NULL) {
+      perror("sample");
+      exit(1);
+   }
+
+   return array;
+}
+
+void sampleRecord(const sampleWindow *w) {
+   windows = grow(windows, numWindows, &windowCap, sizeof(*windows));
+   windows[numWindows++] = *w;
+}
+
+static double windowCpi(const sampleWindow *w) {
+   return (double) w->cycles / w->insts;
+}
+
+/**
+ * Weighted mean CPI of the windows. halfWidth gets the half width of its
+ * 95% confidence interval, or -1 where there is none: bbv measures one
+ * interval per phase and periodic sampling needs two windows.
+ */
+static double estimate(double *halfWidth) {
+   double sum = 0, weights = 0, mean, var = 0;
+   int i;
+
+   *halfWidth = -1;
+   for (i = 0; i < numWindows; i++) {
+      sum += windows[i].weight * windowCpi(&windows[i]);
+      weights += windows[i].weight;
+   }
+   if (weights == 0)
+      return 0.0;
+   mean = sum / weights;
+   if (spec.mode != SAMPLE_PERIODIC || numWindows < 2)
+      return mean;
+
+   for (i = 0; i < numWindows; i++)
+      var += (windowCpi(&windows[i]) - mean) * (windowCpi(&windows[i]) - mean);
+   var /= numWindows - 1;
+   *halfWidth = (numWindows - 1 <= 30 ? tTable[numWindows - 2] : 1.960) * sqrt(var / numWindows);
+
+   return mean;
+}
+
+/**
+ * Clock cycles a whole detailed run would have taken to reach
+ * instructions, cpi per instruction since the run started
+ */
+static long cyclesAt(double cpi, long instructions) {
+   return baseCycles + (long) (cpi * (instructions - baseInsts) + 0.5);
+}
+
+long sampleCycles(long instructions) {
+   double half, cpi = estimate(&half);
+
+   return cyclesAt(cpi, instructions);
+}
+
+static void measured(long *insts, long *cycles) {
+   int i;
+
+   *insts = *cycles = 0;
+   for (i = 0; i < numWindows; i++) {
+      *insts += windows[i].insts;
+      *cycles += windows[i].cycles;
+   }
+}
+
+void samplePrintStats(FILE *out, long instructions) {
+   double half, cpi = estimate(&half);
+   long insts, cycles;
+   int i;
+
+   measured(&insts, &cycles);
+   if (spec.mode == SAMPLE_PERIODIC)
+      fprintf(out, "Sampling: %ld of every %ld instructions, %ld warmup\n", spec.window,
+       spec.period, spec.warmup);
+   else
+      fprintf(out, "Sampling: up to %d phases of %ld instruction intervals, %ld warmup\n",
+       spec.clusters, spec.window, spec.warmup);
+   fprintf(out, "Sampled windows: %d, %ld instructions measured in %ld cycles\n", numWindows,
+    insts, cycles);
+   for (i = 0; i < numWindows && spec.mode == SAMPLE_BBV; i++)
+      fprintf(out, "  phase at %ld: weight %.3f, CPI %.3f\n", windows[i].start,
+       windows[i].weight, windowCpi(&windows[i]));
+   if (half < 0) {
+      fprintf(out, "Estimated CPI %.3f, IPC %.3f\n", cpi, cpi > 0 ? 1 / cpi : 0.0);
+      return;
+   }
+   fprintf(out, "Estimated CPI %.3f +- %.3f (95%% confidence), IPC %.3f\n", cpi, half,
+    cpi > 0 ? 1 / cpi : 0.0);
+   fprintf(out, "Estimated clock cycles: %ld to %ld\n", cyclesAt(cpi - half, instructions),
+    cyclesAt(cpi + half, instructions));
+}
+
+/**
+ * Print the sampling as a JSON object member, leading comma included
+ */
+void samplePrintStatsJson(FILE *out, long instructions) {
+   double half, cpi = estimate(&half);
+   long insts, cycles;
+   int i;
+
+   measured(&insts, &cycles);
+   if (spec.mode == SAMPLE_PERIODIC)
+      fprintf(out, ", \"sample\": {\"mode\": \"periodic\", \"period\": %ld, \"window\": %ld",
+       spec.period, spec.window);
+   else
+      fprintf(out, ", \"sample\": {\"mode\": \"bbv\", \"interval\": %ld, \"clusters\": %d",
+       spec.window, spec.clusters);
+   fprintf(out, ", \"warmup\": %ld, \"measured_instructions\": %ld, \"measured_cycles\": %ld, "
+    "\"cpi\": %.4f", spec.warmup, insts, cycles, cpi);
+   if (half >= 0)
+      fprintf(out, ", \"cpi_low\": %.4f, \"cpi_high\": %.4f, \"cycles_low\": %ld, "
+       "\"cycles_high\": %ld", cpi - half, cpi + half, cyclesAt(cpi - half, instructions),
+       cyclesAt(cpi + half, instructions));
+   fprintf(out, ", \"windows\": [");
+   for (i = 0; i < numWindows; i++)
+      fprintf(out, "%s{\"start\": %ld, \"instructions\": %ld, \"cycles\": %ld, "
+       "\"weight\": %.4f}", i ? ", " : "", windows[i].start, windows[i].insts,
+       windows[i].cycles, windows[i].weight);
+   fprintf(out, "]}");
+}
+
+/**
+ * Close a profiled interval of insts instructions: its basic block
+ * vector, as fractions of the interval, is projected and kept for
+ * bbvChoose
+ */
+void bbvEndInterval(long insts) {
+   double *v;
+   int i, d;
+
+   if (insts == 0)
+      return;
+   vectors = grow(vectors, numVectors, &vectorCap, sizeof(*vectors));
+   vectorInsts = realloc(vectorInsts, vectorCap * sizeof(*vectorInsts));
+   if (vectorInsts == NULL) {
+      perror("sample");
+      exit(1);
+   }
+
+   v = vectors[numVectors];
+   memset(v, 0, sizeof(*vectors));
+   for (i = 0; i < bbvLines; i++) {
+      if (bbvCounts[i] == 0)
+         continue;
+      for (d = 0; d < SAMPLE_BBV_DIMS; d++)
+         v[d] += (double) bbvCounts[i] / insts * projection[i][d];
+   }
+   vectorInsts[numVectors++] = insts;
+   memset(bbvCounts, 0, bbvLines * sizeof(*bbvCounts));
+}
+
+static double distance(const double *a, const double *b) {
+   double sum = 0;
+   int d;
+
+   for (d = 0; d < SAMPLE_BBV_DIMS; d++)
+      sum += (a[d] - b[d]) * (a[d] - b[d]);
+
+   return sum;
+}
+
+static int nearestCentroid(const double *v, double (*centroids)[SAMPLE_BBV_DIMS], int k) {
+   int c, best = 0;
+
+   for (c = 1; c < k; c++) {
+      if (distance(v, centroids[c]) < distance(v, centroids[best]))
+         best = c;
+   }
+
+   return best;
+}
+
+/**
+ * Cluster the profiled intervals into phases with k-means, seeded by
+ * farthest-first from the first interval, and pick the interval nearest
+ * each centre to stand for its phase. Fills intervals (indexes, in run
+ * order) and weights (the share of the run's instructions each phase
+ * covers) and returns how many were picked.
+ */
+int bbvChoose(long *intervals, double *weights) {
+   double centroids[SAMPLE_MAX_CLUSTERS][SAMPLE_BBV_DIMS], members[SAMPLE_MAX_CLUSTERS];
+   double best[SAMPLE_MAX_CLUSTERS], *far, total = 0, w;
+   int *assign, k = spec.clusters < numVectors ? spec.clusters : numVectors;
+   int i, c, d, round, changed, picked = 0;
+   long pick[SAMPLE_MAX_CLUSTERS], tmp;
+
+   assign = malloc(numVectors * sizeof(int));
+   far = malloc(numVectors * sizeof(double));
+   if (numVectors > 0 && (assign == NULL || far == NULL)) {
+      perror("sample");
+      exit(1);
+   }
+
+   //Farthest-first seeding: each new centre is the interval furthest from those so far
+   for (c = 0; c < k; c++) {
+      for (i = 0, d = 0; i < numVectors && c > 0; i++) {
+         w = distance(vectors[i], centroids[c - 1]);
+         if (c == 1 || w < far[i])
+            far[i] = w;
+         if (far[i] > far[d])
+            d = i;
+      }
+      memcpy(centroids[c], vectors[d], sizeof(*centroids));
+   }
+
+   for (i = 0; i < numVectors; i++)
+      assign[i] = -1;
+   for (round = 0, changed = 1; round < SAMPLE_KMEANS_ROUNDS && changed; round++) {
+      changed = 0;
+      for (i = 0; i < numVectors; i++) {
+         c = nearestCentroid(vectors[i], centroids, k);
+         changed |= c != assign[i];
+         assign[i] = c;
+      }
+      //Centres move to the instruction weighted mean; an emptied cluster keeps its own
+      memset(members, 0, sizeof(members));
+      for (i = 0; i < numVectors; i++)
+         members[assign[i]] += vectorInsts[i];
+      for (c = 0; c < k; c++) {
+         if (members[c] > 0)
+            memset(centroids[c], 0, sizeof(*centroids));
+      }
+      for (i = 0; i < numVectors; i++) {
+         for (d = 0; d < SAMPLE_BBV_DIMS; d++)
+            centroids[assign[i]][d] += vectors[i][d] * vectorInsts[i] / members[assign[i]];
+      }
+   }
+
+   for (c = 0; c < k; c++)
+      pick[c] = -1;
+   for (i = 0; i < numVectors; i++) {
+      c = assign[i];
+      w = distance(vectors[i], centroids[c]);
+      if (pick[c] < 0 || w < best[c]) {
+         pick[c] = i;
+         best[c] = w;
+      }
+      total += vectorInsts[i];
+   }
+   for (c = 0; c < k; c++) {
+      if (pick[c] < 0)
+         continue;
+      intervals[picked] = pick[c];
+      weights[picked++] = members[c] / total;
+   }
+
+   //Into run order, so one pass can reach them all
+   for (i = 1; i < picked; i++) {
+      for (c = i; c > 0 && intervals[c - 1] > intervals[c]; c--) {
+         tmp = intervals[c];
+         intervals[c] = intervals[c - 1];
+         intervals[c - 1] = tmp;
+         w = weights[c];
+         weights[c] = weights[c - 1];
+         weights[c - 1] = w;
+      }
+   }
+
+   free(assign);
+   free(far);
+   return picked;
+}
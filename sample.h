@@ -0,0 +1,74 @@
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <stdio.h>
+#include "machine.h"
+
+#define SAMPLE_PERIODIC 0   // a window every period instructions
+#define SAMPLE_BBV 1        // a window per phase, found by clustering basic block vectors
+
+#define SAMPLE_MAX_CLUSTERS 64
+#define SAMPLE_BBV_DIMS 16        // basic block vectors are projected down to this many
+#define SAMPLE_KMEANS_ROUNDS 100
+
+/**
+ * A --sample spec. periodic:PERIOD:WINDOW[:WARMUP] measures WINDOW
+ * instructions out of every PERIOD; bbv:INTERVAL:CLUSTERS[:WARMUP] cuts
+ * the run into INTERVAL instruction intervals, groups them into at most
+ * CLUSTERS phases and measures one interval of each. WARMUP instructions
+ * run through the pipeline ahead of every window without being measured.
+ */
+typedef struct {
+   int mode;
+   long period;    // periodic: instructions from one window to the next
+   long window;    // instructions measured per window, the interval for bbv
+   long warmup;
+   int clusters;
+} sampleSpec;
+
+/**
+ * One measured window. weight is its share of the estimate: equal for
+ * periodic windows, the fraction of the run its phase covers for bbv.
+ */
+typedef struct {
+   long start;     // instructions executed before its first measured one
+   long insts;
+   long cycles;
+   double weight;
+} sampleWindow;
+
+extern long *bbvCounts;
+extern int bbvLeader;
+
+int sampleParse(const char *spec, sampleSpec *s);
+
+void sampleInit(const sampleSpec *s, int lines, long instructions, long cycles);
+
+void sampleFree(void);
+
+void sampleRecord(const sampleWindow *w);
+
+long sampleCycles(long instructions);
+
+void samplePrintStats(FILE *out, long instructions);
+
+void samplePrintStatsJson(FILE *out, long instructions);
+
+void bbvEndInterval(long insts);
+
+int bbvChoose(long *intervals, double *weights);
+
+/**
+ * Count one executed line against the basic block it belongs to, blocks
+ * ending at taken transfers. Called for every instruction of the
+ * profiling pass.
+ */
+static inline void bbvStep(int line, int taken) {
+   if (bbvLeader < 0)
+      bbvLeader = line;
+   bbvCounts[bbvLeader]++;
+   if (taken)
+      bbvLeader = -1;
+}
+
+#endif
@@ -2,723 +2,295 @@
 #include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <getopt.h>
 #include "simulator.h"
+#include "pipeline.h"
+#include "memory.h"
+#include "cache.h"
+#include "bpred.h"
+#include "predecode.h"
+#include "threaded.h"
+#include "trace.h"
+#include "jit.h"
+#include "ooo.h"
+#include "timing.h"
+#include "machine.h"
+#include "batch.h"
+#include "snapshot.h"
+#include "reverse.h"
+#include "assembler.h"
+#include "profile.h"
+#include "stagelog.h"
+#include "stats.h"
+#include "sample.h"
+
+#define PIPE_MAX_WIDTH 8
 
-#define LINE_LENGTH 100
-#define WORD_SIZE 10
-#define INST_SIZE 32
-#define NUM_REGISTERS 32
-#define SYMBOL_TABLE_SIZE 500
-#define INITIAL_PC 0
-#define PROG_SIZE 1000
-#define PROG_START 0x0400024
-
+/**
+ * A pipeline latch: the instructions that finished a stage together, in
+ * program order
+ */
 typedef struct {
-   char symbol[40];
-   int loc;
-} symbolEntry;
+   status slot[PIPE_MAX_WIDTH];
+   int count;
+} stageGroup;
 
 typedef struct {
-   int inst;
-   int type;
-} line;
+   char engine;    // 's', 'p', 't', 'j' or 'o', 0 to ask at startup
+   int run;        // run to completion without the step prompt
+   long maxInsts;  // stop after this many instructions, -1 for no limit
+   int quiet;      // leave the register dump out of the final stats
+   int statsJson;  // print final stats as JSON
+   char *traceFile;  // binary instruction trace, NULL for none
+   long traceRing;   // keep only the last traceRing records, 0 for all
+   char *l1i;        // cache specs (see cache.c), NULL for none
+   char *l1d;
+   char *l2;
+   int memLatency;   // cycles for an access that misses every cache
+   char *bpred;      // branch predictor spec (see bpred.c), NULL for none
+   int issueWidth;   // pipeline fetch/decode/issue width
+   int alus;         // ALU instructions issued per cycle, 0 for issueWidth
+   int memPorts;     // LW/SW issued per cycle
+   int robSize;      // out-of-order engine window sizes
+   int rsSize;
+   int lsqSize;
+   char *timing;     // timing models fed by the functional engine (see timing.c)
+   int batch;        // run every program given on the functional core (see batch.c)
+   char *batchList;  // file naming more programs, NULL for none
+   int jobs;         // batch worker threads, 0 for one per CPU
+   long checkpointAt;  // write a snapshot after this many instructions, -1 for none
+   char *checkpointFile;
+   int reverse;      // keep history so the functional engine can step back
+   char *profile;    // per-instruction profile report, NULL for none
+   char *stageLog;   // per-cycle pipeline stage log (see stagelog.c), NULL for none
+   long windowStart; // cycles the stage log covers, windowEnd -1 for no end
+   long windowEnd;
+   char *statsDump;  // counter registry output (see stats.c), NULL for none
+   int statsCsv;     // ... as CSV rows instead of JSON objects
+   long statsInterval;  // also dump every this many instructions, 0 for only at exit
+   char *sample;     // sampled pipeline run (see sample.c), NULL for a full one
+} simConfig;
 
+/**
+ * Pipeline hazard accounting, one counter per stall cause plus the
+ * operands the forwarding paths supplied
+ */
 typedef struct {
-   line inst;
-   int pc;
-   int rs;
-   int rt;
-   int rd;
-   int shamt;
-   int imm;
-   int opCode;
-   int funcCode;
-   int aluOut;
-   int flush;
-   int busy;
-   int writeBack;
-   int exec;
-   int nop;
-   // LOGIC TO WRITE BACK
-} status;
-
-static symbolEntry symbolTable[SYMBOL_TABLE_SIZE];
-static line assembledLines[PROG_SIZE]; 
-static int registers[NUM_REGISTERS];
-
-int numSymbols = 0;
+   long loadUse;       // EX waited on a load in the instruction ahead
+   long control;       // wrong-path instructions squashed by a taken branch or jump
+   long memory;        // cache miss penalty cycles (fetch and MEM)
+   long execute;       // multi-cycle shifts
+   long forwardExMem;  // operands taken from EX/MEM
+   long forwardMemWb;  // operands taken from MEM/WB
+   long issued;        // instructions that entered EX
+   long lostEmpty;     // issue slots with nothing decoded to fill them
+   long lostLoadUse;   // ... held back by a load-use interlock
+   long lostDependence;  // ... by a result of an older instruction in the same packet
+   long lostStructural;  // ... by running out of ALUs or memory ports
+   long lostControl;   // ... left after a redirect squashed the rest of the packet
+} hazardStats;
+
+typedef int (*engineFn)(uop *ops, memory *mem, int *regs, int numLines, int i,
+ long maxSteps, long *memRefs, long *clockCycles, long *instExec);
+
+static machine sim;
+static hazardStats hazards;
+static char cmdArgs[256];   // what followed a b or l command
+static statHistogram *opcodeMix, *branchDistance, *stallLength;
+static long stallRun;       // cycles in a row issue has been stalled
+static long nextSample;     // instructions at which the next interval dump is due
+static sampleSpec sampling;
+static simConfig config = {0, 0, -1, 0, 0, NULL, 0, NULL, NULL, NULL, CACHE_MEM_LATENCY, NULL, 1, 0, 1,
+ OOO_ROB_SIZE, OOO_RS_SIZE, OOO_LSQ_SIZE, NULL, 0, NULL, 0, -1, NULL, 0, NULL, NULL, 0, -1, NULL, 0,
+ 0, NULL};
 
 /**
- * Check beginning of each line for symbol
+ * Run one predecoded instruction through the functional core and the
+ * timing models, return the line index of the next one (-1 when the
+ * program exits).
  */
-int parseLineForSymbolTable(char *line, int numLines) {
-   const char *format = " \t,\n";
-   char *word, *end;
-   int len;
-
-   if ((int)strlen(line) == 0) {
-      return 0;
+int runCommand(uop *op, long *memRefs, long *clockCycles, int lineNum) {
+   streamRecord r;
+   int next = machineStep(&sim, op, memRefs, lineNum, &r);
+   long cycles = 0;
+
+   if (timingEnabled)
+      *clockCycles += cycles = timingConsume(&r);
+   if (statsEnabled) {
+      statsSample(opcodeMix, r.op.handler);
+      if (next >= 0 && next != lineNum + 1)
+         statsSample(branchDistance, next > lineNum ? next - lineNum : lineNum - next);
    }
-   
-   word = strtok(line, format);
-   if (word == NULL || strlen(word) == 0 || strchr(word, '#') != NULL) {
-      return 0;
-   }
-
-   //Only need to check first word of line for symbol
-   if ((end = strchr(word, ':')) != NULL) {
-      *(end + 1) = '\0';
-      strcpy(symbolTable[numSymbols].symbol, word);
-      symbolTable[numSymbols].symbol[strlen(word) - 1] = '\0';
-      symbolTable[numSymbols].loc = (numLines) * 4 + INITIAL_PC;
-      numSymbols++;
+   //The cache penalties and prediction are only filled in for the timing models
+   if (profileEnabled) {
+      profileExec(lineNum, cycles);
+      if (timingEnabled) {
+         profileMiss(lineNum, r.fetchPenalty);
+         profileMiss(lineNum, r.memPenalty);
+         if (r.predicted != next)
+            profileFlush(lineNum);
+      }
    }
 
-   return 1;
+   return next;
 }
 
-/**
- * First Pass - check each line for a symbol
- * Return number of lines in file
- */
-int constructSymbolTable(FILE *code) {
-   char line[LINE_LENGTH];
-   int numLines = 0;
-
-   while (fgets(line, LINE_LENGTH, code)) {
-      if (parseLineForSymbolTable(line,  numLines))
-         numLines++;
-   }
-   
-   return numLines;
+void initStatus(status *s) {
+   s->pc = 0;
+   s->rs = -1;
+   s->rt = -1;
+   s->rd = -1;
+   s->imm = 0;
+   s->opCode = -1;
+   s->funcCode = -1;
+   s->aluOut = 0;
+   s->storeData = 0;
+   s->flush = 0;
+   s->busy = 0;
+   s->writeBack = 0;
+   s->exec = 0;
+   s->nop = 0;
+   s->predicted = -1;
+   s->seq = 0;
+   s->fetchPc = 0;
 }
 
 /**
- * Set the instruction op/function code for each instruction, and return type.
- * The S type is actually the R type, but for a shift command as the format is different.
+ * The register an instruction writes in WB, -1 for none
  */
-char getInstruction(char *word, int *code) {
-   int i;
-   char opFormat = 0;
-
-   //Make word lowercase for matching
-   for (i = 0; word[i]; i++)
-      word[i] = tolower(word[i]);
-
-   //Begin matching
-   if (!strcmp(word, "and")) { //R
-      opFormat = 'R';
-      *code |= AND_CODE;
-   } else if (!strcmp(word, "or")) { //R
-      opFormat = 'R';
-      *code |= OR_CODE;
-   } else if (!strcmp(word, "ori")) { //I
-      opFormat = 'I';
-      *code |= ORI_CODE;
-   } else if (!strcmp(word, "add")) { //R
-      opFormat = 'R';
-      *code |= ADD_CODE;
-   } else if (!strcmp(word, "addu")) { //R
-      opFormat = 'R';
-      *code |= ADDU_CODE;
-   } else if (!strcmp(word, "addi")) { //I
-      opFormat = 'I';
-      *code |= ADDI_CODE;
-   } else if (!strcmp(word, "addiu")) { //I
-      opFormat = 'I';
-      *code |= ADDIU_CODE;
-   } else if (!strcmp(word, "sll")) { //S = R
-      opFormat = 'S';
-      *code |= SLL_CODE;
-   } else if (!strcmp(word, "srl")) { //S = R
-      opFormat = 'S';
-      *code |= SRL_CODE;
-   } else if (!strcmp(word, "sra")) { //S = R
-      opFormat = 'S';
-      *code |= SRA_CODE;
-   } else if (!strcmp(word, "sub")) { //R
-      opFormat = 'R';
-      *code |= SUB_CODE;
-   } else if (!strcmp(word, "slt")) { //R
-      opFormat = 'R';
-      *code |= SLT_CODE; 
-   } else if (!strcmp(word, "slti")) { //I
-      opFormat = 'I';
-      *code |= SLTIU_CODE;
-   } else if (!strcmp(word, "sltu")) { //R
-      opFormat = 'R';
-      *code |= SLTU_CODE;
-   } else if (!strcmp(word, "sltiu")) { //I
-      opFormat = 'I';
-      *code |= SLTIU_CODE;
-   } else if (!strcmp(word, "beq")) { //I
-      opFormat = 'B';
-      *code |= BEQ_CODE;
-   } else if (!strcmp(word, "bne")) { //I
-      opFormat = 'B';
-      *code |= BNE_CODE;
-   } else if (!strcmp(word, "lui")) { //I
-      opFormat = 'I';
-      *code |= LUI_CODE;
-   } else if (!strcmp(word, "lw")) { //I
-      opFormat = 'I';
-      *code |= LW_CODE;
-   } else if (!strcmp(word, "sw")) { //I
-      opFormat = 'I';
-      *code |= SW_CODE;
-   } else if (!strcmp(word, "j")) { //J
-      opFormat = 'J';
-      *code |= J_CODE;
-   } else if (!strcmp(word, "jr")) { //R
-      opFormat = 'U';
-      *code |= JR_CODE;
-   } else if (!strcmp(word, "jal")) { //J
-      opFormat ='J';
-      *code |= JAL_CODE;
-   } else if (!strcmp(word, "syscall")) {
-      opFormat = 'T';
-      *code |= SYSCALL_CODE;
-   } else if (!strcmp(word, ".word")) {
-      opFormat = 'W';
-   } else if (!strcmp(word, ".byte")) {
-      opFormat = 'D';
-   } else {
-      opFormat = '\0';
+int destRegister(status *s) {
+   switch (s->inst.type) {
+   case AND_CODE: case OR_CODE: case ADD_CODE: case ADDU_CODE: case SUB_CODE:
+   case SLT_CODE: case SLTU_CODE: case SLL_CODE: case SRL_CODE: case SRA_CODE:
+      return s->inst.inst == 0 ? -1 : s->rd;
+   case ORI_CODE: case ADDI_CODE: case ADDIU_CODE: case SLTI_CODE: case SLTIU_CODE:
+   case LUI_CODE: case LW_CODE:
+      return s->rt;
+   case JAL_CODE: case JR_CODE:
+      return 31;
    }
-
-   return opFormat;
+   return -1;
 }
 
 /**
- * Trims comment from word, returns whether there was one
+ * The registers an instruction reads in EX, -1 when a slot is unused
  */
-int trimComment(char *word) {
-   char *c = strchr(word, '#');
-
-   if (c != NULL) {
-      *c = '\0';
-      return 1;
+void sourceRegisters(status *s, int *src1, int *src2) {
+   *src1 = -1;
+   *src2 = -1;
+   switch (s->inst.type) {
+   case AND_CODE: case OR_CODE: case ADD_CODE: case ADDU_CODE: case SUB_CODE:
+   case SLT_CODE: case SLTU_CODE: case BEQ_CODE: case BNE_CODE: case SW_CODE:
+      *src1 = s->rs;
+      *src2 = s->rt;
+      break;
+   case SLL_CODE: case SRL_CODE: case SRA_CODE:
+      *src2 = s->rt;
+      break;
+   case ORI_CODE: case ADDI_CODE: case ADDIU_CODE: case SLTI_CODE: case SLTIU_CODE:
+   case LW_CODE: case JR_CODE:
+      *src1 = s->rs;
+      break;
+   case SYSCALL_CODE:
+      *src1 = 2;
+      break;
    }
-   return 0;
 }
 
 /**
- * Parse word to get register number
+ * How the BTB files a resolved instruction, -1 when it is not a control
+ * transfer
  */
-int getRegisterNumber(char *reg) {
-   int num;
-
-   if (reg[strlen(reg) - 1] == ')')
-      reg[strlen(reg) - 1] = '\0';
-
-   if (!strcmp(reg, "zero") || !strcmp(reg, "0")) {
-      num = 0;
-   } else if (!strcmp(reg, "at")) {
-      num = 1;
-   } else if (!strcmp(reg, "v0")) {
-      num = 2; 
-   } else if (!strcmp(reg, "v1")) {
-      num = 3; 
-   } else if (!strcmp(reg, "a0")) {
-      num = 4;
-   } else if (!strcmp(reg, "a1")) {
-      num = 5;
-   } else if (!strcmp(reg, "a2")) {
-      num = 6;
-   } else if (!strcmp(reg, "a3")) {
-      num = 7;
-   } else if (!strcmp(reg, "t0")) {
-      num = 8;
-   } else if (!strcmp(reg, "t1")) {
-      num = 9;
-   } else if (!strcmp(reg, "t2")) {
-      num = 10;
-   } else if (!strcmp(reg, "t3")) {
-      num = 11;
-   } else if (!strcmp(reg, "t4")) {
-      num = 12;
-   } else if (!strcmp(reg, "t5")) {
-      num = 13;
-   } else if (!strcmp(reg, "t6")) {
-      num = 14;
-   } else if (!strcmp(reg, "t7")) {
-      num = 15;
-   } else if (!strcmp(reg, "s0")) {
-      num = 16;
-   } else if (!strcmp(reg, "s1")) {
-      num = 17;
-   } else if (!strcmp(reg, "s2")) {
-      num = 18;
-   } else if (!strcmp(reg, "s3")) {
-      num = 19;
-   } else if (!strcmp(reg, "s4")) {
-      num = 20;
-   } else if (!strcmp(reg, "s5")) {
-      num = 21;
-   } else if (!strcmp(reg, "s6")) {
-      num = 22;
-   } else if (!strcmp(reg, "s7")) {
-      num = 23;
-   } else if (!strcmp(reg, "t8")) {
-      num = 24;
-   } else if (!strcmp(reg, "t9")) {
-      num = 25;
-   } else if (!strcmp(reg, "k0")) {
-      num = 26;
-   } else if (!strcmp(reg, "k1")) {
-      num = 27;
-   } else if (!strcmp(reg, "gp")) {
-      num = 28;
-   } else if (!strcmp(reg, "sp")) {
-      num = 29;
-   } else if (!strcmp(reg, "fp")) {
-      num = 30;
-   } else if (!strcmp(reg, "ra")) {
-      num = 31;
-   } else {
-      num = -1;
+int branchKind(status *s) {
+   switch (s->inst.type) {
+   case BEQ_CODE: case BNE_CODE:
+      return BRANCH_COND;
+   case J_CODE:
+      return BRANCH_JUMP;
+   case JAL_CODE:
+      return BRANCH_CALL;
+   case JR_CODE:
+      return s->rs == 31 ? BRANCH_RETURN : BRANCH_INDIRECT;
    }
-
-   return num;
+   return -1;
 }
 
 /**
- * General parsing of line
+ * Whether next reads a register written by one of the count instructions
+ * in group, only counting loads when loadsOnly is set
  */
-int parseLineGeneral(char *line, int curLine) {
-   const char *format = " \t,\n$:";
-   const char *formatReg = " \t\n()";
-   char *word;
-   char *immediate;
-   char *regStr;
-   int code = 0, reg, instLoc = 0, isComment;
-   char opFormat = 0;
-   char buffer[INST_SIZE];
-   int i = 0;
-   int setSymbol = 0;
-   int jumpSymbol = 0;
-   int curByte = 0;
-   int noOp = 0;
-   
-
-   if (line == NULL || strlen(line) == 0)
-      return 0;
-
-   word = strtok(line, format);
-   while (word != NULL) {
-      isComment = trimComment(word);
-
-      if (opFormat == '\0') { 
-         opFormat = getInstruction(word, &code);
-         assembledLines[curLine].type = code;
-      } else if (opFormat == 'R') {
-         noOp = 1;
-         reg = getRegisterNumber(word); 
-         if (reg != -1) {
-            if (instLoc == 0) {
-               code |= reg << 11; //rd
-            } else if (instLoc == 1) {
-               code |= reg << 21; //rs
-            } else if (instLoc == 2) {
-               code |= reg << 16; //rt
-            }
-         }
-         instLoc++;
-      } else if (opFormat == 'U') {
-         reg = getRegisterNumber(word); 
-         if (reg != -1) {
-            if (instLoc == 0) {
-               code |= reg << 21; //rd
-            }
-         }
-         instLoc++;
-      } else if (opFormat == 'S') {
-         reg = getRegisterNumber(word); 
-         if (instLoc == 2) {
-            code |= (strtol(word, NULL, 10) & 0x1F) << 6; //shamt
-         } else {
-            if (reg != -1) {
-               if (instLoc == 0) {
-                  code |= reg << 11; //rd
-               } else if (instLoc == 1) {
-                  code |= reg << 16; //rt
-               }
-            }
-         }
-         instLoc++;
-      } else if (opFormat == 'I') {
-         for (i = 0; i < numSymbols; i++) {
-            if (!strcmp(symbolTable[i].symbol, word)) {
-               code |= ((symbolTable[i].loc - (curLine * 4 + INITIAL_PC )) / 4) & 0xFFFF;
-               jumpSymbol = 1;
-            }
-         }
-         if (instLoc == 2 || strstr(word, "0x")) {
-            if (strstr(word, "0x") != NULL)
-               code |= strtol(word, NULL, 16) & 0xFFFF;
-            else
-               code |= strtol(word, NULL, 10) & 0xFFFF; //and word so only 16 bytes are copied
-         } else {
-            reg = getRegisterNumber(word); 
-            if (reg != -1) {
-               if (instLoc == 0) {
-                  code |= reg << 16;
-               }
-               else if (instLoc == 1) {
-                  code |= reg << 21;
-               }
-            }
-            else {
-               code |= strtol(word, NULL, 10);
-               regStr = strtok(NULL, format);
-               if (regStr != NULL) {
-                  reg = getRegisterNumber(regStr);
-                  if (reg != -1) {
-                     code |= reg << 21;
-                  }
-               }
-            }
-               
-         }
-         instLoc++;
-      } else if (opFormat == 'B') {
-         if (instLoc == 2) {
-            for (i = 0; i < numSymbols; i++) {
-               if (!strcmp(symbolTable[i].symbol, word)) {
-                  code |= ((symbolTable[i].loc - (curLine * 4 + INITIAL_PC )) / 4) & 0xFFFF;
-                  jumpSymbol = 1;
-               }
-            }
-         } else {
-            reg = getRegisterNumber(word); 
-            if (reg != -1) {
-               if (instLoc == 0) {
-                  code |= reg << 21;
-               }
-               else if (instLoc == 1) {
-                  code |= reg << 16;
-               }
-            }
-            else {
-               immediate = strtok(word, formatReg);
-               if (immediate != NULL)
-                  code |= strtol(immediate, NULL, 10);
-               regStr = strtok(NULL, formatReg);
-               if (regStr != NULL) {
-                  reg = getRegisterNumber(regStr);
-                  if (reg != -1) {
-                     code |= reg << 21;
-                  }
-               }
-            }
-         }
-         instLoc++;
-      } else if (opFormat == 'J') {
-         for (i = 0; i < numSymbols; i++) {
-            if (!strcmp(symbolTable[i].symbol, word)) {
-               code |= symbolTable[i].loc / 4;
-               jumpSymbol = 1;
-            }
-         }
-         if (jumpSymbol == 0) {
-            reg = getRegisterNumber(word);
-            if (reg != -1) {
-               code |= (reg & 0x1F);
-            }
-            else if (strstr(word, "0x") != NULL && !setSymbol) {
-               code |= (strtol(word, NULL, 16) & 0xFFFF) << 5;
-            }
-            else {
-               code |= (strtol(word, NULL, 10) & 0xFFFF) << 5; //and word so only 16 bytes are copied
-            }  
-         }
-         jumpSymbol = 0;
-      } else if (opFormat == 'T') {
-            break;
-      } else if (opFormat == 'W') {
-         assembledLines[curLine].type = -1;
-         assembledLines[curLine++].inst = (int) word;
-      } else if (opFormat == 'D') {
-         assembledLines[curLine << (curByte % 32)].type = -1;
-         assembledLines[curLine << (curByte % 32)].inst = (char) word;
-         if (curByte % 32 == 0) {
-            curLine++; 
-         }
-      }
-
-      //Rest of line is comment
-      //Put this at the end because there may be no space between previous word and comment
-      if (isComment)
-         break;
-
-      
-      word = strtok(NULL, format);
-   }
-
-   if (code) {
-      assembledLines[curLine].inst = code;
-      return 1;
-   }
-   else if (opFormat == 'S') {
-      assembledLines[curLine].inst = code;
-      return 1;
+static int readsResultOf(status *next, status *group, int count, int loadsOnly) {
+   int src1, src2, dest, k;
+
+   sourceRegisters(next, &src1, &src2);
+   for (k = 0; k < count; k++) {
+      if (loadsOnly && group[k].inst.type != LW_CODE)
+         continue;
+      dest = destRegister(&group[k]);
+      if (dest >= 0 && (src1 == dest || src2 == dest))
+         return 1;
    }
 
    return 0;
 }
 
 /**
- * Second pass - assemble the program
+ * Load-use interlock: a load in EX/MEM whose result the instruction about
+ * to execute needs. Its value only exists at the end of MEM, so EX has to
+ * wait a cycle and take it from MEM/WB.
  */
-int assemble(FILE *code) {
-   char line[LINE_LENGTH];
-   int curLine = 0;
-
-   while (fgets(line, LINE_LENGTH, code)) {
-      curLine += parseLineGeneral(line, curLine);
-   }
-
-   return curLine;
-}
-
-void printAssembled(int numLines) {
-   int i;
-
-   for (i = 0; i < numLines; i++) {
-      printf("%08X\n", assembledLines[i].inst);
-   }
+static int loadUseHazard(status *next, stageGroup *exMem) {
+   return readsResultOf(next, exMem->slot, exMem->count, 1);
 }
 
-void printSymbolTable(int numLines) {
-   int i;
+/**
+ * Read a source operand in EX. The group one ahead has just left MEM (the
+ * EX/MEM path) and the one two ahead was written back this cycle (the
+ * MEM/WB path); anything older is in the register file. Within a group
+ * the youngest writer wins.
+ */
+static int readOperand(int reg, stageGroup *exMem, stageGroup *memWb) {
+   int k;
 
-   for( i = 0; i < numLines; i++) {
-      if (strlen(symbolTable[i].symbol) != 0) {
-         printf("Symbol: %s @ line: %d\n", symbolTable[i].symbol, symbolTable[i].loc);
+   if (reg < 0)
+      return 0;
+   for (k = exMem->count - 1; k >= 0; k--) {
+      if (destRegister(&exMem->slot[k]) == reg) {
+         hazards.forwardExMem++;
+         return exMem->slot[k].aluOut;
       }
    }
-}
-
-void initRegisters() {
-   int i;
-
-   for (i = 0; i < NUM_REGISTERS; i++) {
-      registers[i] = 0; 
-   }
-
-   registers[28] = PROG_SIZE / 4;
-   registers[29] = PROG_SIZE - 8;
-   registers[31] = INITIAL_PC;
-}
-
-int runCommand(line *inst, int *memRefs, int *clockCycles, int lineNum) {
-   int rs, rt, rd, imm, shamt, address, pc = lineNum * 4 + INITIAL_PC, oldPc;
-
-   printf("%08X\n", inst->inst);
-   if (inst->type == AND_CODE) {
-      rs = (inst->inst >> 21) & 0x1F;
-      rt = (inst->inst >> 16) & 0x1F;
-      rd = (inst->inst >> 11) & 0x1F;
-      registers[rd] = registers[rs] & registers[rt];
-      pc += 4;
-      *clockCycles += 4;
-   } else if (inst->type == OR_CODE) {
-      rs = (inst->inst >> 21) & 0x1F;
-      rt = (inst->inst >> 16) & 0x1F;
-      rd = (inst->inst >> 11) & 0x1F;
-      registers[rd] = registers[rs] | registers[rt];
-      pc += 4;
-      *clockCycles += 4;
-   } else if (inst->type ==  ORI_CODE) {
-      rs = (inst->inst >> 21) & 0x1F;
-      rt = (inst->inst >> 16) & 0x1F;
-      imm = inst->inst & 0xFFFF;
-      registers[rt] = registers[rs] | (short) imm;
-      pc += 4;
-      *clockCycles += 4;
-   } else if (inst->type == ADD_CODE) {
-      rs = (inst->inst >> 21) & 0x1F;
-      rt = (inst->inst >> 16) & 0x1F;
-      rd = (inst->inst >> 11) & 0x1F;
-      registers[rd] = registers[rs] + registers[rt];
-      pc += 4;
-      *clockCycles += 4;
-   } else if (inst->type ==  ADDU_CODE) {
-      rs = (inst->inst >> 21) & 0x1F;
-      rt = (inst->inst >> 16) & 0x1F;
-      rd = (inst->inst >> 11) & 0x1F;
-      registers[rd] = (unsigned) registers[rs] + (unsigned) registers[rt];
-      pc += 4;
-      *clockCycles += 4;
-   } else if (inst->type == ADDI_CODE) {
-      rs = (inst->inst >> 21) & 0x1F;
-      rt = (inst->inst >> 16) & 0x1F;
-      imm = inst->inst & 0xFFFF;
-      registers[rt] = registers[rs] + (short) imm;
-      pc += 4;
-      *clockCycles += 4;
-   } else if (inst->type == ADDIU_CODE) {
-      rs = (inst->inst >> 21) & 0x1F;
-      rt = (inst->inst >> 16) & 0x1F;
-      imm = inst->inst & 0xFFFF;
-      registers[rt] = (unsigned) registers[rs] & (unsigned short) imm;
-      pc += 4;
-      *clockCycles += 4;
-   } else if (inst->type == SLL_CODE) {
-      rt = (inst->inst >> 16) & 0x1F;
-      rd = (inst->inst >> 11) & 0x1F;
-      shamt = (inst->inst >> 6) & 0x1F;
-      registers[rd] = registers[rt] << shamt;
-      pc += 4;
-      *clockCycles += shamt + 5;
-   } else if (inst->type == SRL_CODE) {
-      rt = (inst->inst >> 16) & 0x1F;
-      rd = (inst->inst >> 11) & 0x1F;
-      shamt = (inst->inst >> 6) & 0x1F;
-      registers[rd] = registers[rt] >> shamt;
-      pc += 4;
-      *clockCycles += shamt + 5;
-   } else if (inst->type == SRA_CODE) {
-      rt = (inst->inst >> 16) & 0x1F;
-      rd = (inst->inst >> 11) & 0x1F;
-      shamt = (inst->inst >> 6) & 0x1F;
-      registers[rd] = (unsigned) registers[rt] >> shamt;
-      pc += 4;
-       *clockCycles += shamt + 5;
-   } else if (inst->type == SUB_CODE) {
-      rs = (inst->inst >> 21) & 0x1F;
-      rt = (inst->inst >> 16) & 0x1F;
-      rd = (inst->inst >> 11) & 0x1F;
-      registers[rd] = registers[rs] - registers[rt];
-      pc += 4;
-      *clockCycles += 4;
-   } else if (inst->type == SLT_CODE) {
-      rs = (inst->inst >> 21) & 0x1F;
-      rt = (inst->inst >> 16) & 0x1F;
-      rd = (inst->inst >> 11) & 0x1F;
-      registers[rd] = registers[rs] < registers[rt] ? 1 : 0;
-      pc += 4;
-      *clockCycles += 4;
-   } else if (inst->type == SLTI_CODE) {
-      rs = (inst->inst >> 21) & 0x1F;
-      rt = (inst->inst >> 16) & 0x1F;
-      imm = inst->inst & 0xFFFF;
-      registers[rt] = registers[rs] < imm ? 1 : 0;
-      pc += 4;
-      *clockCycles += 4;
-   } else if (inst->type == SLTU_CODE) {
-      rs = (inst->inst >> 21) & 0x1F;
-      rt = (inst->inst >> 16) & 0x1F;
-      rd = (inst->inst >> 11) & 0x1F;
-      registers[rd] = (unsigned) registers[rs] < (unsigned) registers[rt] ? 1 : 0;
-      pc += 4;
-      *clockCycles += 4;
-   } else if (inst->type == SLTIU_CODE) {
-      rs = (inst->inst >> 21) & 0x1F;
-      rt = (inst->inst >> 16) & 0x1F;
-      imm = inst->inst & 0xFFFF;
-      registers[rt] = (unsigned) registers[rs] < (unsigned) imm ? 1 : 0;
-      pc += 4;
-      *clockCycles += 4;
-   } else if (inst->type == BEQ_CODE) {
-      rs = (inst->inst >> 21) & 0x1F;
-      rt = (inst->inst >> 16) & 0x1F;
-      address = (inst->inst & 0xFFFF);
-      if (address & 0x8000)
-         address += 0xFFFF0000;
-      address = address * 4;
-      if (registers[rs] == registers[rt]) {
-         pc += address;
-      } else {
-         pc += 4; 
+   for (k = memWb->count - 1; k >= 0; k--) {
+      if (destRegister(&memWb->slot[k]) == reg) {
+         hazards.forwardMemWb++;
+         return memWb->slot[k].aluOut;
       }
-      *clockCycles += 3;
-   } else if (inst->type == BNE_CODE) {
-      rs = (inst->inst >> 21) & 0x1F;
-      rt = (inst->inst >> 16) & 0x1F;
-      address = (inst->inst & 0xFFFF);
-      if (address & 0x8000)
-         address += 0xFFFF0000;
-      address = address * 4;
-      if (registers[rs] != registers[rt]) {
-         pc += address;
-      } else {
-         pc += 4;
-      }
-      *clockCycles += 3;
-   } else if (inst->type == LUI_CODE) {
-      rt = (inst->inst >> 16) & 0x1F;
-      imm = inst->inst & 0xFFFF;
-      registers[rt] = (imm << 16) & 0xFFFF0000;
-      pc += 4;
-      *clockCycles += 4;
-      *memRefs += 1;
-   } else if (inst->type == LW_CODE) {
-      rs = (inst->inst >> 21) & 0x1F;
-      rt = (inst->inst >> 16) & 0x1F;
-      imm = inst->inst & 0xFFFF;
-      registers[rt] = assembledLines[registers[rs] + imm].inst;
-      pc += 4;
-      *clockCycles += 5;
-      *memRefs = 1;
-   } else if (inst->type == SW_CODE) {
-      rs = (inst->inst >> 21) & 0x1F;
-      rt = (inst->inst >> 16) & 0x1F;
-      imm = inst->inst & 0xFFFF;
-      assembledLines[registers[rs] + imm].inst = registers[rt];
-      pc += 4;
-      *clockCycles += 4;
-      *memRefs += 1;
-   } else if (inst->type == J_CODE) {
-      pc = (inst->inst & 0x1FFFFFF) * 4;
-      *clockCycles += 3;
-   } else if (inst->type == JR_CODE) {
-      rs = (inst->inst >> 21) & 0x1F;
-      oldPc = pc;
-      pc = registers[rs] - 4; 
-      registers[31] = oldPc - 4;
-      *clockCycles += 3;
-   } else if (inst->type == JAL_CODE) {
-      registers[31] = pc + 8; 
-      pc = (inst->inst & 0x1FFFFFF) * 4;
-      *clockCycles += 3;
-   } else if (inst->type == SYSCALL_CODE) {
-      if (registers[2]  == 10)
-        return -1; 
-   } else {
-      pc += 4;
    }
-
-   return (pc - INITIAL_PC) / 4;
-}
-
-void initStatus(status *s) {
-   s->pc = 0;
-   s->rs = -1;
-   s->rs = -1;
-   s->rd = -1;
-   s->imm = 0;
-   s->opCode = -1;
-   s->funcCode = -1;
-   s->aluOut = 0;
-   s->flush = 0;
-   s->busy = 0;
-   s->exec = 0;
-   s->nop = 0;
+   return sim.registers[reg];
 }
 
-status instructionFetch(int i) {
+status instructionFetch(int i, long *clockCycles) {
    status s;
+   int penalty;
    initStatus(&s);
    
    s.pc = PROG_START + i * 4;
-   s.inst = assembledLines[i];
-   if (s.inst.type == SYSCALL_CODE) {
-      if (registers[2]  == 10)
-         s.pc = -1;
+   s.fetchPc = s.pc;
+   s.inst = sim.assembledLines[i];
+   if (cacheEnabled) {
+      penalty = cacheFetch(i * 4 + INITIAL_PC);
+      *clockCycles += penalty;
+      hazards.memory += penalty;
+      if (profileEnabled) {
+         profileCycles(i, penalty);
+         profileMiss(i, penalty);
+      }
    }
    s.busy = 1;
-   printf("%08X\n", s.inst.inst);
+   //Traced in the functional core's addresses, like every other engine
+   if (traceEnabled)
+      traceInst(s.pc - PROG_START + INITIAL_PC, s.inst.inst);
    
    return s;
 }
@@ -728,8 +300,6 @@ status instructionDecode(status s) {
    
    if (s.inst.inst == 0) {
       s.nop = 1;
-      s.busy = 0;
-      return s;
    } else if (s.inst.type == AND_CODE) {
       s.rs = (s.inst.inst >> 21) & 0x1F;
       s.rt = (s.inst.inst >> 16) & 0x1F;
@@ -812,9 +382,6 @@ status instructionDecode(status s) {
       s.rs = (s.inst.inst >> 21) & 0x1F;
    } else if (s.inst.type == JAL_CODE) {
    } else if (s.inst.type == SYSCALL_CODE) {
-      if (registers[2]  == 10){
-         s.pc = -1;
-      }
    } 
    
    s.busy = 1;
@@ -822,72 +389,77 @@ status instructionDecode(status s) {
    return s;
 }
 
-status execute(status s, int *clockCycles) {
+/**
+ * The ALU, branch and address semantics of EX given the source operand
+ * values (a for the first source, b for the second). Shifts take shamt
+ * extra cycles, added to *extraCycles.
+ */
+status aluExecute(status s, int a, int b, int *extraCycles) {
    int address, oldPc;
 
    if (s.inst.inst == 0) {
       s.nop = 1;
    } else if (s.inst.type == AND_CODE) {
-      s.aluOut = registers[s.rs] & registers[s.rt];
+      s.aluOut = a & b;
       s.writeBack = 1;
       s.exec = 1;
    } else if (s.inst.type == OR_CODE) {
-      s.aluOut = registers[s.rs] | registers[s.rt];
+      s.aluOut = a | b;
       s.writeBack = 1;
       s.exec = 1;
    } else if (s.inst.type ==  ORI_CODE) {
-      s.aluOut = registers[s.rs] | (short) s.imm;
+      s.aluOut = a | (short) s.imm;
       s.writeBack = 1;
       s.exec = 1;
    } else if (s.inst.type == ADD_CODE) {
-      s.aluOut = registers[s.rs] + registers[s.rt];
+      s.aluOut = a + b;
       s.writeBack = 1;
       s.exec = 1;
    } else if (s.inst.type ==  ADDU_CODE) {
-      s.aluOut = (unsigned) registers[s.rs] + (unsigned) registers[s.rt];
+      s.aluOut = (unsigned) a + (unsigned) b;
       s.writeBack = 1;
       s.exec = 1;
    } else if (s.inst.type == ADDI_CODE) {
-      s.aluOut = registers[s.rs] + (short) s.imm;
+      s.aluOut = a + (short) s.imm;
       s.writeBack = 1;
       s.exec = 1;
    } else if (s.inst.type == ADDIU_CODE) {
-      s.aluOut = (unsigned) registers[s.rs] & (unsigned short) s.imm;
+      s.aluOut = (unsigned) a & (unsigned short) s.imm;
       s.writeBack = 1;
       s.exec = 1;
    } else if (s.inst.type == SLL_CODE) {
-      s.aluOut = registers[s.rt] << s.shamt;
+      s.aluOut = b << s.shamt;
       s.writeBack = 1;
-      *clockCycles += s.shamt;
+      *extraCycles += s.shamt;
       s.exec = 1;
    } else if (s.inst.type == SRL_CODE) {
-      s.aluOut = registers[s.rt] >> s.shamt;
+      s.aluOut = b >> s.shamt;
       s.writeBack = 1;
-      *clockCycles += s.shamt;
+      *extraCycles += s.shamt;
       s.exec = 1;
    } else if (s.inst.type == SRA_CODE) {
-      s.aluOut = (unsigned) registers[s.rt] >> s.shamt;
+      s.aluOut = (unsigned) b >> s.shamt;
       s.writeBack = 1;
-      *clockCycles += s.shamt;
+      *extraCycles += s.shamt;
       s.exec = 1;
    } else if (s.inst.type == SUB_CODE) {
-      s.aluOut = registers[s.rs] - registers[s.rt];
+      s.aluOut = a - b;
       s.writeBack = 1;
       s.exec = 1;
    } else if (s.inst.type == SLT_CODE) {
-      s.aluOut = registers[s.rs] < registers[s.rt] ? 1 : 0;
+      s.aluOut = a < b ? 1 : 0;
       s.writeBack = 1;
       s.exec = 1;
    } else if (s.inst.type == SLTI_CODE) {
-      s.aluOut = registers[s.rs] < s.imm ? 1 : 0;
+      s.aluOut = a < s.imm ? 1 : 0;
       s.writeBack = 1;
       s.exec = 1;
    } else if (s.inst.type == SLTU_CODE) {
-      s.aluOut = (unsigned) registers[s.rs] < (unsigned) registers[s.rt] ? 1 : 0;
+      s.aluOut = (unsigned) a < (unsigned) b ? 1 : 0;
       s.writeBack = 1;
       s.exec = 1;
    } else if (s.inst.type == SLTIU_CODE) {
-      s.aluOut = (unsigned) registers[s.rs] < (unsigned) s.imm ? 1 : 0;
+      s.aluOut = (unsigned) a < (unsigned) s.imm ? 1 : 0;
       s.writeBack = 1;
       s.exec = 1;
    } else if (s.inst.type == BEQ_CODE) {
@@ -895,7 +467,7 @@ status execute(status s, int *clockCycles) {
       if (address & 0x8000)
          address += 0xFFFF0000;
       address = address * 4;
-      if (registers[s.rs] == registers[s.rt]) {
+      if (a == b) {
          s.pc += address;
          s.flush = 1;
       }
@@ -905,40 +477,46 @@ status execute(status s, int *clockCycles) {
       if (address & 0x8000)
          address += 0xFFFF0000;
       address = address * 4;
-      if (registers[s.rs] != registers[s.rt]) {
+      if (a != b) {
          s.pc += address;
          s.flush = 1;
       } 
       s.exec = 1;
    } else if (s.inst.type == LUI_CODE) {
       s.aluOut = (s.imm << 16) & 0xFFFF0000;
+      s.writeBack = 1;
       s.exec = 1;
    } else if (s.inst.type == LW_CODE) {
-      s.aluOut = assembledLines[registers[s.rs] + s.imm].inst;
+      s.aluOut = a + (short) s.imm;
+      s.writeBack = 1;
       s.exec = 1;
    } else if (s.inst.type == SW_CODE) {
-      s.aluOut = assembledLines[registers[s.rs] + s.imm].inst;
+      s.aluOut = a + (short) s.imm;
+      s.storeData = b;
       s.exec = 1;
    } else if (s.inst.type == J_CODE) {
       s.pc = (s.inst.inst & 0x1FFFFFF) * 4 + PROG_START;
       s.flush = 1;
       s.exec = 1;
    } else if (s.inst.type == JR_CODE) {
-      oldPc = s.pc;
-      s.pc = registers[s.rs] - 4; 
-      s.aluOut = oldPc - 4; 
+      //Return addresses are in the functional engine's text addresses (from
+      //INITIAL_PC), so either engine can pick up a run the other started
+      oldPc = s.pc - PROG_START + INITIAL_PC;
+      s.pc = a - 4 - INITIAL_PC + PROG_START;
+      s.aluOut = oldPc - 4;
       s.writeBack = 1;
       s.flush = 1;
       s.exec = 1;
    } else if (s.inst.type == JAL_CODE) {
-      s.aluOut = s.pc + 8; 
+      s.aluOut = s.pc - PROG_START + INITIAL_PC + 8;
       s.writeBack = 1;
       s.pc = (s.inst.inst & 0x1FFFFFF) * 4 + PROG_START;
       s.flush = 1;
       s.exec = 1;
    } else if (s.inst.type == SYSCALL_CODE) {
-      if (registers[2]  == 10) {
+      if (a == 10) {
          s.pc = -1; 
+         s.flush = 1;
       }
       s.exec = 1;
    } else {
@@ -951,238 +529,1019 @@ status execute(status s, int *clockCycles) {
    return s;
 }
 
-status memoryAccess(status s, int *memRefs) {
+/**
+ * EX stage. Operands come through readOperand, so exMem and memWb are the
+ * latches of the two groups ahead of this one.
+ */
+status execute(status s, stageGroup *exMem, stageGroup *memWb, long *clockCycles) {
+   int a, b, src1, src2, extra = 0, line = (s.pc - PROG_START) / 4;
+
+   sourceRegisters(&s, &src1, &src2);
+   a = readOperand(src1, exMem, memWb);
+   b = readOperand(src2, exMem, memWb);
+   s = aluExecute(s, a, b, &extra);
+   *clockCycles += extra;
+   hazards.execute += extra;
+   if (profileEnabled && extra)
+      profileCycles(line, extra);
+
+   return s;
+}
+
+/**
+ * MEM stage: loads leave the loaded word in aluOut for WB and forwarding
+ */
+status memoryAccess(status s, long *memRefs, long *clockCycles) {
+   int penalty = 0, line;
+
    if (s.inst.type == LW_CODE) {
-      registers[s.rt] = s.aluOut;
-      *memRefs = 1;
+      if (cacheEnabled)
+         penalty = cacheRead(s.aluOut);
+      s.aluOut = memLoadWord(&sim.mainMemory, s.aluOut);
+      *memRefs += 1;
    } else if (s.inst.type == SW_CODE) {
-      assembledLines[registers[s.rs] + s.imm].inst = s.aluOut;
+      if (cacheEnabled)
+         penalty = cacheWrite(s.aluOut);
+      //A store into text has to reach the functional engine's micro-ops too
+      if ((line = memStoreWord(&sim.mainMemory, s.aluOut, s.storeData)) >= 0)
+         sim.decodedLines[line].handler = UOP_UNDECODED;
       *memRefs += 1;
    } 
+   *clockCycles += penalty;
+   hazards.memory += penalty;
+   if (profileEnabled && penalty) {
+      profileCycles((s.pc - PROG_START) / 4, penalty);
+      profileMiss((s.pc - PROG_START) / 4, penalty);
+   }
    
    s.busy = 1;
    
    return s;
 }
 
-status writeBack(status s, int *memRefs) {
-   if (s.inst.type == AND_CODE) {
-      registers[s.rd] = s.aluOut;
-   } else if (s.inst.type == OR_CODE) {
-      registers[s.rd] = s.aluOut;
-   } else if (s.inst.type ==  ORI_CODE) {
-      registers[s.rt] = s.aluOut;
-   } else if (s.inst.type == ADD_CODE) {
-      registers[s.rd] = registers[s.rs] + registers[s.rt];
-   } else if (s.inst.type ==  ADDU_CODE) {
-      registers[s.rd] = (unsigned) registers[s.rs] + (unsigned) registers[s.rt];
-   } else if (s.inst.type == ADDI_CODE) {
-      registers[s.rt] = registers[s.rs] + (short) s.imm;
-   } else if (s.inst.type == ADDIU_CODE) {
-      registers[s.rt] = (unsigned) registers[s.rs] & (unsigned short) s.imm;
-   } else if (s.inst.type == SLL_CODE) {
-      registers[s.rd] = registers[s.rt] << s.shamt;
-   } else if (s.inst.type == SRL_CODE) {
-      registers[s.rd] = registers[s.rt] >> s.shamt;
-   } else if (s.inst.type == SRA_CODE) {
-      registers[s.rd] = (unsigned) registers[s.rt] >> s.shamt;
-   } else if (s.inst.type == SUB_CODE) {
-      registers[s.rd] = registers[s.rs] - registers[s.rt];
-   } else if (s.inst.type == SLT_CODE) {
-      registers[s.rd] = registers[s.rs] < registers[s.rt] ? 1 : 0;
-   } else if (s.inst.type == SLTI_CODE) {
-      registers[s.rt] = registers[s.rs] < s.imm ? 1 : 0;
-   } else if (s.inst.type == SLTU_CODE) {
-      registers[s.rd] = (unsigned) registers[s.rs] < (unsigned) registers[s.rt] ? 1 : 0;
-   } else if (s.inst.type == SLTIU_CODE) {
-      registers[s.rt] = (unsigned) registers[s.rs] < (unsigned) s.imm ? 1 : 0;
-   } else if (s.inst.type == LUI_CODE) {
-      registers[s.rt] = (s.imm << 16) & 0xFFFF0000;
-   } else if (s.inst.type == LW_CODE) {
-      registers[s.rt] = assembledLines[registers[s.rs] + s.imm].inst;
-      *memRefs += 1;
-   } else if (s.inst.type == SW_CODE) {
-      assembledLines[registers[s.rs] + s.imm].inst = registers[s.rt];
-      *memRefs += 1;
-   } else if (s.inst.type == JAL_CODE) {
-      registers[31] = s.aluOut;
-   }
+status writeBack(status s) {
+   int dest = destRegister(&s);
+
+   if (s.writeBack && dest >= 0)
+      sim.registers[dest] = s.aluOut;
    
    return s;
 }
 
-void printStats(int instExec, int memRefs, int totClock, int fetcher) {
+/**
+ * Issue slots offered so far, every one either used or charged to a cause
+ */
+static long issueSlots(void) {
+   return hazards.issued + hazards.lostEmpty + hazards.lostLoadUse
+    + hazards.lostDependence + hazards.lostStructural + hazards.lostControl;
+}
+
+void printStats(long instExec, long memRefs, long totClock, long fetcher) {
    int j;
    
-   printf("Instructions executed: %d\n", instExec);
-   printf("Memory references: %d\n", memRefs);
-   printf("Clock cycles: %d\n", totClock);
-   printf("Instructions Fetched: %d\n", fetcher);
+   printf("Instructions executed: %ld\n", instExec);
+   printf("Memory references: %ld\n", memRefs);
+   printf("Clock cycles: %ld\n", totClock);
+   printf("Instructions Fetched: %ld\n", fetcher);
+   printf("Stalls: load-use %ld, control %ld, memory %ld, execute %ld\n", hazards.loadUse,
+    hazards.control, hazards.memory, hazards.execute);
+   printf("Forwarded operands: EX/MEM %ld, MEM/WB %ld\n", hazards.forwardExMem,
+    hazards.forwardMemWb);
+   printf("Issue width %d: IPC %.3f, %ld of %ld issue slots used (%.2f%%)\n",
+    config.issueWidth, totClock ? (double) instExec / totClock : 0.0, hazards.issued,
+    issueSlots(), issueSlots() ? 100.0 * hazards.issued / issueSlots() : 0.0);
+   printf("Lost issue slots: empty %ld, load-use %ld, dependence %ld, structural %ld, "
+    "control %ld\n", hazards.lostEmpty, hazards.lostLoadUse, hazards.lostDependence,
+    hazards.lostStructural, hazards.lostControl);
+   if (bpredEnabled)
+      bpredPrintStats(stdout);
+   if (cacheEnabled)
+      cachePrintStats(stdout);
+   for (j = 0; j < NUM_REGISTERS && !config.quiet; j++) {
+      printf("R%d = %08X\n", j, sim.registers[j]); 
+   }
+}
+
+/**
+ * Print final stats as a single JSON object, fetcher < 0 leaves it out
+ */
+void printStatsJson(const char *engine, long instExec, long memRefs, long totClock,
+ long fetcher) {
+   int j;
+
+   printf("{\"engine\": \"%s\", \"instructions\": %ld, \"memory_references\": %ld, "
+    "\"clock_cycles\": %ld", engine, instExec, memRefs, totClock);
+   if (fetcher >= 0) {
+      printf(", \"fetched\": %ld", fetcher);
+      printf(", \"stalls\": {\"load_use\": %ld, \"control\": %ld, \"memory\": %ld, "
+       "\"execute\": %ld}", hazards.loadUse, hazards.control, hazards.memory, hazards.execute);
+      printf(", \"forwarded\": {\"ex_mem\": %ld, \"mem_wb\": %ld}", hazards.forwardExMem,
+       hazards.forwardMemWb);
+      printf(", \"issue\": {\"width\": %d, \"ipc\": %.3f, \"issued\": %ld, \"slots\": %ld, "
+       "\"lost\": {\"empty\": %ld, \"load_use\": %ld, \"dependence\": %ld, "
+       "\"structural\": %ld, \"control\": %ld}}", config.issueWidth,
+       totClock ? (double) instExec / totClock : 0.0, hazards.issued, issueSlots(),
+       hazards.lostEmpty, hazards.lostLoadUse, hazards.lostDependence,
+       hazards.lostStructural, hazards.lostControl);
+      if (bpredEnabled)
+         bpredPrintStatsJson(stdout);
+   }
+   if (config.engine == 'o') {
+      oooPrintStatsJson(stdout);
+      if (bpredEnabled)
+         bpredPrintStatsJson(stdout);
+   }
+   if (config.engine == 's' && timingEnabled) {
+      if (config.timing)
+         timingPrintStatsJson(stdout);
+      if (bpredEnabled)
+         bpredPrintStatsJson(stdout);
+   }
+   if (config.sample) {
+      samplePrintStatsJson(stdout, instExec);
+      if (bpredEnabled)
+         bpredPrintStatsJson(stdout);
+   }
+   if (cacheEnabled)
+      cachePrintStatsJson(stdout);
+   printf(", \"registers\": [");
    for (j = 0; j < NUM_REGISTERS; j++) {
-      printf("R%d = %08X\n", j, registers[j]); 
+      printf("%s%d", j ? ", " : "", sim.registers[j]);
    }
+   printf("]}\n");
+}
+
+/**
+ * Register what --stats-dump collects beyond the engines' own counters:
+ * the histograms (stall lengths come from the pipeline alone, the others
+ * from the func and pipe engines) and the derived metrics
+ */
+static void statsSetup(void) {
+   statsCounter("instructions");
+   statsCounter("memory_references");
+   statsCounter("clock_cycles");
+   opcodeMix = statsHistogram("opcode_mix", NUM_UOPS, uopNames);
+   branchDistance = statsHistogram("branch_distance", 24, NULL);
+   stallLength = statsHistogram("stall_length", 24, NULL);
+   statsMetric("ipc", "instructions", "clock_cycles", 1);
+   statsMetric("cpi", "clock_cycles", "instructions", 1);
+   if (config.l1i)
+      statsMetric("l1i.mpki", "l1i.misses", "instructions", 1000);
+   if (config.l1d)
+      statsMetric("l1d.mpki", "l1d.misses", "instructions", 1000);
+   if (config.l2)
+      statsMetric("l2.mpki", "l2.misses", "instructions", 1000);
+   if (config.bpred)
+      statsMetric("bpred.mpki", "bpred.mispredicts", "instructions", 1000);
+   nextSample = config.statsInterval;
+}
+
+/**
+ * Copy the engine's counters into the registry, fetcher < 0 for the
+ * engines without the pipeline's hazard counters
+ */
+static void publishStats(long instExec, long memRefs, long totClock, long fetcher) {
+   if (!statsEnabled)
+      return;
+   statsSet("instructions", instExec);
+   statsSet("memory_references", memRefs);
+   statsSet("clock_cycles", totClock);
+   if (fetcher >= 0) {
+      statsSet("fetched", fetcher);
+      statsSet("stalls.load_use", hazards.loadUse);
+      statsSet("stalls.control", hazards.control);
+      statsSet("stalls.memory", hazards.memory);
+      statsSet("stalls.execute", hazards.execute);
+   }
+   if (cacheEnabled)
+      cachePublishStats();
+   if (bpredEnabled)
+      bpredPublishStats();
+}
+
+/**
+ * Interval dump for --stats-interval, once instExec has reached the next
+ * multiple of the interval
+ */
+static void statsTick(long instExec, long memRefs, long totClock, long fetcher) {
+   publishStats(instExec, memRefs, totClock, fetcher);
+   statsDump();
+   nextSample = (instExec / config.statsInterval + 1) * config.statsInterval;
+}
+
+/**
+ * Read the next step/run/quit command. Batch runs (--run) never prompt.
+ */
+char readCommand() {
+   char cmd;
+
+   if (config.run)
+      return 'r';
+
+   if (config.reverse)
+      printf("Enter command (s for single step, r for run, b [N] to step back, "
+       "l $reg|addr to go back to its last write, q for quit): ");
+   else
+      printf("Enter command (s for single step, r for run, q for quit): ");
+   if (scanf(" %c", &cmd) != 1)
+      return 'q';
+
+   cmdArgs[0] = '\0';
+   if (config.reverse && (cmd == 'b' || cmd == 'l') && fgets(cmdArgs, sizeof(cmdArgs), stdin))
+      cmdArgs[strcspn(cmdArgs, "\n")] = '\0';
+
+   return cmd;
 }
    
+/**
+ * Pipeline latches, each a group of up to issueWidth instructions. wb is
+ * only non-empty in the cycle its group was written back, which is what
+ * makes it the MEM/WB forwarding source.
+ */
+typedef struct {
+   stageGroup fetch;
+   stageGroup decode;
+   stageGroup execute;
+   stageGroup memory;
+   stageGroup wb;
+   int next;      // line to fetch next, -1 once a SYSCALL exit has left EX
+} pipeline;
+
+/**
+ * The engine section of a snapshot taken mid-pipeline
+ */
+typedef struct {
+   pipeline p;
+   hazardStats hazards;
+} pipeSnapshot;
+
+/**
+ * Write the --checkpoint snapshot, once
+ */
+static void checkpoint(const machineResume *at) {
+   config.checkpointAt = -1;
+   if (snapshotWrite(config.checkpointFile, &sim, at) != 0)
+      perror(config.checkpointFile);
+}
+
+/**
+ * A snapshot taken mid-pipeline has instructions in flight that only the
+ * pipeline can finish
+ */
+static int resumable(void) {
+   if (sim.resume.engine == SNAPSHOT_ENGINE_NONE)
+      return 1;
+   fprintf(stderr, "snapshot was taken mid-pipeline, resume it with the pipe engine\n");
+   return 0;
+}
+
+/**
+ * The micro-op handler of a line, for the opcode mix
+ */
+static int uopAt(int line) {
+   uop *op = &sim.decodedLines[line];
+
+   if (op->handler == UOP_UNDECODED)
+      predecodeLine(&sim.assembledLines[line], line, op);
+
+   return op->handler;
+}
+
+static int usesMemPort(status *s) {
+   return s->inst.type == LW_CODE || s->inst.type == SW_CODE;
+}
+
+/**
+ * Drop the decoded and fetched instructions behind a mispredicted
+ * instruction, issued being how many of the decode latch have gone
+ */
+static void squashYounger(pipeline *p, int issued) {
+   hazards.control += p->decode.count - issued + p->fetch.count;
+   p->decode.count = 0;
+   p->fetch.count = 0;
+}
+
+/**
+ * Issue from the decode latch into EX: the longest in-order prefix with no
+ * load-use interlock and no dependence on an older instruction in the same
+ * packet that fits the ALUs and memory ports. Instructions execute as they
+ * issue, so a redirect squashes everything younger, the rest of the
+ * packet included. Slots left empty are charged to whatever stopped issue,
+ * which is returned.
+ */
+static long *issue(pipeline *p, long *totClock, long *instExec) {
+   int width = config.issueWidth, alus = config.alus ? config.alus : width;
+   int usedAlus = 0, usedPorts = 0, line, actual, kind, k, younger;
+   long *stop = &hazards.lostEmpty;
+   status *s, *e;
+
+   p->execute.count = 0;
+   for (k = 0; k < p->decode.count && p->execute.count < width; k++) {
+      s = &p->decode.slot[k];
+      if (config.maxInsts >= 0 && *instExec >= config.maxInsts)
+         break;
+      if (loadUseHazard(s, &p->memory)) {
+         stop = &hazards.lostLoadUse;
+         hazards.loadUse++;
+         if (profileEnabled)
+            profileStall((s->pc - PROG_START) / 4);
+         break;
+      }
+      if (readsResultOf(s, p->execute.slot, p->execute.count, 0)) {
+         stop = &hazards.lostDependence;
+         break;
+      }
+      if (!s->nop && (usesMemPort(s) ? usedPorts == config.memPorts : usedAlus == alus)) {
+         stop = &hazards.lostStructural;
+         break;
+      }
+      if (!s->nop && usesMemPort(s))
+         usedPorts++;
+      else if (!s->nop)
+         usedAlus++;
+
+      line = (s->pc - PROG_START) / 4;
+      e = &p->execute.slot[p->execute.count++];
+      *e = execute(*s, &p->memory, &p->wb, totClock);
+      hazards.issued++;
+      if (e->exec)
+         (*instExec)++;
+      if (profileEnabled && e->exec)
+         profileExec(line, 0);
+      if (statsEnabled && e->exec)
+         statsSample(opcodeMix, uopAt(line));
+      if (e->flush && e->pc < 0) {
+         p->decode.count = 0;
+         p->fetch.count = 0;
+         p->next = -1;
+         stop = &hazards.lostControl;
+         break;
+      }
+
+      actual = e->flush ? (e->pc - PROG_START) / 4 : line + 1;
+      if (statsEnabled && e->flush)
+         statsSample(branchDistance, actual > line ? actual - line : line - actual);
+      kind = branchKind(e);
+      younger = p->decode.count - k - 1 + p->fetch.count;
+      if (bpredEnabled && kind >= 0)
+         bpredResolve(line, kind, e->flush, kind == BRANCH_COND
+          ? line + (short) (e->inst.inst & 0xFFFF) : actual, e->predicted, younger);
+      //Fetch went down the wrong path, squash it and redirect
+      if (actual != e->predicted) {
+         if (profileEnabled)
+            profileFlush(line);
+         squashYounger(p, k + 1);
+         p->next = actual;
+         stop = &hazards.lostControl;
+         break;
+      }
+   }
+
+   if (p->decode.count > 0) {
+      k = p->execute.count;
+      memmove(p->decode.slot, p->decode.slot + k, (p->decode.count - k) * sizeof(status));
+      p->decode.count -= k;
+   }
+   *stop += width - p->execute.count;
+
+   return stop;
+}
+
+static unsigned char bubbles[STAGE_COUNT];   // what each empty latch holds, for the stage log
+
+/**
+ * Log one stage group. held marks instructions that were already in the
+ * stage last cycle.
+ */
+static void logGroup(long cycle, stageGroup *g, int stage, int held) {
+   status *s;
+   int k;
+
+   if (g->count == 0) {
+      stageLogRecord(cycle, 0, 0, 0, stage, bubbles[stage], 0);
+      return;
+   }
+   for (k = 0; k < g->count; k++) {
+      s = &g->slot[k];
+      stageLogRecord(cycle, s->seq, s->fetchPc, s->inst.inst, stage, s->inst.inst == 0
+       ? STAGE_NOP : held ? STAGE_STALL : STAGE_BUSY, k);
+   }
+}
+
+/**
+ * Log a cycle the whole pipeline spent held by a shift or a miss penalty:
+ * every instruction stays where it is and every empty stage is a stall.
+ */
+static void logHeld(pipeline *p, long cycle) {
+   stageGroup *groups[STAGE_COUNT] = {&p->fetch, &p->decode, &p->execute, &p->memory, &p->wb};
+   status *s;
+   int stage, k;
+
+   for (stage = 0; stage < STAGE_COUNT; stage++) {
+      if (groups[stage]->count == 0)
+         stageLogRecord(cycle, 0, 0, 0, stage, STAGE_EMPTY_STALL, 0);
+      for (k = 0; k < groups[stage]->count; k++) {
+         s = &groups[stage]->slot[k];
+         stageLogRecord(cycle, s->seq, s->fetchPc, s->inst.inst, stage, s->inst.inst == 0
+          ? STAGE_NOP : STAGE_STALL, k);
+      }
+   }
+}
+
+/**
+ * Carry the bubbles one stage down and log where every instruction is at
+ * the end of a cycle. stop is what held issue back, and fetched and
+ * decoded say whether the IF and ID latches were refilled this cycle.
+ * A shift in EX or a cache miss penalty moves the clock on within the
+ * cycle, to end; the cycles after cycle up to end are logged as held.
+ */
+static void logStages(pipeline *p, long cycle, long end, long *stop, int fetched,
+ int decoded) {
+   unsigned char prev[STAGE_COUNT];
+   long held;
+
+   memcpy(prev, bubbles, sizeof(prev));
+   bubbles[STAGE_WB] = prev[STAGE_MEM];
+   bubbles[STAGE_MEM] = prev[STAGE_EX];
+   if (stop == &hazards.lostControl)
+      bubbles[STAGE_EX] = STAGE_EMPTY_FLUSH;
+   else if (stop == &hazards.lostEmpty)
+      bubbles[STAGE_EX] = prev[STAGE_ID];
+   else
+      bubbles[STAGE_EX] = STAGE_EMPTY_STALL;
+   bubbles[STAGE_ID] = stop == &hazards.lostControl ? STAGE_EMPTY_FLUSH : prev[STAGE_IF];
+   bubbles[STAGE_IF] = STAGE_EMPTY_IDLE;
+
+   if (stageLogWanted(cycle)) {
+      logGroup(cycle, &p->fetch, STAGE_IF, !fetched);
+      logGroup(cycle, &p->decode, STAGE_ID, !decoded);
+      logGroup(cycle, &p->execute, STAGE_EX, 0);
+      logGroup(cycle, &p->memory, STAGE_MEM, 0);
+      logGroup(cycle, &p->wb, STAGE_WB, 0);
+   }
+   for (held = cycle + 1; held <= end; held++) {
+      if (stageLogWanted(held))
+         logHeld(p, held);
+   }
+}
+
+/**
+ * The line a pipeline clock is charged to in the profile: the oldest
+ * instruction waiting to issue, or when nothing waits the one fetch is
+ * after, so a refill lands on the target it is waiting for. The drain
+ * after the program exits is not charged to anything.
+ */
+static int cycleOwner(pipeline *p) {
+   if (p->decode.count > 0)
+      return (p->decode.slot[0].pc - PROG_START) / 4;
+   if (p->fetch.count > 0)
+      return (p->fetch.slot[0].pc - PROG_START) / 4;
+   return p->next;
+}
+
+/**
+ * Advance the pipeline one clock. Stages run in reverse so each latch is
+ * consumed before it is refilled. Returns 0 once the pipeline has drained.
+ */
+static int pipelineCycle(pipeline *p, int numLines, long *memRefs, long *totClock,
+ long *instExec, long *fetcher) {
+   status *s;
+   long cycle = *totClock;
+   int k, taken, owner, fetched = 0, decoded = 0;
+   long *stop;
+
+   if (profileEnabled && (owner = cycleOwner(p)) >= 0 && owner < numLines)
+      profileCycles(owner, 1);
+   for (k = 0; k < p->memory.count; k++)
+      p->wb.slot[k] = writeBack(p->memory.slot[k]);
+   p->wb.count = p->memory.count;
+   for (k = 0; k < p->execute.count; k++)
+      p->memory.slot[k] = memoryAccess(p->execute.slot[k], memRefs, totClock);
+   p->memory.count = p->execute.count;
+   stop = issue(p, totClock, instExec);
+   if (statsEnabled) {
+      if (p->execute.count == 0 && stop != &hazards.lostEmpty && stop != &hazards.lostControl) {
+         stallRun++;
+      } else if (stallRun > 0) {
+         statsSample(stallLength, stallRun);
+         stallRun = 0;
+      }
+   }
+   if (p->fetch.count > 0 && p->decode.count == 0) {
+      for (k = 0; k < p->fetch.count; k++)
+         p->decode.slot[k] = instructionDecode(p->fetch.slot[k]);
+      p->decode.count = p->fetch.count;
+      p->fetch.count = 0;
+      decoded = 1;
+   }
+   //Fetch a group along the predicted path, ending it at a predicted taken transfer
+   if (p->fetch.count == 0) {
+      fetched = 1;
+      while (p->fetch.count < config.issueWidth && p->next >= 0 && p->next < numLines) {
+         s = &p->fetch.slot[p->fetch.count++];
+         *s = instructionFetch(p->next, totClock);
+         s->predicted = bpredEnabled ? bpredPredict(p->next) : p->next + 1;
+         (*fetcher)++;
+         s->seq = *fetcher;
+         taken = s->predicted != p->next + 1;
+         p->next = s->predicted;
+         if (taken)
+            break;
+      }
+   }
+   if (stageLogEnabled)
+      logStages(p, cycle, *totClock, stop, fetched, decoded);
+   (*totClock)++;
+
+   return (p->next >= 0 && p->next < numLines) || p->fetch.count || p->decode.count
+    || p->execute.count || p->memory.count;
+}
+
 void runProgramPipeline(int numLines) {
    char cmd;
-   int i = 0, j, memRefs = 0, clockCycles = 0, instExec = 0, totClock = 0, fetcher = 0;
-   status fetchReturn, decodeReturn, executeReturn, memReturn, wbReturn;
+   int j, running = numLines > 0;
+   long memRefs = sim.resume.memRefs, instExec = sim.resume.instExec,
+    totClock = sim.resume.cycles, fetcher = sim.resume.fetched;
+   machineResume at;
+   pipeSnapshot snap;
+   pipeline p;
    
+   memset(&p, 0, sizeof(p));
+   memset(bubbles, STAGE_EMPTY_IDLE, sizeof(bubbles));
+   p.next = sim.resume.pc;
+   if (sim.resume.engine == SNAPSHOT_ENGINE_PIPE) {
+      if (sim.resume.engineSize != sizeof(pipeSnapshot)) {
+         fprintf(stderr, "snapshot is from a different pipeline build\n");
+         return;
+      }
+      memcpy(&snap, sim.resume.engineState, sizeof(snap));
+      p = snap.p;
+      hazards = snap.hazards;
+   }
 
-   initRegisters();
-
-   while (i < numLines && i >= 0) {
-      printf("Enter command (s for single step, r for run, q for quit): ");
-      scanf(" %c", &cmd);
+   while (running) {
+      cmd = readCommand();
 
       if (cmd == 's') {
-            if (memReturn.busy == 1) {
-               wbReturn = writeBack(memReturn, &memRefs);
-               memReturn.busy = 0;
-            }
-            if (executeReturn.busy == 1 && memReturn.busy != 1) {
-               memReturn = memoryAccess(executeReturn, &memRefs);
-               executeReturn.busy = 0;
-            }
-            if (decodeReturn.busy == 1 && executeReturn.busy != 1) {
-               executeReturn = execute(decodeReturn, &totClock);
-               decodeReturn.busy = 0;
-               if (executeReturn.flush == 1) {
-                  fetchReturn.busy = 0;
-                  decodeReturn.busy = 0;
-                  i = (executeReturn.pc - PROG_START) / 4;
-               }
-            }
-            if (fetchReturn.busy == 1 && decodeReturn.busy != 1) {
-               decodeReturn = instructionDecode(fetchReturn);
-               fetchReturn.busy = 0;
-            }
-            if (fetchReturn.busy != 1) {
-               fetchReturn = instructionFetch(i);
-               if (fetchReturn.pc == -1) {
-                  i = -1;
-               }
-               i++;
-            }
-            
-            if (executeReturn.exec == 1 && executeReturn.nop != 1)
-               instExec++;
-            
-            if (fetchReturn.busy == 1)
-               fetcher++;   
-               
-            totClock++;
+         running = pipelineCycle(&p, numLines, &memRefs, &totClock, &instExec, &fetcher);
          
          //printf("Instructions executed (step): %d\n", 1);
-         printf("Instructions executed (total): %d\n", instExec);
-         printf("Memory references: %d\n", memRefs);
-         //printf("Clock cycles (step): %d\n", 1);
-         printf("Clock cycles (total): %d\n", totClock);
-         printf("fetcher: %d\n", fetcher);
+         printf("Instructions executed (total): %ld\n", instExec);
+         printf("Memory references: %ld\n", memRefs);
+         //printf("Clock cycles (step): %ld\n", 1);
+         printf("Clock cycles (total): %ld\n", totClock);
+         printf("fetcher: %ld\n", fetcher);
             
          for (j = 0; j < NUM_REGISTERS; j++) {
-            printf("R%d = %08X\n", j, registers[j]); 
+            printf("R%d = %08X\n", j, sim.registers[j]); 
          }
             
       } else if (cmd == 'r') {
-         while (i < numLines && executeReturn.pc >= 0) {
-            if (memReturn.busy == 1) {
-               wbReturn = writeBack(memReturn, &memRefs);
-               memReturn.busy = 0;
-            }
-            if (executeReturn.busy == 1 && memReturn.busy != 1) {
-               memReturn = memoryAccess(executeReturn, &memRefs);
-               executeReturn.busy = 0;
+         while (running) {
+            //Budget spent: stop fetching and let what has executed retire
+            if (config.maxInsts >= 0 && instExec >= config.maxInsts) {
+               p.fetch.count = 0;
+               p.decode.count = 0;
+               p.next = -1;
             }
-            if (decodeReturn.busy == 1 && executeReturn.busy != 1) {
-               executeReturn = execute(decodeReturn, &totClock);
-               decodeReturn.busy = 0;
-               if (executeReturn.flush == 1) {
-                  fetchReturn.busy = 0;
-                  decodeReturn.busy = 0;
-                  i = (executeReturn.pc - PROG_START) / 4;
-               }
+            running = pipelineCycle(&p, numLines, &memRefs, &totClock, &instExec, &fetcher);
+            if (config.checkpointAt >= 0 && instExec - sim.resume.instExec >= config.checkpointAt) {
+               snap.p = p;
+               snap.hazards = hazards;
+               at = (machineResume) {.pc = p.next, .instExec = instExec, .memRefs = memRefs,
+                .cycles = totClock, .fetched = fetcher, .engine = SNAPSHOT_ENGINE_PIPE,
+                .engineState = &snap, .engineSize = sizeof(snap)};
+               checkpoint(&at);
             }
-            if (fetchReturn.busy == 1 && decodeReturn.busy != 1) {
-               decodeReturn = instructionDecode(fetchReturn);
-               fetchReturn.busy = 0;
-               if (decodeReturn.pc == -1) {
-                  printStats(instExec, memRefs, totClock, fetcher);
-                  return;
-               }
-            }
-            if (fetchReturn.busy != 1) {
-               fetchReturn = instructionFetch(i);
-               if (fetchReturn.pc == -1) {
-                  i = -1;
-               }
-               i++;
+            if (statsEnabled && config.statsInterval && instExec >= nextSample)
+               statsTick(instExec, memRefs, totClock, fetcher);
+         }
+         publishStats(instExec, memRefs, totClock, fetcher);
+         if (config.statsJson)
+            printStatsJson("pipe", instExec, memRefs, totClock, fetcher);
+         else
+            printStats(instExec, memRefs, totClock, fetcher);
+         if (config.run)
+            return;
+      } else if (cmd == 'q') {
+         running = 0;
+      } else {
+         printf("Invalid Command.\n");
+      }
+   }
+}
+
+/**
+ * Sampled runs between windows: run the functional core on to instruction
+ * until, feeding the caches and predictor each instruction the way the
+ * pipeline would so the next window starts with them warm (until -1 runs
+ * to the end). Returns the line to run next.
+ */
+static int fastForward(int i, int numLines, long until, long *memRefs, long *instExec) {
+   streamRecord r;
+
+   while (i >= 0 && i < numLines && (until < 0 || *instExec < until)) {
+      i = machineStep(&sim, &sim.decodedLines[i], memRefs, i, &r);
+      timingAnnotate(&r);
+      (*instExec)++;
+   }
+
+   return i;
+}
+
+/**
+ * One detailed window of a sampled run: fill an empty pipeline from line
+ * i and run it until instExec reaches end, measuring from when it reaches
+ * measure into w. Then stop fetching and drain it, so the functional core
+ * can take over. Returns the oldest line that did not execute, -1 once
+ * the program has exited.
+ */
+static int detailWindow(int i, int numLines, long measure, long end, long *memRefs,
+ long *instExec, long *totClock, long *fetcher, sampleWindow *w) {
+   long budget = config.maxInsts, from = -1;
+   int running = 1, next;
+   pipeline p;
+
+   memset(&p, 0, sizeof(p));
+   memset(bubbles, STAGE_EMPTY_IDLE, sizeof(bubbles));
+   p.next = i;
+   w->insts = 0;
+   //issue stops at the budget, so the window ends on the instruction asked for
+   config.maxInsts = end;
+   while (running && *instExec < end) {
+      if (from < 0 && *instExec >= measure) {
+         from = *totClock;
+         w->start = *instExec;
+      }
+      running = pipelineCycle(&p, numLines, memRefs, totClock, instExec, fetcher);
+   }
+   if (from >= 0) {
+      w->insts = *instExec - w->start;
+      w->cycles = *totClock - from;
+   }
+
+   if (p.decode.count > 0)
+      next = (p.decode.slot[0].pc - PROG_START) / 4;
+   else if (p.fetch.count > 0)
+      next = (p.fetch.slot[0].pc - PROG_START) / 4;
+   else
+      next = p.next;
+   p.fetch.count = 0;
+   p.decode.count = 0;
+   p.next = -1;
+   while (running)
+      running = pipelineCycle(&p, numLines, memRefs, totClock, instExec, fetcher);
+   config.maxInsts = budget;
+
+   return next;
+}
+
+/**
+ * Whether the program starting at line i, with instExec instructions
+ * executed, is still running once it reaches instruction until. Found on
+ * a copy of the machine, so sim stays where it is.
+ */
+static int reaches(int i, int numLines, long instExec, long until) {
+   machine *ahead;
+   streamRecord r;
+   long refs = 0;
+
+   if ((ahead = malloc(sizeof(machine))) == NULL)
+      return 1;
+   machineFork(ahead, &sim);
+   for (; i >= 0 && i < numLines && instExec < until; instExec++)
+      i = machineStep(ahead, &ahead->decodedLines[i], &refs, i, &r);
+   machineFree(ahead);
+   free(ahead);
+
+   return i >= 0 && i < numLines;
+}
+
+/**
+ * --sample: the pipeline runs only in windows, the functional core
+ * fast-forwards between them, and the clock cycles are extrapolated from
+ * the windows' CPI. bbv runs the program ahead once on a copy of the
+ * machine to find the phases before the real pass. Like the ooo engine
+ * there is no single step.
+ */
+void runProgramSampled(int numLines) {
+   char cmd;
+   int i = sim.resume.pc, j, k, count;
+   long memRefs = sim.resume.memRefs, instExec = sim.resume.instExec,
+    totClock = sim.resume.cycles, fetcher = 0, start = instExec, end, at, refs = 0, n,
+    budget = config.maxInsts < 0 ? -1 : instExec + config.maxInsts;
+   long intervals[SAMPLE_MAX_CLUSTERS];
+   double weights[SAMPLE_MAX_CLUSTERS];
+   sampleWindow w;
+   streamRecord r;
+   machine *ahead;
+
+   if (!resumable())
+      return;
+   while ((cmd = readCommand()) != 'r') {
+      if (cmd == 'q')
+         return;
+      printf("Invalid Command.\n");
+   }
+   sampleInit(&sampling, numLines, instExec, totClock);
+
+   w.weight = 1;
+   w.insts = 0;
+   at = start + sampling.period - sampling.window - sampling.warmup;
+   if (sampling.mode == SAMPLE_PERIODIC && ((budget >= 0 && budget <= at + sampling.warmup)
+    || !reaches(i, numLines, instExec, at + sampling.warmup))) {
+      //Over before its first window, so there is nothing to extrapolate from: measure it all
+      i = detailWindow(i, numLines, instExec, budget < 0 ? LONG_MAX : budget, &memRefs,
+       &instExec, &totClock, &fetcher, &w);
+      if (w.insts > 0)
+         sampleRecord(&w);
+   } else if (sampling.mode == SAMPLE_PERIODIC) {
+      for (; i >= 0 && i < numLines && (budget < 0 || instExec < budget); at += sampling.period) {
+         i = fastForward(i, numLines, budget >= 0 && budget < at ? budget : at, &memRefs,
+          &instExec);
+         end = instExec + sampling.warmup + sampling.window;
+         if (i >= 0 && i < numLines && (budget < 0 || instExec < budget))
+            i = detailWindow(i, numLines, instExec + sampling.warmup, budget >= 0
+             && budget < end ? budget : end, &memRefs, &instExec, &totClock, &fetcher, &w);
+         if (w.insts > 0)
+            sampleRecord(&w);
+         w.insts = 0;
+      }
+   } else {
+      if ((ahead = malloc(sizeof(machine))) == NULL) {
+         perror("sample");
+         return;
+      }
+      machineFork(ahead, &sim);
+      for (j = i, n = start; j >= 0 && j < numLines && (budget < 0 || n < budget); ) {
+         j = machineStep(ahead, &ahead->decodedLines[j], &refs, j, &r);
+         bbvStep(r.line, r.taken);
+         if ((++n - start) % sampling.window == 0)
+            bbvEndInterval(sampling.window);
+      }
+      bbvEndInterval((n - start) % sampling.window);
+      machineFree(ahead);
+      free(ahead);
+
+      count = bbvChoose(intervals, weights);
+      for (k = 0; k < count && i >= 0 && i < numLines; k++) {
+         at = start + intervals[k] * sampling.window;
+         n = at - sampling.warmup > instExec ? at - sampling.warmup : instExec;
+         i = fastForward(i, numLines, n, &memRefs, &instExec);
+         end = at + sampling.window;
+         w.insts = 0;
+         if (i >= 0 && i < numLines)
+            i = detailWindow(i, numLines, at, budget >= 0 && budget < end ? budget : end,
+             &memRefs, &instExec, &totClock, &fetcher, &w);
+         w.weight = weights[k];
+         if (w.insts > 0)
+            sampleRecord(&w);
+      }
+   }
+   //The rest of the run, so the architectural state at exit is the real one
+   i = fastForward(i, numLines, budget, &memRefs, &instExec);
+
+   totClock = sampleCycles(instExec);
+   publishStats(instExec, memRefs, totClock, -1);
+   if (config.statsJson) {
+      printStatsJson("pipe", instExec, memRefs, totClock, -1);
+   } else {
+      printf("Instructions executed: %ld\n", instExec);
+      printf("Memory references: %ld\n", memRefs);
+      printf("Clock cycles: %ld\n", totClock);
+      samplePrintStats(stdout, instExec);
+      if (bpredEnabled)
+         bpredPrintStats(stdout);
+      if (cacheEnabled)
+         cachePrintStats(stdout);
+      for (j = 0; j < NUM_REGISTERS && !config.quiet; j++) {
+         printf("R%d = %08X\n", j, sim.registers[j]); 
+      }
+   }
+   sampleFree();
+}
+
+/**
+ * Log the step about to run at i for --reverse. When the history cannot
+ * grow any further it is dropped and --reverse turns off, so the run
+ * carries on without it.
+ */
+static void recordStep(reverseLog *rev, int i, long instExec, long memRefs, long totClock) {
+   reversePos pos = {i, instExec, memRefs, totClock};
+
+   if (reverseRecord(rev, &sim, &pos) != 0) {
+      fprintf(stderr, "--reverse: out of memory, history stops at instruction %ld\n",
+       instExec);
+      reverseFree(rev);
+      config.reverse = 0;
+   }
+}
+
+/**
+ * Move the functional engine to where a b or l command asked, from the
+ * history kept with --reverse
+ */
+static void reverseCommand(char cmd, reverseLog *rev, reversePos *pos) {
+   char *arg = cmdArgs, *end;
+   long n, found;
+   int reg, j;
+
+   //The rest of the word, as in "back 10" or "last $t0"
+   while (*arg >= 'a' && *arg <= 'z')
+      arg++;
+   while (*arg == ' ' || *arg == '\t')
+      arg++;
+
+   if (cmd == 'b') {
+      n = *arg ? strtol(arg, &end, 10) : 1;
+      if (n < 0 || (*arg && *end != '\0')) {
+         printf("Invalid Command.\n");
+         return;
+      }
+      reverseGoto(rev, &sim, rev->step - n, pos);
+      printf("Back at step %ld, line %d\n", rev->step, pos->pc);
+   } else {
+      if (*arg == '$') {
+         if ((reg = getRegisterNumber(arg, strlen(arg))) < 0) {
+            printf("Invalid Command.\n");
+            return;
+         }
+         found = reverseLastRegWrite(rev, &sim, reg, pos);
+      } else {
+         n = strtoul(arg, &end, 0);
+         if (*arg == '\0' || *end != '\0') {
+            printf("Invalid Command.\n");
+            return;
+         }
+         found = reverseLastMemWrite(rev, &sim, n, pos);
+      }
+      if (found < 0) {
+         printf("No write to %s recorded\n", arg);
+         return;
+      }
+      printf("Last write to %s is step %ld, line %d\n", arg, found, pos->pc);
+   }
+
+   for (j = 0; j < NUM_REGISTERS; j++) {
+      printf("R%d = %08X\n", j, sim.registers[j]); 
+   }
+}
+
+void runProgram(int numLines) {
+   char cmd = 0;
+   int i = sim.resume.pc, j;
+   long memRefs = sim.resume.memRefs, clockCycles = 0, instExec = sim.resume.instExec,
+    totClock = sim.resume.cycles, steps = 0;
+   machineResume at;
+   reverseLog rev;
+   reversePos pos;
+
+   if (!resumable())
+      return;
+   reverseInit(&rev);
+
+   //With history on, the prompt stays up after the program exits
+   while ((i < numLines && i >= 0) || (config.reverse && cmd != 'q')) {
+      cmd = readCommand();
+
+      if (cmd == 's' && (i >= numLines || i < 0)) {
+         printf("Program has exited.\n");
+      } else if (cmd == 's') {
+         if (config.reverse)
+            recordStep(&rev, i, instExec, memRefs, totClock);
+         clockCycles = 0;
+         memRefs = 0;
+         i = runCommand(&sim.decodedLines[i], &memRefs, &clockCycles, i);
+         instExec++;
+         totClock += clockCycles;
+
+         printf("Instructions executed (step): %d\n", 1);
+         printf("Instructions executed (total): %ld\n", instExec);
+         printf("Memory references: %ld\n", memRefs);
+         printf("Clock cycles (step): %ld\n", clockCycles);
+         printf("Clock cycles (total): %ld\n", totClock);
+         for (j = 0; j < NUM_REGISTERS; j++) {
+            printf("R%d = %08X\n", j, sim.registers[j]); 
+         }
+      } else if (cmd == 'r') {
+         while (i < numLines && i >= 0
+          && (config.maxInsts < 0 || steps < config.maxInsts)) {
+            if (steps == config.checkpointAt) {
+               at = (machineResume) {.pc = i, .instExec = instExec, .memRefs = memRefs,
+                .cycles = totClock, .engine = SNAPSHOT_ENGINE_NONE};
+               checkpoint(&at);
             }
-            
-            if (executeReturn.exec == 1 && executeReturn.nop != 1)
+            if (config.reverse)
+               recordStep(&rev, i, instExec, memRefs, totClock);
+            i = runCommand(&sim.decodedLines[i], &memRefs, &totClock, i);
+            if (i > 0)
                instExec++;
-            
-            if (fetchReturn.busy == 1)
-               fetcher++;   
-               
-            totClock++;
+            steps++;
+            if (statsEnabled && config.statsInterval && instExec >= nextSample)
+               statsTick(instExec, memRefs, totClock, -1);
          }
-         printStats(instExec, memRefs, totClock, fetcher);
-         /*
-         printf("Instructions executed: %d\n", instExec);
-         printf("Memory references: %d\n", memRefs);
-         printf("Clock cycles: %d\n", totClock);
-         printf("fetcher: %d\n", fetcher);
-         for (j = 0; j < NUM_REGISTERS; j++) {
-            printf("R%d = %08X\n", j, registers[j]); 
-         }*/
-         //printf("i: %d  executeReturn.pc: %08x  numlinees: %d\n", i, executeReturn.pc, numLines);
+
+         publishStats(instExec, memRefs, totClock, -1);
+         if (config.statsJson) {
+            printStatsJson("func", instExec, memRefs, totClock, -1);
+         } else {
+            printf("Instructions executed: %ld\n", instExec);
+            printf("Memory references: %ld\n", memRefs);
+            printf("Clock cycles: %ld\n", totClock);
+            if (config.timing)
+               timingPrintStats(stdout);
+            if (bpredEnabled && timingEnabled)
+               bpredPrintStats(stdout);
+            if (cacheEnabled)
+               cachePrintStats(stdout);
+            for (j = 0; j < NUM_REGISTERS && !config.quiet; j++) {
+               printf("R%d = %08X\n", j, sim.registers[j]); 
+            }
+         }
+         if (config.run)
+            break;
+      } else if ((cmd == 'b' || cmd == 'l') && config.reverse) {
+         pos = (reversePos) {i, instExec, memRefs, totClock};
+         reverseCommand(cmd, &rev, &pos);
+         i = pos.pc;
+         instExec = pos.instExec;
+         memRefs = pos.memRefs;
+         totClock = pos.cycles;
       } else if (cmd == 'q') {
          i = -1;
       } else {
          printf("Invalid Command.\n");
       }
    }
+   reverseFree(&rev);
 }
 
-void runProgram(int numLines) {
+/**
+ * Step/run loop for the engines that run predecoded lines in bulk
+ * (threaded interpreter and JIT)
+ */
+void runProgramEngine(int numLines, engineFn engine, const char *name) {
    char cmd;
-   int i = 0, j, memRefs = 0, clockCycles = 0, instExec = 0, totClock = 0;
+   int i = sim.resume.pc, j;
+   long memRefs = sim.resume.memRefs, clockCycles = 0, instExec = sim.resume.instExec,
+    totClock = sim.resume.cycles, stepExec, budget;
+   machineResume at;
 
-   initRegisters();
+   if (!resumable())
+      return;
 
    while (i < numLines && i >= 0) {
-      printf("Enter command (s for single step, r for run, q for quit): ");
-      scanf(" %c", &cmd);
+      cmd = readCommand();
 
       if (cmd == 's') {
          clockCycles = 0;
          memRefs = 0;
-         i = runCommand(&assembledLines[i], &memRefs, &clockCycles, i);
+         stepExec = 0;
+         i = engine(sim.decodedLines, &sim.mainMemory, sim.registers, numLines, i,
+          1, &memRefs, &clockCycles, &stepExec);
          instExec++;
          totClock += clockCycles;
 
          printf("Instructions executed (step): %d\n", 1);
-         printf("Instructions executed (total): %d\n", instExec);
-         printf("Memory references: %d\n", memRefs);
-         printf("Clock cycles (step): %d\n", clockCycles);
-         printf("Clock cycles (total): %d\n", totClock);
+         printf("Instructions executed (total): %ld\n", instExec);
+         printf("Memory references: %ld\n", memRefs);
+         printf("Clock cycles (step): %ld\n", clockCycles);
+         printf("Clock cycles (total): %ld\n", totClock);
          for (j = 0; j < NUM_REGISTERS; j++) {
-            printf("R%d = %08X\n", j, registers[j]); 
+            printf("R%d = %08X\n", j, sim.registers[j]); 
          }
       } else if (cmd == 'r') {
-         while (i < numLines && i >= 0) {
-            i = runCommand(&assembledLines[i], &memRefs, &totClock, i);
-            if (i > 0)
-               instExec++;
+         budget = config.maxInsts;
+         if (config.checkpointAt >= 0 && (budget < 0 || config.checkpointAt < budget)) {
+            i = engine(sim.decodedLines, &sim.mainMemory, sim.registers, numLines, i,
+             config.checkpointAt, &memRefs, &totClock, &instExec);
+            if (budget >= 0)
+               budget -= config.checkpointAt;
+            if (i >= 0 && i < numLines) {
+               at = (machineResume) {.pc = i, .instExec = instExec, .memRefs = memRefs,
+                .cycles = totClock, .engine = SNAPSHOT_ENGINE_NONE};
+               checkpoint(&at);
+            }
          }
+         if (i >= 0 && i < numLines)
+            i = engine(sim.decodedLines, &sim.mainMemory, sim.registers, numLines, i,
+             budget, &memRefs, &totClock, &instExec);
 
-         printf("Instructions executed: %d\n", instExec);
-         printf("Memory references: %d\n", memRefs);
-         printf("Clock cycles: %d\n", totClock);
-         for (j = 0; j < NUM_REGISTERS; j++) {
-            printf("R%d = %08X\n", j, registers[j]); 
+         publishStats(instExec, memRefs, totClock, -1);
+         if (config.statsJson) {
+            printStatsJson(name, instExec, memRefs, totClock, -1);
+         } else {
+            printf("Instructions executed: %ld\n", instExec);
+            printf("Memory references: %ld\n", memRefs);
+            printf("Clock cycles: %ld\n", totClock);
+            if (cacheEnabled)
+               cachePrintStats(stdout);
+            for (j = 0; j < NUM_REGISTERS && !config.quiet; j++) {
+               printf("R%d = %08X\n", j, sim.registers[j]); 
+            }
          }
+         if (config.run)
+            return;
       } else if (cmd == 'q') {
          i = -1;
       } else {
@@ -1191,28 +1550,365 @@ void runProgram(int numLines) {
    }
 }
 
+/**
+ * The out-of-order model runs to completion, there is no single step
+ */
+void runProgramOoo(void) {
+   oooConfig ooo;
+   char cmd;
+   long memRefs = sim.resume.memRefs, instExec = sim.resume.instExec,
+    totClock = sim.resume.cycles;
+   int j;
+
+   if (!resumable())
+      return;
+   if (config.checkpointAt >= 0) {
+      fprintf(stderr, "the ooo engine does not take checkpoints\n");
+      return;
+   }
+   ooo.width = config.issueWidth;
+   ooo.robSize = config.robSize;
+   ooo.rsSize = config.rsSize;
+   ooo.lsqSize = config.lsqSize;
+   ooo.alus = config.alus ? config.alus : config.issueWidth;
+   ooo.memPorts = config.memPorts;
+
+   while ((cmd = readCommand()) != 'r') {
+      if (cmd == 'q')
+         return;
+      printf("Invalid Command.\n");
+   }
+
+   if (runOoo(&sim.mainMemory, sim.registers, &ooo, sim.resume.pc,
+    config.maxInsts < 0 ? -1 : instExec + config.maxInsts, &memRefs, &totClock,
+    &instExec) != 0) {
+      perror("ooo");
+      return;
+   }
+
+   publishStats(instExec, memRefs, totClock, -1);
+   if (config.statsJson) {
+      printStatsJson("ooo", instExec, memRefs, totClock, -1);
+      return;
+   }
+   printf("Instructions executed: %ld\n", instExec);
+   printf("Memory references: %ld\n", memRefs);
+   printf("Clock cycles: %ld\n", totClock);
+   oooPrintStats(stdout);
+   if (bpredEnabled)
+      bpredPrintStats(stdout);
+   if (cacheEnabled)
+      cachePrintStats(stdout);
+   for (j = 0; j < NUM_REGISTERS && !config.quiet; j++) {
+      printf("R%d = %08X\n", j, sim.registers[j]); 
+   }
+}
+
+void usage(char *prog) {
+   fprintf(stderr, "usage: %s [--engine=func|pipe|threaded|jit|ooo] [--run] [--max-insts=N]\n"
+    "       [--quiet] [--stats=text|json] [--trace=FILE [--trace-ring=N]]\n"
+    "       [--l1i=SPEC] [--l1d=SPEC] [--l2=SPEC] [--mem-latency=N]\n"
+    "       [--bpred=none|nt|btfn|bimodal|gshare[:ENTRIES[:HISTORY]]]\n"
+    "       [--issue=N [--alus=N] [--mem-ports=N]] [--rob=N] [--rs=N] [--lsq=N]\n"
+    "       [--timing=none|fixed|inorder[:PENALTY][/l1i|l1d|l2=SPEC][/bpred=SPEC][,...]]\n"
+    "       [--batch[=LIST] [--jobs=N]] [--checkpoint=N:FILE] [--reverse] [--profile=FILE]\n"
+    "       [--stage-log=FILE [--window=START:[END]]]\n"
+    "       [--stats-dump=FILE [--stats-format=json|csv] [--stats-interval=N]]\n"
+    "       [--sample=periodic:PERIOD:WINDOW[:WARMUP]|bbv:INTERVAL:CLUSTERS[:WARMUP]]\n"
+    "       file.asm|image|snapshot|- (any number of them with --batch)\n"
+    "cache SPEC is SIZE:ASSOC:LINE[:lru|plru|random[:wb|wt[:LATENCY]]], e.g. 32k:4:64:plru\n"
+    "(LATENCY, the cost of an L1 miss that hits, only for --l2)\n",
+    prog);
+}
+
+/**
+ * Parse command line flags into config, return index of the source file
+ * argument or -1 on a bad command line
+ */
+int parseOptions(int argc, char **argv) {
+   static struct option longOptions[] = {
+      {"engine", required_argument, NULL, 'e'},
+      {"run", no_argument, NULL, 'r'},
+      {"max-insts", required_argument, NULL, 'm'},
+      {"quiet", no_argument, NULL, 'q'},
+      {"stats", required_argument, NULL, 'S'},
+      {"trace", required_argument, NULL, 't'},
+      {"trace-ring", required_argument, NULL, 'R'},
+      {"l1i", required_argument, NULL, 'I'},
+      {"l1d", required_argument, NULL, 'D'},
+      {"l2", required_argument, NULL, 'L'},
+      {"mem-latency", required_argument, NULL, 'M'},
+      {"bpred", required_argument, NULL, 'B'},
+      {"issue", required_argument, NULL, 'W'},
+      {"alus", required_argument, NULL, 'A'},
+      {"mem-ports", required_argument, NULL, 'P'},
+      {"rob", required_argument, NULL, 'O'},
+      {"rs", required_argument, NULL, 'T'},
+      {"lsq", required_argument, NULL, 'Q'},
+      {"timing", required_argument, NULL, 'C'},
+      {"batch", optional_argument, NULL, 'b'},
+      {"jobs", required_argument, NULL, 'j'},
+      {"checkpoint", required_argument, NULL, 'K'},
+      {"reverse", no_argument, NULL, 'V'},
+      {"profile", required_argument, NULL, 'F'},
+      {"stage-log", required_argument, NULL, 'G'},
+      {"window", required_argument, NULL, 'w'},
+      {"stats-dump", required_argument, NULL, 'X'},
+      {"stats-format", required_argument, NULL, 'Y'},
+      {"stats-interval", required_argument, NULL, 'Z'},
+      {"sample", required_argument, NULL, 'U'},
+      {NULL, 0, NULL, 0}
+   };
+   char *end;
+   int opt;
+
+   while ((opt = getopt_long(argc, argv, "", longOptions, NULL)) != -1) {
+      if (opt == 'e') {
+         if (!strcmp(optarg, "func"))
+            config.engine = 's';
+         else if (!strcmp(optarg, "pipe"))
+            config.engine = 'p';
+         else if (!strcmp(optarg, "threaded"))
+            config.engine = 't';
+         else if (!strcmp(optarg, "jit"))
+            config.engine = 'j';
+         else if (!strcmp(optarg, "ooo"))
+            config.engine = 'o';
+         else
+            return -1;
+      } else if (opt == 'r') {
+         config.run = 1;
+      } else if (opt == 'm') {
+         config.maxInsts = strtol(optarg, NULL, 10);
+      } else if (opt == 'q') {
+         config.quiet = 1;
+      } else if (opt == 'S') {
+         if (!strcmp(optarg, "json"))
+            config.statsJson = 1;
+         else if (strcmp(optarg, "text"))
+            return -1;
+      } else if (opt == 't') {
+         config.traceFile = optarg;
+      } else if (opt == 'R') {
+         config.traceRing = strtol(optarg, NULL, 10);
+      } else if (opt == 'I') {
+         config.l1i = optarg;
+      } else if (opt == 'D') {
+         config.l1d = optarg;
+      } else if (opt == 'L') {
+         config.l2 = optarg;
+      } else if (opt == 'M') {
+         config.memLatency = strtol(optarg, NULL, 10);
+      } else if (opt == 'B') {
+         config.bpred = optarg;
+      } else if (opt == 'W') {
+         config.issueWidth = strtol(optarg, NULL, 10);
+         if (config.issueWidth < 1 || config.issueWidth > PIPE_MAX_WIDTH)
+            return -1;
+      } else if (opt == 'A') {
+         config.alus = strtol(optarg, NULL, 10);
+         if (config.alus < 1)
+            return -1;
+      } else if (opt == 'P') {
+         config.memPorts = strtol(optarg, NULL, 10);
+         if (config.memPorts < 1)
+            return -1;
+      } else if (opt == 'O') {
+         config.robSize = strtol(optarg, NULL, 10);
+         if (config.robSize < 1 || config.robSize > OOO_MAX_ROB)
+            return -1;
+      } else if (opt == 'T') {
+         config.rsSize = strtol(optarg, NULL, 10);
+         if (config.rsSize < 1)
+            return -1;
+      } else if (opt == 'Q') {
+         config.lsqSize = strtol(optarg, NULL, 10);
+         if (config.lsqSize < 1)
+            return -1;
+      } else if (opt == 'C') {
+         config.timing = optarg;
+      } else if (opt == 'b') {
+         config.batch = 1;
+         config.batchList = optarg;
+      } else if (opt == 'K') {
+         config.checkpointAt = strtol(optarg, &end, 10);
+         if (config.checkpointAt < 0 || *end != ':' || end[1] == '\0')
+            return -1;
+         config.checkpointFile = end + 1;
+      } else if (opt == 'V') {
+         config.reverse = 1;
+      } else if (opt == 'F') {
+         config.profile = optarg;
+      } else if (opt == 'X') {
+         config.statsDump = optarg;
+      } else if (opt == 'Y') {
+         if (!strcmp(optarg, "csv"))
+            config.statsCsv = 1;
+         else if (strcmp(optarg, "json"))
+            return -1;
+      } else if (opt == 'Z') {
+         config.statsInterval = strtol(optarg, NULL, 10);
+         if (config.statsInterval < 1)
+            return -1;
+      } else if (opt == 'U') {
+         config.sample = optarg;
+         if (sampleParse(optarg, &sampling) != 0)
+            return -1;
+      } else if (opt == 'G') {
+         config.stageLog = optarg;
+      } else if (opt == 'w') {
+         config.windowStart = strtol(optarg, &end, 10);
+         if (config.windowStart < 0 || *end != ':')
+            return -1;
+         config.windowEnd = -1;
+         if (end[1] != '\0') {
+            config.windowEnd = strtol(end + 1, &end, 10);
+            if (*end != '\0' || config.windowEnd <= config.windowStart)
+               return -1;
+         }
+      } else if (opt == 'j') {
+         config.jobs = strtol(optarg, NULL, 10);
+         if (config.jobs < 1)
+            return -1;
+      } else {
+         return -1;
+      }
+   }
+
+   //Batch runs never prompt, so pick the default engine up front
+   if (config.run && !config.engine)
+      config.engine = 's';
+
+   //A batch list can stand in for the program arguments
+   if (config.batch && config.batchList)
+      return optind;
+   return optind < argc ? optind : -1;
+}
+
+/**
+ * --batch: only the functional core runs, so the options for the other
+ * engines and the shared trace, predictor and timing models are refused
+ */
+int runBatch(char **programs, int numPrograms) {
+   batchConfig cfg = {config.jobs, config.maxInsts, config.statsJson, config.quiet,
+    config.l1i, config.l1d, config.l2, config.memLatency};
+
+   if ((config.engine && config.engine != 's') || config.traceFile || config.bpred
+    || config.timing || config.checkpointFile || config.profile || config.stageLog
+    || config.statsDump || config.sample)
+      return -1;
+
+   return batchRun(config.batchList, programs, numPrograms, &cfg);
+}
+
 int main(int argc, char **argv) {
-   FILE *code;
-   int numLines = 0, i;
+   int numLines = 0, fileArg, status;
    char cmd;
 
-   code = fopen(argv[1], "r");
-   
-   numLines = constructSymbolTable(code);
-   
+   if ((fileArg = parseOptions(argc, argv)) < 0) {
+      usage(argv[0]);
+      return 1;
+   }
+
+   if (config.batch) {
+      if ((status = runBatch(argv + fileArg, argc - fileArg)) < 0)
+         usage(argv[0]);
+      return status != 0;
+   }
 
-   fclose(code);
-   code = fopen(argv[1], "r");
-   assemble(code);
-   for (i = 0; i < numLines; i++) {
-   //   printf("%08x: %08x\n", i * 4 + PROG_START, assembledLines[i]);
+   if ((numLines = machineLoad(&sim, argv[fileArg])) == MACHINE_ERR_OPEN) {
+      perror(argv[fileArg]);
+      return 1;
+   }
+   if (numLines == MACHINE_ERR_SIZE) {
+      fprintf(stderr, "%s: no memory for the program\n", argv[fileArg]);
+      return 1;
+   }
+
+   if (config.traceFile && traceOpen(config.traceFile, config.traceRing) != 0) {
+      perror(config.traceFile);
+      return 1;
+   }
+   if (cacheInit(config.l1i, config.l1d, config.l2, config.memLatency) != 0) {
+      fprintf(stderr, "bad cache configuration\n");
+      usage(argv[0]);
+      return 1;
+   }
+   if (bpredInit(config.bpred) != 0) {
+      fprintf(stderr, "bad branch predictor\n");
+      usage(argv[0]);
+      return 1;
+   }
+   if (timingInit(config.timing, config.memLatency) != 0) {
+      fprintf(stderr, "bad timing model\n");
+      usage(argv[0]);
+      return 1;
+   }
+
+   cmd = config.engine;
+   if (!cmd) {
+      printf("Enter command (P for pipeline, s for single, t for threaded, j for jit, "
+       "o for out-of-order): ");
+      if (scanf(" %c", &cmd) != 1)
+         cmd = 'q';
+   }
+   config.engine = cmd;
+   if (config.profile && cmd != 's' && cmd != 'p') {
+      fprintf(stderr, "--profile needs the func or pipe engine\n");
+      return 1;
+   }
+   if (config.stageLog && cmd != 'p') {
+      fprintf(stderr, "--stage-log needs the pipe engine\n");
+      return 1;
+   }
+   if (config.reverse && cmd != 's') {
+      fprintf(stderr, "--reverse needs the func engine\n");
+      return 1;
+   }
+   if (config.sample && (cmd != 'p' || config.traceFile || config.timing || config.profile
+    || config.checkpointFile)) {
+      fprintf(stderr, "--sample needs the pipe engine, without --trace, --timing, --profile "
+       "or --checkpoint\n");
+      return 1;
+   }
+   if (config.profile && profileInit(numLines) != 0) {
+      perror("profile");
+      return 1;
+   }
+   if (config.statsDump) {
+      if (statsOpen(config.statsDump, config.statsCsv) != 0) {
+         perror(config.statsDump);
+         return 1;
+      }
+      statsSetup();
+   }
+   if (config.stageLog && stageLogOpen(config.stageLog, config.windowStart,
+    config.windowEnd) != 0) {
+      perror(config.stageLog);
+      return 1;
    }
-   printf("Enter command (P for pipeline, s for single): ");
-   scanf(" %c", &cmd);
-   if (cmd == 'p')
+   if (cmd == 'p' && config.sample)
+      runProgramSampled(numLines);
+   else if (cmd == 'p')
       runProgramPipeline(numLines);
    else if (cmd == 's')
       runProgram(numLines);
+   else if (cmd == 't')
+      runProgramEngine(numLines, runThreaded, "threaded");
+   else if (cmd == 'j')
+      runProgramEngine(numLines, runJit, "jit");
+   else if (cmd == 'o')
+      runProgramOoo();
+
+   if (config.profile && profileWrite(config.profile, &sim, argv[fileArg]) != 0)
+      perror(config.profile);
+   statsClose();
+   stageLogClose();
+   traceClose();
+   timingFree();
+   cacheFree();
+   bpredFree();
+   machineFree(&sim);
 
    return 0;
 }
@@ -1,6 +1,10 @@
 #ifndef SIMULATOR_H
 #define SIMULATOR_H
 
+#define NUM_REGISTERS 32
+#define INITIAL_PC 0
+#define PROG_START 0x0400024
+
 #define AND_CODE 0x24
 #define OR_CODE 0x25
 #define ORI_CODE 0x0D << 26
@@ -26,4 +30,9 @@
 #define JAL_CODE 0x03 << 26
 #define SYSCALL_CODE 0x0c
 
+typedef struct {
+   int inst;
+   int type;
+} line;
+
 #endif
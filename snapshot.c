@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+
+/**
+ * Write m, resuming from at, to path. Returns 0, or -1 if a write failed
+ * or there was no memory for the page directory.
+ */
+int snapshotWrite(const char *path, machine *m, const machineResume *at) {
+   static const unsigned char zeros[MEM_PAGE_SIZE];
+   snapshotHeader hdr;
+   memTable *t;
+   unsigned int *dir = NULL, *grown, addr;
+   FILE *out;
+   long pos;
+   int i, j, count = 0, cap = 0, err;
+
+   for (i = 0; i < 1 << MEM_DIR_BITS; i++) {
+      if ((t = m->mainMemory.tables[i]) == NULL)
+         continue;
+      for (j = 0; j < 1 << MEM_TABLE_BITS; j++) {
+         if (t->pages[j] == NULL)
+            continue;
+         if (count == cap) {
+            cap = cap ? cap * 2 : 64;
+            if ((grown = realloc(dir, cap * sizeof(unsigned int))) == NULL) {
+               free(dir);
+               return -1;
+            }
+            dir = grown;
+         }
+         addr = ((unsigned int) i << (MEM_TABLE_BITS + MEM_PAGE_BITS)) | (j << MEM_PAGE_BITS);
+         dir[count++] = addr;
+      }
+   }
+
+   memset(&hdr, 0, sizeof(hdr));
+   hdr.magic = SNAPSHOT_MAGIC;
+   hdr.version = SNAPSHOT_VERSION;
+   hdr.pc = at->pc;
+   hdr.engine = at->engine;
+   hdr.instExec = at->instExec;
+   hdr.memRefs = at->memRefs;
+   hdr.cycles = at->cycles;
+   hdr.fetched = at->fetched;
+   memcpy(hdr.registers, m->registers, sizeof(hdr.registers));
+   hdr.textOffset = sizeof(hdr);
+   hdr.textCount = m->textLines;
+   hdr.engineOffset = hdr.textOffset + m->textLines * sizeof(line);
+   hdr.engineSize = at->engineSize;
+   hdr.dirOffset = hdr.engineOffset + at->engineSize;
+   hdr.pageCount = count;
+   pos = hdr.dirOffset + count * sizeof(unsigned int);
+   hdr.pageOffset = (pos + MEM_PAGE_SIZE - 1) & ~(long) (MEM_PAGE_SIZE - 1);
+
+   if ((out = fopen(path, "wb")) == NULL) {
+      free(dir);
+      return -1;
+   }
+   fwrite(&hdr, sizeof(hdr), 1, out);
+   fwrite(m->assembledLines, sizeof(line), m->textLines, out);
+   fwrite(at->engineState, 1, at->engineSize, out);
+   fwrite(dir, sizeof(unsigned int), count, out);
+   fwrite(zeros, 1, hdr.pageOffset - pos, out);
+   for (i = 0; i < count; i++)
+      fwrite(memPage(&m->mainMemory, dir[i]), 1, MEM_PAGE_SIZE, out);
+   free(dir);
+
+   err = ferror(out);
+   return fclose(out) != 0 || err ? -1 : 0;
+}
+
+static int sectionFits(size_t len, unsigned long long offset, unsigned int count,
+ size_t size) {
+   return offset <= len && count <= (len - offset) / size;
+}
+
+/**
+ * Return the header if buf holds a well formed snapshot, NULL otherwise
+ */
+const snapshotHeader *snapshotCheck(const void *buf, size_t len) {
+   const snapshotHeader *hdr = buf;
+
+   if (len < sizeof(*hdr) || hdr->magic != SNAPSHOT_MAGIC
+    || hdr->version != SNAPSHOT_VERSION)
+      return NULL;
+   if (!sectionFits(len, hdr->textOffset, hdr->textCount, sizeof(line))
+    || !sectionFits(len, hdr->engineOffset, hdr->engineSize, 1)
+    || !sectionFits(len, hdr->dirOffset, hdr->pageCount, sizeof(unsigned int))
+    || !sectionFits(len, hdr->pageOffset, hdr->pageCount, MEM_PAGE_SIZE)
+    || hdr->pageOffset % MEM_PAGE_SIZE != 0)
+      return NULL;
+
+   return hdr;
+}
+
+/**
+ * Restore the snapshot at path into a freshly reset m. The file is mapped
+ * copy-on-write and its pages become m's memory where they lie, so the
+ * cost is the page table setup, not the size of memory. Returns the
+ * number of text lines or a MACHINE_ERR code.
+ */
+int snapshotLoad(machine *m, const char *path) {
+   const snapshotHeader *hdr;
+   const unsigned int *dir;
+   unsigned char *base;
+   struct stat st;
+   memTable **table;
+   unsigned int i, addr;
+   int fd;
+
+   if ((fd = open(path, O_RDONLY)) < 0)
+      return MACHINE_ERR_OPEN;
+   if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      close(fd);
+      errno = EINVAL;
+      return MACHINE_ERR_OPEN;
+   }
+   base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (base == MAP_FAILED)
+      return MACHINE_ERR_OPEN;
+   m->mainMemory.backing = base;
+   m->mainMemory.backingLen = st.st_size;
+
+   if ((hdr = snapshotCheck(base, st.st_size)) == NULL) {
+      errno = EINVAL;
+      return MACHINE_ERR_OPEN;
+   }
+   if (machineText(m, hdr->textCount) != 0)
+      return MACHINE_ERR_SIZE;
+
+   memcpy(m->assembledLines, base + hdr->textOffset, hdr->textCount * sizeof(line));
+   m->mainMemory.textLines = hdr->textCount;
+   memcpy(m->registers, hdr->registers, sizeof(m->registers));
+
+   dir = (const unsigned int *) (base + hdr->dirOffset);
+   for (i = 0; i < hdr->pageCount; i++) {
+      addr = dir[i];
+      table = &m->mainMemory.tables[addr >> (MEM_TABLE_BITS + MEM_PAGE_BITS)];
+      if (*table == NULL && (*table = calloc(1, sizeof(memTable))) == NULL)
+         return MACHINE_ERR_OPEN;
+      (*table)->pages[(addr >> MEM_PAGE_BITS) & ((1 << MEM_TABLE_BITS) - 1)] =
+       base + hdr->pageOffset + (size_t) i * MEM_PAGE_SIZE;
+      m->mainMemory.pagesAllocated++;
+   }
+
+   m->resume.pc = hdr->pc;
+   m->resume.instExec = hdr->instExec;
+   m->resume.memRefs = hdr->memRefs;
+   m->resume.cycles = hdr->cycles;
+   m->resume.fetched = hdr->fetched;
+   m->resume.engine = hdr->engine;
+   m->resume.engineState = base + hdr->engineOffset;
+   m->resume.engineSize = hdr->engineSize;
+
+   return hdr->textCount;
+}
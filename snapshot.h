@@ -0,0 +1,45 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "simulator.h"
+#include "machine.h"
+
+#define SNAPSHOT_MAGIC 0x50414E53  // "SNAP" read as little endian
+#define SNAPSHOT_VERSION 1
+
+#define SNAPSHOT_ENGINE_NONE 0   // between instructions, any engine can resume
+#define SNAPSHOT_ENGINE_PIPE 1   // mid-pipeline, the latches are in the engine section
+
+/**
+ * Snapshot layout, all native endian: a snapshotHeader, the text lines
+ * (stores may have patched them), the engine section, the address of
+ * each data page and then the pages themselves, page aligned from
+ * pageOffset. Restoring maps the file privately and points memory at the
+ * pages in place, so they are only copied when the program writes them.
+ */
+typedef struct {
+   unsigned int magic;
+   unsigned int version;
+   int pc;
+   int engine;
+   long long instExec;
+   long long memRefs;
+   long long cycles;
+   long long fetched;
+   int registers[NUM_REGISTERS];
+   unsigned int textOffset;
+   unsigned int textCount;     // line records
+   unsigned int engineOffset;
+   unsigned int engineSize;    // bytes, checked against the engine's own state
+   unsigned int dirOffset;
+   unsigned int pageCount;     // page addresses in the directory
+   unsigned long long pageOffset;
+} snapshotHeader;
+
+int snapshotWrite(const char *path, machine *m, const machineResume *at);
+
+const snapshotHeader *snapshotCheck(const void *buf, size_t len);
+
+int snapshotLoad(machine *m, const char *path);
+
+#endif
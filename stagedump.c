@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <string.h>
+#include "stagelog.h"
+
+#define DUMP_CHUNK 4096
+#define DUMP_LIVE 64   // more than every latch slot of the widest pipeline
+
+static const char *stageNames[STAGE_COUNT] = {"IF", "ID", "EX", "MEM", "WB"};
+static const char *emptyNames[] = {"", "", "", "flush", "stall", "idle"};
+
+/**
+ * An instruction the Kanata writer has started and not yet retired
+ */
+typedef struct {
+   unsigned int seq;
+   int stage;
+   int seen;   // logged in the current cycle
+} liveInst;
+
+static liveInst live[DUMP_LIVE];
+static int numLive;
+static unsigned long retired;
+
+/**
+ * Text dump: one line per cycle, each stage listing the pcs in it. A *
+ * marks an instruction held by a stall; an empty stage names its bubble.
+ */
+static void textRecord(const stageRecord *r, unsigned int *cycle, int *first, int *stage) {
+   if (*first || r->cycle != *cycle) {
+      printf("%s%10u:", *first ? "" : "\n", r->cycle);
+      *cycle = r->cycle;
+      *stage = -1;
+      *first = 0;
+   }
+   if (r->stage != *stage) {
+      printf("%s %s", *stage >= 0 ? " |" : "", stageNames[r->stage]);
+      *stage = r->stage;
+   }
+   if (r->seq == 0)
+      printf(" <%s>", emptyNames[r->state]);
+   else if (r->state == STAGE_NOP)
+      printf(" nop");
+   else
+      printf(" %08X%s", r->pc, r->state == STAGE_STALL ? "*" : "");
+}
+
+/**
+ * Retire (from WB) or flush (from anywhere else) every instruction the
+ * cycle just logged left out, at that cycle
+ */
+static void kanataEndCycle(void) {
+   int i, kept = 0;
+
+   for (i = 0; i < numLive; i++) {
+      if (live[i].seen) {
+         live[i].seen = 0;
+         live[kept++] = live[i];
+      } else if (live[i].stage == STAGE_WB) {
+         printf("R\t%u\t%lu\t0\n", live[i].seq, retired++);
+      } else {
+         printf("R\t%u\t%u\t1\n", live[i].seq, live[i].seq);
+      }
+   }
+   numLive = kept;
+}
+
+/**
+ * At the end of the log, retire what the last cycle wrote back. Anything
+ * still further up was cut off by the window and is left running.
+ */
+static void kanataFinish(void) {
+   int i;
+
+   printf("C\t1\n");
+   for (i = 0; i < numLive; i++) {
+      if (live[i].stage == STAGE_WB)
+         printf("R\t%u\t%lu\t0\n", live[i].seq, retired++);
+   }
+}
+
+/**
+ * Kanata (Konata pipeline viewer) log: instructions are started the first
+ * cycle they appear, move stage as the log moves them and end when they
+ * stop appearing. Bubbles have no Kanata form and are left out.
+ */
+static void kanataRecord(const stageRecord *r, unsigned int *cycle, int *first) {
+   liveInst *l = NULL;
+   int i;
+
+   if (*first) {
+      printf("Kanata\t0004\nC=\t%u\n", r->cycle);
+      *cycle = r->cycle;
+      *first = 0;
+   } else if (r->cycle != *cycle) {
+      kanataEndCycle();
+      printf("C\t%u\n", r->cycle - *cycle);
+      *cycle = r->cycle;
+   }
+   if (r->seq == 0)
+      return;
+
+   for (i = 0; i < numLive && l == NULL; i++) {
+      if (live[i].seq == r->seq)
+         l = &live[i];
+   }
+   if (l == NULL) {
+      if (numLive == DUMP_LIVE)
+         return;
+      l = &live[numLive++];
+      l->seq = r->seq;
+      l->stage = -1;
+      printf("I\t%u\t%u\t0\n", r->seq, r->seq);
+      printf("L\t%u\t0\t%08X: %08X\n", r->seq, r->pc, r->inst);
+   }
+   l->seen = 1;
+   if (l->stage != r->stage) {
+      if (l->stage >= 0)
+         printf("E\t%u\t0\t%s\n", r->seq, stageNames[l->stage]);
+      printf("S\t%u\t0\t%s\n", r->seq, stageNames[r->stage]);
+      l->stage = r->stage;
+   }
+}
+
+/**
+ * Offline reader for pipeline stage logs written with --stage-log. Prints
+ * a per-cycle stage table, or with -k a Kanata log for the Konata viewer.
+ */
+int main(int argc, char **argv) {
+   FILE *in;
+   stageLogHeader hdr;
+   stageRecord recs[DUMP_CHUNK];
+   size_t got, i;
+   unsigned long total = 0;
+   unsigned int cycle = 0;
+   int kanata = 0, arg = 1, first = 1, stage = -1;
+
+   if (argc > 1 && !strcmp(argv[1], "-k")) {
+      kanata = 1;
+      arg++;
+   }
+   if (arg >= argc) {
+      fprintf(stderr, "usage: %s [-k] stages.bin\n", argv[0]);
+      return 1;
+   }
+
+   in = fopen(argv[arg], "rb");
+   if (in == NULL) {
+      perror(argv[arg]);
+      return 1;
+   }
+   if (stageLogReadHeader(in, &hdr) != 0) {
+      fprintf(stderr, "%s: not a pipeline stage log\n", argv[arg]);
+      fclose(in);
+      return 1;
+   }
+
+   while ((got = fread(recs, sizeof(stageRecord), DUMP_CHUNK, in)) > 0) {
+      for (i = 0; i < got; i++) {
+         if (recs[i].stage >= STAGE_COUNT || recs[i].state > STAGE_EMPTY_IDLE)
+            continue;
+         if (kanata)
+            kanataRecord(&recs[i], &cycle, &first);
+         else
+            textRecord(&recs[i], &cycle, &first, &stage);
+      }
+      total += got;
+   }
+   if (kanata && !first)
+      kanataFinish();
+   else if (!first)
+      printf("\n");
+
+   if (hdr.count != 0 && hdr.count != total)
+      fprintf(stderr, "warning: header says %u records, read %lu\n", hdr.count, total);
+
+   fclose(in);
+   return 0;
+}
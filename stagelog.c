@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include "stagelog.h"
+
+int stageLogEnabled = 0;
+stageLog stageOut;
+
+static void writeHeader(unsigned int count) {
+   stageLogHeader hdr;
+
+   hdr.magic = STAGELOG_MAGIC;
+   hdr.version = STAGELOG_VERSION;
+   hdr.recordSize = sizeof(stageRecord);
+   hdr.count = count;
+   fwrite(&hdr, sizeof(hdr), 1, stageOut.out);
+}
+
+/**
+ * Open a stage log that records the cycles in [windowStart, windowEnd)
+ * (windowEnd -1 for the rest of the run). The record buffer is allocated
+ * here once and written out each time it fills.
+ */
+int stageLogOpen(const char *path, long windowStart, long windowEnd) {
+   stageOut.out = fopen(path, "wb");
+   if (stageOut.out == NULL)
+      return -1;
+
+   stageOut.buf = malloc(STAGELOG_BUFFER_RECORDS * sizeof(stageRecord));
+   if (stageOut.buf == NULL) {
+      fclose(stageOut.out);
+      return -1;
+   }
+   stageOut.used = 0;
+   stageOut.written = 0;
+   stageOut.windowStart = windowStart;
+   stageOut.windowEnd = windowEnd;
+
+   writeHeader(0);
+   stageLogEnabled = 1;
+
+   return 0;
+}
+
+void stageLogFlush(void) {
+   fwrite(stageOut.buf, sizeof(stageRecord), stageOut.used, stageOut.out);
+   stageOut.written += stageOut.used;
+   stageOut.used = 0;
+}
+
+/**
+ * Write out what is buffered and patch the record count into the header
+ */
+void stageLogClose(void) {
+   if (!stageLogEnabled)
+      return;
+
+   stageLogFlush();
+   if (fseek(stageOut.out, 0, SEEK_SET) == 0)
+      writeHeader((unsigned int) stageOut.written);
+
+   fclose(stageOut.out);
+   free(stageOut.buf);
+   stageLogEnabled = 0;
+}
+
+/**
+ * Read and check a stage log header, returns 0 when it is a log we
+ * understand
+ */
+int stageLogReadHeader(FILE *in, stageLogHeader *hdr) {
+   if (fread(hdr, sizeof(*hdr), 1, in) != 1)
+      return -1;
+   if (hdr->magic != STAGELOG_MAGIC || hdr->version != STAGELOG_VERSION
+    || hdr->recordSize != sizeof(stageRecord))
+      return -1;
+
+   return 0;
+}
@@ -0,0 +1,94 @@
+#ifndef STAGELOG_H
+#define STAGELOG_H
+
+#include <stdio.h>
+
+#define STAGELOG_MAGIC 0x4754534D  // "MSTG" read as little endian
+#define STAGELOG_VERSION 1
+#define STAGELOG_BUFFER_RECORDS (1 << 16)
+
+enum { STAGE_IF, STAGE_ID, STAGE_EX, STAGE_MEM, STAGE_WB, STAGE_COUNT };
+
+/**
+ * What a stage was doing in a cycle. An instruction is busy, held in place
+ * by a stall, or a nop; an empty stage says what bubble it holds.
+ */
+enum {
+   STAGE_BUSY,
+   STAGE_STALL,
+   STAGE_NOP,
+   STAGE_EMPTY_FLUSH,   // squashed by a redirect
+   STAGE_EMPTY_STALL,   // a stall further up held its instruction back
+   STAGE_EMPTY_IDLE     // nothing left to fetch
+};
+
+/**
+ * Stage log layout: one stageLogHeader followed by stageRecords in cycle
+ * order, one per occupied slot and one per empty stage. count is filled
+ * in when the log is closed; 0 means read to end of file.
+ */
+typedef struct {
+   unsigned int magic;
+   unsigned int version;
+   unsigned int recordSize;
+   unsigned int count;
+} stageLogHeader;
+
+typedef struct {
+   unsigned int cycle;
+   unsigned int seq;     // fetch order of the instruction, 0 for an empty stage
+   unsigned int pc;
+   unsigned int inst;
+   unsigned char stage;
+   unsigned char state;
+   unsigned char slot;   // position in its group
+   unsigned char pad;
+} stageRecord;
+
+typedef struct {
+   FILE *out;
+   stageRecord *buf;   // allocated once, flushed to out whenever it fills
+   long used;
+   long written;
+   long windowStart;   // cycles outside [windowStart, windowEnd) are not logged
+   long windowEnd;     // -1 for no end
+} stageLog;
+
+extern int stageLogEnabled;
+extern stageLog stageOut;
+
+int stageLogOpen(const char *path, long windowStart, long windowEnd);
+
+void stageLogFlush(void);
+
+void stageLogClose(void);
+
+int stageLogReadHeader(FILE *in, stageLogHeader *hdr);
+
+/**
+ * Whether cycle falls in the logging window. Callers check stageLogEnabled
+ * first, so the pipeline pays one predictable branch when nothing is
+ * logged.
+ */
+static inline int stageLogWanted(long cycle) {
+   return cycle >= stageOut.windowStart && (stageOut.windowEnd < 0 || cycle < stageOut.windowEnd);
+}
+
+static inline void stageLogRecord(unsigned int cycle, unsigned int seq, unsigned int pc,
+ unsigned int inst, int stage, int state, int slot) {
+   stageRecord *r;
+
+   if (stageOut.used == STAGELOG_BUFFER_RECORDS)
+      stageLogFlush();
+   r = &stageOut.buf[stageOut.used++];
+   r->cycle = cycle;
+   r->seq = seq;
+   r->pc = pc;
+   r->inst = inst;
+   r->stage = stage;
+   r->state = state;
+   r->slot = slot;
+   r->pad = 0;
+}
+
+#endif
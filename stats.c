@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <string.h>
+#include "stats.h"
+
+int statsEnabled = 0;
+
+static statCounter counters[STATS_MAX_COUNTERS];
+static statHistogram histograms[STATS_MAX_HISTOGRAMS];
+static statMetric metrics[STATS_MAX_METRICS];
+static int numCounters, numHistograms, numMetrics;
+static statCounter spare;   // absorbs updates once the table is full
+static FILE *out;
+static int csvOut;
+
+/**
+ * The counter called name, added (at zero) the first time it is asked for
+ */
+statCounter *statsCounter(const char *name) {
+   int i;
+
+   for (i = 0; i < numCounters; i++) {
+      if (!strcmp(counters[i].name, name))
+         return &counters[i];
+   }
+   if (numCounters == STATS_MAX_COUNTERS)
+      return &spare;
+   snprintf(counters[numCounters].name, STATS_NAME_LEN, "%s", name);
+   counters[numCounters].value = 0;
+
+   return &counters[numCounters++];
+}
+
+/**
+ * Set a counter the engines keep themselves, when publishing them
+ */
+void statsSet(const char *name, unsigned long long value) {
+   statsCounter(name)->value = value;
+}
+
+/**
+ * Register a histogram of buckets buckets (at most STATS_MAX_BUCKETS).
+ * labels names the buckets of a histogram indexed by value, NULL makes it
+ * a power of two histogram. Returns NULL when the table is full.
+ */
+statHistogram *statsHistogram(const char *name, int buckets, const char *const *labels) {
+   statHistogram *h;
+
+   if (numHistograms == STATS_MAX_HISTOGRAMS || buckets < 1 || buckets > STATS_MAX_BUCKETS)
+      return NULL;
+   h = &histograms[numHistograms++];
+   memset(h, 0, sizeof(*h));
+   snprintf(h->name, STATS_NAME_LEN, "%s", name);
+   h->labels = labels;
+   h->buckets = buckets;
+
+   return h;
+}
+
+/**
+ * Register name as num / den * scale. Returns 0, or -1 when the table is
+ * full.
+ */
+int statsMetric(const char *name, const char *num, const char *den, double scale) {
+   statMetric *m;
+
+   if (numMetrics == STATS_MAX_METRICS)
+      return -1;
+   m = &metrics[numMetrics++];
+   snprintf(m->name, STATS_NAME_LEN, "%s", name);
+   m->num = statsCounter(num);
+   m->den = statsCounter(den);
+   m->scale = scale;
+
+   return 0;
+}
+
+static double metricValue(const statMetric *m) {
+   return m->den->value ? m->scale * m->num->value / m->den->value : 0.0;
+}
+
+/**
+ * Bucket k's name: its label, or the range of values it counts
+ */
+static void bucketName(const statHistogram *h, int k, char *buf, size_t len) {
+   if (h->labels != NULL)
+      snprintf(buf, len, "%s", h->labels[k]);
+   else if (k <= 1)
+      snprintf(buf, len, "%d", k);
+   else if (k == h->buckets - 1)
+      snprintf(buf, len, "%llu+", 1ULL << (k - 1));
+   else
+      snprintf(buf, len, "%llu-%llu", 1ULL << (k - 1), (1ULL << k) - 1);
+}
+
+/**
+ * Start the registry writing to path ("-" for stdout) as JSON, one object
+ * per dump, or with csv as rows of instructions,kind,name,bucket,value.
+ * Returns 0 or -1.
+ */
+int statsOpen(const char *path, int csv) {
+   out = strcmp(path, "-") ? fopen(path, "w") : stdout;
+   if (out == NULL)
+      return -1;
+   csvOut = csv;
+   if (csv)
+      fprintf(out, "instructions,kind,name,bucket,value\n");
+   statsEnabled = 1;
+
+   return 0;
+}
+
+/**
+ * Write every counter, the non-empty histogram buckets and the metrics as
+ * they stand. Dumps are cumulative; the instructions counter marks when
+ * each was taken.
+ */
+void statsDump(void) {
+   unsigned long long at = statsCounter("instructions")->value;
+   const statHistogram *h;
+   char bucket[48];
+   int i, k, first;
+
+   if (!statsEnabled)
+      return;
+
+   if (csvOut) {
+      for (i = 0; i < numCounters; i++)
+         fprintf(out, "%llu,counter,%s,,%llu\n", at, counters[i].name, counters[i].value);
+      for (i = 0; i < numHistograms; i++) {
+         h = &histograms[i];
+         for (k = 0; k < h->buckets; k++) {
+            bucketName(h, k, bucket, sizeof(bucket));
+            if (h->counts[k])
+               fprintf(out, "%llu,histogram,%s,%s,%llu\n", at, h->name, bucket, h->counts[k]);
+         }
+      }
+      for (i = 0; i < numMetrics; i++)
+         fprintf(out, "%llu,metric,%s,,%.6f\n", at, metrics[i].name, metricValue(&metrics[i]));
+      fflush(out);
+      return;
+   }
+
+   fprintf(out, "{\"instructions\": %llu, \"counters\": {", at);
+   for (i = 0; i < numCounters; i++)
+      fprintf(out, "%s\"%s\": %llu", i ? ", " : "", counters[i].name, counters[i].value);
+   fprintf(out, "}, \"histograms\": {");
+   for (i = 0; i < numHistograms; i++) {
+      h = &histograms[i];
+      fprintf(out, "%s\"%s\": {", i ? ", " : "", h->name);
+      for (k = 0, first = 1; k < h->buckets; k++) {
+         if (h->counts[k] == 0)
+            continue;
+         bucketName(h, k, bucket, sizeof(bucket));
+         fprintf(out, "%s\"%s\": %llu", first ? "" : ", ", bucket, h->counts[k]);
+         first = 0;
+      }
+      fprintf(out, "}");
+   }
+   fprintf(out, "}, \"metrics\": {");
+   for (i = 0; i < numMetrics; i++)
+      fprintf(out, "%s\"%s\": %.6f", i ? ", " : "", metrics[i].name, metricValue(&metrics[i]));
+   fprintf(out, "}}\n");
+   fflush(out);
+}
+
+/**
+ * Write the final dump and close the output
+ */
+void statsClose(void) {
+   if (!statsEnabled)
+      return;
+   statsDump();
+   if (out != stdout)
+      fclose(out);
+   out = NULL;
+   statsEnabled = 0;
+}
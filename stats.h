@@ -0,0 +1,77 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+#define STATS_MAX_COUNTERS 64
+#define STATS_MAX_HISTOGRAMS 8
+#define STATS_MAX_METRICS 16
+#define STATS_MAX_BUCKETS 40
+#define STATS_NAME_LEN 48
+
+/**
+ * A named 64-bit event count. Counters live in a fixed table, so the
+ * pointer statsCounter hands out stays valid for the whole run.
+ */
+typedef struct {
+   char name[STATS_NAME_LEN];
+   unsigned long long value;
+} statCounter;
+
+/**
+ * A distribution over buckets. With labels, bucket k counts the value k
+ * (an opcode mix). Without, bucket 0 counts zeros and bucket k values in
+ * [2^(k-1), 2^k), the last bucket taking everything larger.
+ */
+typedef struct {
+   char name[STATS_NAME_LEN];
+   const char *const *labels;
+   int buckets;
+   unsigned long long counts[STATS_MAX_BUCKETS];
+} statHistogram;
+
+/**
+ * A ratio of two counters times scale, worked out when it is dumped
+ */
+typedef struct {
+   char name[STATS_NAME_LEN];
+   statCounter *num;
+   statCounter *den;
+   double scale;
+} statMetric;
+
+extern int statsEnabled;
+
+statCounter *statsCounter(const char *name);
+
+void statsSet(const char *name, unsigned long long value);
+
+statHistogram *statsHistogram(const char *name, int buckets, const char *const *labels);
+
+int statsMetric(const char *name, const char *num, const char *den, double scale);
+
+int statsOpen(const char *path, int csv);
+
+void statsDump(void);
+
+void statsClose(void);
+
+/**
+ * The hot path increments. Callers check statsEnabled first, as with
+ * traceEnabled, so a run without a registry pays one predictable branch.
+ */
+static inline void statsAdd(statCounter *c, unsigned long long n) {
+   c->value += n;
+}
+
+static inline void statsSample(statHistogram *h, unsigned long long value) {
+   unsigned long long k = value;
+
+   if (h->labels == NULL) {
+      for (k = 0; value != 0; k++)
+         value >>= 1;
+   }
+   h->counts[k < (unsigned) h->buckets ? k : (unsigned) h->buckets - 1]++;
+}
+
+#endif
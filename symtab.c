@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <string.h>
+#include "symtab.h"
+
+static unsigned int hashName(const char *name, int len) {
+   unsigned int h = 2166136261u;
+   int i;
+
+   for (i = 0; i < len; i++) {
+      h ^= (unsigned char) name[i];
+      h *= 16777619u;
+   }
+
+   return h;
+}
+
+void symtabInit(symtab *t) {
+   t->entries = NULL;
+   t->count = 0;
+   t->entryCap = 0;
+   t->slots = NULL;
+   t->slotCap = 0;
+   t->arena = NULL;
+}
+
+/**
+ * Copy a name into the arena, NUL terminated so it can still be printed
+ */
+static const char *intern(symtab *t, const char *name, int len) {
+   symArena *a = t->arena;
+   int size;
+   char *s;
+
+   if (a == NULL || a->size - a->used < len + 1) {
+      size = len + 1 > SYMTAB_ARENA_SIZE ? len + 1 : SYMTAB_ARENA_SIZE;
+      a = malloc(sizeof(symArena) + size);
+      if (a == NULL)
+         return NULL;
+      a->next = t->arena;
+      a->used = 0;
+      a->size = size;
+      t->arena = a;
+   }
+
+   s = a->text + a->used;
+   memcpy(s, name, len);
+   s[len] = '\0';
+   a->used += len + 1;
+
+   return s;
+}
+
+static int findSlot(symtab *t, const char *name, int len, unsigned int hash) {
+   int mask = t->slotCap - 1;
+   int i = hash & mask;
+   symbolEntry *e;
+
+   while (t->slots[i] != -1) {
+      e = &t->entries[t->slots[i]];
+      if (e->hash == hash && e->len == len && !memcmp(e->symbol, name, len))
+         return i;
+      i = (i + 1) & mask;
+   }
+
+   return i;
+}
+
+/**
+ * Double the slot array and rehash, keeping the load factor under 1/2
+ */
+static int growSlots(symtab *t) {
+   int newCap = t->slotCap ? t->slotCap * 2 : SYMTAB_INITIAL_SLOTS;
+   int *slots = malloc(newCap * sizeof(int));
+   int i, j;
+
+   if (slots == NULL)
+      return -1;
+   for (i = 0; i < newCap; i++)
+      slots[i] = -1;
+
+   for (i = 0; i < t->count; i++) {
+      j = t->entries[i].hash & (newCap - 1);
+      while (slots[j] != -1)
+         j = (j + 1) & (newCap - 1);
+      slots[j] = i;
+   }
+
+   free(t->slots);
+   t->slots = slots;
+   t->slotCap = newCap;
+
+   return 0;
+}
+
+/**
+ * Find a label, creating an undefined entry for it if it is new. Returns
+ * NULL when out of memory.
+ */
+symbolEntry *symtabReference(symtab *t, const char *name, int len) {
+   unsigned int hash = hashName(name, len);
+   symbolEntry *e, *grown;
+   int slot;
+
+   if ((t->count + 1) * 2 > t->slotCap && growSlots(t) != 0)
+      return NULL;
+
+   slot = findSlot(t, name, len, hash);
+   if (t->slots[slot] != -1)
+      return &t->entries[t->slots[slot]];
+
+   if (t->count == t->entryCap) {
+      grown = realloc(t->entries, (t->entryCap ? t->entryCap * 2 : SYMTAB_INITIAL_SLOTS)
+       * sizeof(symbolEntry));
+      if (grown == NULL)
+         return NULL;
+      t->entries = grown;
+      t->entryCap = t->entryCap ? t->entryCap * 2 : SYMTAB_INITIAL_SLOTS;
+   }
+
+   e = &t->entries[t->count];
+   e->symbol = intern(t, name, len);
+   if (e->symbol == NULL)
+      return NULL;
+   e->len = len;
+   e->hash = hash;
+   e->loc = 0;
+   e->defined = 0;
+   t->slots[slot] = t->count++;
+
+   return e;
+}
+
+/**
+ * Define a label. Redefinitions keep the first location, like the old
+ * linear scans that stopped at the first match.
+ */
+symbolEntry *symtabAdd(symtab *t, const char *name, int len, int loc) {
+   symbolEntry *e = symtabReference(t, name, len);
+
+   if (e != NULL && !e->defined) {
+      e->loc = loc;
+      e->defined = 1;
+   }
+
+   return e;
+}
+
+symbolEntry *symtabLookup(symtab *t, const char *name, int len) {
+   int slot;
+
+   if (t->count == 0)
+      return NULL;
+
+   slot = findSlot(t, name, len, hashName(name, len));
+
+   return t->slots[slot] == -1 ? NULL : &t->entries[t->slots[slot]];
+}
+
+void symtabFree(symtab *t) {
+   symArena *a, *next;
+
+   for (a = t->arena; a != NULL; a = next) {
+      next = a->next;
+      free(a);
+   }
+   free(t->entries);
+   free(t->slots);
+   symtabInit(t);
+}
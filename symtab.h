@@ -0,0 +1,46 @@
+#ifndef SYMTAB_H
+#define SYMTAB_H
+
+#define SYMTAB_INITIAL_SLOTS 64
+#define SYMTAB_ARENA_SIZE 65536
+
+/**
+ * Label table: an open-addressing hash of indices into a dense array of
+ * entries (kept in definition order for printing). Names are interned in
+ * arena chunks, so lookups never copy and the table grows without limit.
+ */
+typedef struct {
+   const char *symbol;
+   int len;
+   unsigned int hash;
+   int loc;
+   int defined;     // 0 while the label has only been referenced
+} symbolEntry;
+
+typedef struct symArena {
+   struct symArena *next;
+   int used;
+   int size;
+   char text[];
+} symArena;
+
+typedef struct {
+   symbolEntry *entries;
+   int count;
+   int entryCap;
+   int *slots;      // index into entries, -1 when empty
+   int slotCap;     // always a power of two
+   symArena *arena;
+} symtab;
+
+void symtabInit(symtab *t);
+
+symbolEntry *symtabAdd(symtab *t, const char *name, int len, int loc);
+
+symbolEntry *symtabReference(symtab *t, const char *name, int len);
+
+symbolEntry *symtabLookup(symtab *t, const char *name, int len);
+
+void symtabFree(symtab *t);
+
+#endif
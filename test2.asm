@@ -0,0 +1,18 @@
+# This is test program 2. It calls a leaf function 2000 times, so sampled
+# runs (--sample) and snapshots hand over between the functional engine
+# and the pipeline with a return address live in $ra. Every engine, and
+# any sampling spec, should exit with the same registers.
+main:	addi $s0, $zero, 2000
+	addi $s1, $zero, 0
+loop:	jal add3
+	addi $s0, $s0, -1
+	bne $s0, $zero, loop
+	addi $v0, $zero, 10
+	syscall
+add3:	addi $s1, $s1, 3
+	addi $t0, $s1, 1
+	addi $t1, $t0, 1
+	sll $t2, $t1, 1
+	addi $t3, $t2, 1
+	add $t4, $t3, $t0
+	jr $ra
@@ -0,0 +1,16 @@
+# This is test program 3. It patches its own loop: the first pass adds 1
+# to $t1, after which the store turns that instruction into the one at
+# template and every later pass adds 3 ($t1 ends at 448). Every engine,
+# sampled runs included, has to see the store before running the line
+# again.
+main:	addi $t0, $zero, 150
+	addi $t1, $zero, 0
+loop:	addi $t1, $t1, 1
+	lw $t2, 32($zero)
+	sw $t2, 8($zero)
+	addi $t0, $t0, -1
+	bne $t0, $zero, loop
+	j done
+template:	addi $t1, $t1, 3
+done:	addi $v0, $zero, 10
+	syscall
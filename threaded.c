@@ -0,0 +1,198 @@
+#include <limits.h>
+#include "threaded.h"
+#include "trace.h"
+#include "cache.h"
+
+/**
+ * Direct-threaded execution engine. Every handler ends in its own dispatch
+ * so the host branch predictor sees one indirect jump per handler instead of
+ * one shared switch. Build with -DNO_COMPUTED_GOTO (or a non-GNU compiler)
+ * to get the portable switch loop instead.
+ */
+#if defined(__GNUC__) && !defined(NO_COMPUTED_GOTO)
+#define USE_COMPUTED_GOTO
+#endif
+
+#ifdef USE_COMPUTED_GOTO
+#define OP(name) L_##name:
+#define DISPATCH() do { \
+      if (i >= numLines || i < 0 || remaining-- == 0) \
+         goto done; \
+      op = &ops[i]; \
+      cycles += op->cycles; \
+      if (traceEnabled) \
+         traceInst(i * 4 + INITIAL_PC, prog[i].inst); \
+      if (cacheEnabled) \
+         cycles += cacheFetch(i * 4 + INITIAL_PC); \
+      goto *handlers[op->handler]; \
+   } while (0)
+#define REDISPATCH() goto *handlers[op->handler]
+#else
+#define OP(name) case name:
+#define DISPATCH() goto dispatch
+#define REDISPATCH() goto redispatch
+#endif
+
+#define NEXT(n) do { \
+      i = (n); \
+      if (i > 0) \
+         exec++; \
+      DISPATCH(); \
+   } while (0)
+
+/**
+ * Run from line i until the program exits, leaves the text segment or
+ * maxSteps instructions have run (maxSteps < 0 means no limit). Counters
+ * are accumulated exactly as runCommand does. Returns the next line index.
+ */
+int runThreaded(uop *ops, memory *mem, int *regs, int numLines, int i,
+ long maxSteps, long *memRefs, long *clockCycles, long *instExec) {
+   unsigned long remaining = maxSteps < 0 ? ULONG_MAX : (unsigned long) maxSteps;
+   long cycles = *clockCycles, refs = *memRefs, exec = *instExec;
+   line *prog = mem->text;
+   int address;
+   uop *op;
+
+#ifdef USE_COMPUTED_GOTO
+   static void *handlers[NUM_UOPS] = {
+      [UOP_UNDECODED] = &&L_UOP_UNDECODED,
+      [UOP_AND] = &&L_UOP_AND,
+      [UOP_OR] = &&L_UOP_OR,
+      [UOP_ORI] = &&L_UOP_ORI,
+      [UOP_ADD] = &&L_UOP_ADD,
+      [UOP_ADDU] = &&L_UOP_ADDU,
+      [UOP_ADDI] = &&L_UOP_ADDI,
+      [UOP_ADDIU] = &&L_UOP_ADDIU,
+      [UOP_SLL] = &&L_UOP_SLL,
+      [UOP_SRL] = &&L_UOP_SRL,
+      [UOP_SRA] = &&L_UOP_SRA,
+      [UOP_SUB] = &&L_UOP_SUB,
+      [UOP_SLT] = &&L_UOP_SLT,
+      [UOP_SLTI] = &&L_UOP_SLTI,
+      [UOP_SLTU] = &&L_UOP_SLTU,
+      [UOP_SLTIU] = &&L_UOP_SLTIU,
+      [UOP_BEQ] = &&L_UOP_BEQ,
+      [UOP_BNE] = &&L_UOP_BNE,
+      [UOP_LUI] = &&L_UOP_LUI,
+      [UOP_LW] = &&L_UOP_LW,
+      [UOP_SW] = &&L_UOP_SW,
+      [UOP_J] = &&L_UOP_J,
+      [UOP_JR] = &&L_UOP_JR,
+      [UOP_JAL] = &&L_UOP_JAL,
+      [UOP_SYSCALL] = &&L_UOP_SYSCALL,
+      [UOP_NOP] = &&L_UOP_NOP
+   };
+
+   DISPATCH();
+#else
+dispatch:
+   if (i >= numLines || i < 0 || remaining-- == 0)
+      goto done;
+   op = &ops[i];
+   cycles += op->cycles;
+   if (traceEnabled)
+      traceInst(i * 4 + INITIAL_PC, prog[i].inst);
+   if (cacheEnabled)
+      cycles += cacheFetch(i * 4 + INITIAL_PC);
+redispatch:
+   switch (op->handler) {
+#endif
+
+   OP(UOP_UNDECODED)
+      cycles -= op->cycles;
+      predecodeLine(&prog[i], i, op);
+      cycles += op->cycles;
+      REDISPATCH();
+   OP(UOP_AND)
+      regs[op->rd] = regs[op->rs] & regs[op->rt];
+      NEXT(i + 1);
+   OP(UOP_OR)
+      regs[op->rd] = regs[op->rs] | regs[op->rt];
+      NEXT(i + 1);
+   OP(UOP_ORI)
+      regs[op->rt] = regs[op->rs] | op->imm;
+      NEXT(i + 1);
+   OP(UOP_ADD)
+      regs[op->rd] = regs[op->rs] + regs[op->rt];
+      NEXT(i + 1);
+   OP(UOP_ADDU)
+      regs[op->rd] = (unsigned) regs[op->rs] + (unsigned) regs[op->rt];
+      NEXT(i + 1);
+   OP(UOP_ADDI)
+      regs[op->rt] = regs[op->rs] + op->imm;
+      NEXT(i + 1);
+   OP(UOP_ADDIU)
+      regs[op->rt] = (unsigned) regs[op->rs] & (unsigned) op->imm;
+      NEXT(i + 1);
+   OP(UOP_SLL)
+      regs[op->rd] = regs[op->rt] << op->shamt;
+      NEXT(i + 1);
+   OP(UOP_SRL)
+      regs[op->rd] = regs[op->rt] >> op->shamt;
+      NEXT(i + 1);
+   OP(UOP_SRA)
+      regs[op->rd] = (unsigned) regs[op->rt] >> op->shamt;
+      NEXT(i + 1);
+   OP(UOP_SUB)
+      regs[op->rd] = regs[op->rs] - regs[op->rt];
+      NEXT(i + 1);
+   OP(UOP_SLT)
+      regs[op->rd] = regs[op->rs] < regs[op->rt] ? 1 : 0;
+      NEXT(i + 1);
+   OP(UOP_SLTI)
+      regs[op->rt] = regs[op->rs] < op->imm ? 1 : 0;
+      NEXT(i + 1);
+   OP(UOP_SLTU)
+      regs[op->rd] = (unsigned) regs[op->rs] < (unsigned) regs[op->rt] ? 1 : 0;
+      NEXT(i + 1);
+   OP(UOP_SLTIU)
+      regs[op->rt] = (unsigned) regs[op->rs] < (unsigned) op->imm ? 1 : 0;
+      NEXT(i + 1);
+   OP(UOP_BEQ)
+      NEXT(regs[op->rs] == regs[op->rt] ? op->target : i + 1);
+   OP(UOP_BNE)
+      NEXT(regs[op->rs] != regs[op->rt] ? op->target : i + 1);
+   OP(UOP_LUI)
+      regs[op->rt] = op->imm;
+      NEXT(i + 1);
+   OP(UOP_LW)
+      if (cacheEnabled)
+         cycles += cacheRead(regs[op->rs] + op->imm);
+      regs[op->rt] = memLoadWord(mem, regs[op->rs] + op->imm);
+      refs += 1;
+      NEXT(i + 1);
+   OP(UOP_SW)
+      if (cacheEnabled)
+         cycles += cacheWrite(regs[op->rs] + op->imm);
+      address = memStoreWord(mem, regs[op->rs] + op->imm, regs[op->rt]);
+      if (address >= 0)
+         ops[address].handler = UOP_UNDECODED;
+      refs += 1;
+      NEXT(i + 1);
+   OP(UOP_J)
+      NEXT(op->target);
+   OP(UOP_JR)
+      address = regs[op->rs] - 4;
+      regs[31] = i * 4 + INITIAL_PC - 4;
+      NEXT((address - INITIAL_PC) / 4);
+   OP(UOP_JAL)
+      regs[31] = i * 4 + INITIAL_PC + 8;
+      NEXT(op->target);
+   OP(UOP_SYSCALL)
+      if (regs[2] == 10)
+         NEXT(-1);
+      NEXT(i);
+   OP(UOP_NOP)
+      NEXT(i + 1);
+
+#ifndef USE_COMPUTED_GOTO
+   }
+#endif
+
+done:
+   *clockCycles = cycles;
+   *memRefs = refs;
+   *instExec = exec;
+
+   return i;
+}
@@ -0,0 +1,11 @@
+#ifndef THREADED_H
+#define THREADED_H
+
+#include "simulator.h"
+#include "predecode.h"
+#include "memory.h"
+
+int runThreaded(uop *ops, memory *mem, int *regs, int numLines, int i,
+ long maxSteps, long *memRefs, long *clockCycles, long *instExec);
+
+#endif
@@ -0,0 +1,455 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "timing.h"
+
+int timingEnabled = 0;
+
+static timingModel models[TIMING_MAX_MODELS];
+static int numModels;
+static const char *kindNames[TIMING_KINDS] = {"fixed", "inorder"};
+
+/**
+ * Models after the first run on their own threads. The functional core
+ * is the single producer of ring; each worker consumes every record at
+ * its own tail, and the core only waits when the slowest worker is a
+ * whole ring behind. Tails sit on their own cache lines.
+ */
+typedef struct {
+   pthread_t thread;
+   timingModel *model;
+   _Alignas(64) atomic_long tail;
+} timingWorker;
+
+static streamRecord *ring;
+static _Alignas(64) atomic_long head;
+static atomic_int done;
+static long minTail;        // the core's cached view of the slowest tail
+static timingWorker workers[TIMING_MAX_MODELS];
+static int numWorkers;
+
+/**
+ * Parse one model, KIND[:PENALTY] followed by any of /l1i=SPEC,
+ * /l1d=SPEC, /l2=SPEC and /bpred=SPEC giving it private caches or a
+ * private predictor. Returns 0 or -1.
+ */
+static int parseModel(timingModel *m, const char *spec, int memLatency) {
+   const char *caches[3] = {NULL, NULL, NULL}, *bpred = NULL;
+   char *opt, *end;
+   int len, k;
+
+   for (k = 0; k < TIMING_KINDS; k++) {
+      len = strlen(kindNames[k]);
+      if (!strncmp(spec, kindNames[k], len) && strchr(":/", spec[len]) != NULL)
+         break;
+   }
+   if (k == TIMING_KINDS)
+      return -1;
+   m->kind = k;
+   m->penalty = TIMING_MISPREDICT_PENALTY;
+   m->loadDest = -1;
+   end = (char *) spec + len;
+   if (k == TIMING_INORDER && *end == ':')
+      m->penalty = strtol(end + 1, &end, 10);
+   if (m->penalty < 0 || (*end != '/' && *end != '\0'))
+      return -1;
+
+   while (*end == '/') {
+      opt = end + 1;
+      end = opt + strcspn(opt, "/");
+      if (!strncmp(opt, "l1i=", 4))
+         caches[0] = opt + 4;
+      else if (!strncmp(opt, "l1d=", 4))
+         caches[1] = opt + 4;
+      else if (!strncmp(opt, "l2=", 3))
+         caches[2] = opt + 3;
+      else if (!strncmp(opt, "bpred=", 6))
+         bpred = opt + 6;
+      else
+         return -1;
+   }
+
+   if (caches[0] != NULL || caches[1] != NULL || caches[2] != NULL) {
+      for (k = 0; k < 3; k++) {
+         if (caches[k] != NULL)
+            caches[k] = strndup(caches[k], strcspn(caches[k], "/"));
+      }
+      m->caches = malloc(sizeof(cacheHierarchy));
+      k = m->caches == NULL
+       || cacheHierarchyInit(m->caches, caches[0], caches[1], caches[2], memLatency) != 0;
+      for (len = 0; len < 3; len++)
+         free((char *) caches[len]);
+      if (k)
+         return -1;
+   }
+   if (bpred != NULL) {
+      bpred = strndup(bpred, strcspn(bpred, "/"));
+      m->bpred = malloc(sizeof(bpredState));
+      k = m->bpred == NULL || bpredStateInit(m->bpred, bpred) != 0;
+      free((char *) bpred);
+      if (k)
+         return -1;
+   }
+
+   return 0;
+}
+
+static void *workerMain(void *arg);
+
+/**
+ * Parse a comma separated list of models, or none to run the functional
+ * core alone. NULL gives the fixed model, which charges exactly what the
+ * functional engine always has. The first model in the list supplies the
+ * clock cycles an engine reports and runs on the core's thread; the rest
+ * get a thread each. Returns 0 or -1.
+ */
+int timingInit(const char *spec, int memLatency) {
+   timingModel *m;
+   const char *p;
+   int len;
+
+   timingFree();
+   if (spec == NULL)
+      spec = kindNames[TIMING_FIXED];
+   if (!strcmp(spec, "none"))
+      return 0;
+
+   for (p = spec; ; p += len + 1) {
+      if (numModels == TIMING_MAX_MODELS)
+         return -1;
+      m = &models[numModels++];
+      len = strcspn(p, ",");
+      if ((m->spec = strndup(p, len)) == NULL || parseModel(m, m->spec, memLatency) != 0)
+         return -1;
+      if (p[len] == '\0')
+         break;
+   }
+
+   if (numModels > 1) {
+      ring = malloc(TIMING_RING_RECORDS * sizeof(streamRecord));
+      if (ring == NULL)
+         return -1;
+      atomic_store(&head, 0);
+      atomic_store(&done, 0);
+      minTail = 0;
+      for (numWorkers = 0; numWorkers < numModels - 1; numWorkers++) {
+         workers[numWorkers].model = &models[numWorkers + 1];
+         atomic_store(&workers[numWorkers].tail, 0);
+         if (pthread_create(&workers[numWorkers].thread, NULL, workerMain,
+          &workers[numWorkers]) != 0)
+            return -1;
+      }
+   }
+   timingEnabled = 1;
+
+   return 0;
+}
+
+/**
+ * Stop the model threads and release what timingInit allocated
+ */
+void timingFree(void) {
+   int i;
+
+   atomic_store(&done, 1);
+   for (i = 0; i < numWorkers; i++)
+      pthread_join(workers[i].thread, NULL);
+   numWorkers = 0;
+   free(ring);
+   ring = NULL;
+
+   for (i = 0; i < numModels; i++) {
+      free(models[i].spec);
+      if (models[i].caches != NULL)
+         cacheHierarchyFree(models[i].caches);
+      free(models[i].caches);
+      if (models[i].bpred != NULL)
+         bpredStateFree(models[i].bpred);
+      free(models[i].bpred);
+   }
+   memset(models, 0, sizeof(models));
+   numModels = 0;
+   timingEnabled = 0;
+}
+
+/**
+ * Spin, then yield, then sleep: a worker waiting on an interactive run
+ * should not hold a core
+ */
+static void backoff(int *spins) {
+   struct timespec nap = {0, 50000};
+
+   if (++*spins < 64)
+      return;
+   if (*spins < 1024)
+      sched_yield();
+   else
+      nanosleep(&nap, NULL);
+}
+
+/**
+ * The registers an instruction reads, -1 when a slot is unused
+ */
+static void uopSources(const uop *op, int *src1, int *src2) {
+   *src1 = -1;
+   *src2 = -1;
+   switch (op->handler) {
+   case UOP_AND: case UOP_OR: case UOP_ADD: case UOP_ADDU: case UOP_SUB:
+   case UOP_SLT: case UOP_SLTU: case UOP_BEQ: case UOP_BNE: case UOP_SW:
+      *src1 = op->rs;
+      *src2 = op->rt;
+      break;
+   case UOP_SLL: case UOP_SRL: case UOP_SRA:
+      *src2 = op->rt;
+      break;
+   case UOP_ORI: case UOP_ADDI: case UOP_ADDIU: case UOP_SLTI: case UOP_SLTIU:
+   case UOP_LW: case UOP_JR:
+      *src1 = op->rs;
+      break;
+   case UOP_SYSCALL:
+      *src1 = 2;
+      break;
+   }
+}
+
+/**
+ * How the BTB files an instruction, -1 when it is not a control transfer
+ */
+static int uopBranchKind(const uop *op) {
+   switch (op->handler) {
+   case UOP_BEQ: case UOP_BNE:
+      return BRANCH_COND;
+   case UOP_J:
+      return BRANCH_JUMP;
+   case UOP_JAL:
+      return BRANCH_CALL;
+   case UOP_JR:
+      return op->rs == 31 ? BRANCH_RETURN : BRANCH_INDIRECT;
+   }
+   return -1;
+}
+
+/**
+ * Add the cache penalties in program order and what the branch predictor
+ * would have fetched after this line, from caches and bpred when given,
+ * otherwise from the hierarchy and predictor the engines share
+ */
+static void annotate(streamRecord *r, cacheHierarchy *caches, bpredState *bpred) {
+   int kind;
+
+   if (caches != NULL) {
+      r->fetchPenalty = cacheHierarchyFetch(caches, r->pc);
+      r->memPenalty = 0;
+      if (r->op.handler == UOP_LW)
+         r->memPenalty = cacheHierarchyRead(caches, r->addr);
+      else if (r->op.handler == UOP_SW)
+         r->memPenalty = cacheHierarchyWrite(caches, r->addr);
+   }
+   if (bpred != NULL) {
+      r->predicted = bpredStatePredict(bpred, r->line);
+      if ((kind = uopBranchKind(&r->op)) >= 0)
+         bpredStateResolve(bpred, r->line, kind, r->taken,
+          kind == BRANCH_COND ? r->op.target : r->next, r->predicted, TIMING_MISPREDICT_PENALTY);
+   }
+}
+
+/**
+ * The annotations every model without its own caches or predictor sees,
+ * so they are all charged for the same misses. Sampled runs (sample.c)
+ * call it on its own to keep the shared caches and predictor warm while
+ * they fast-forward.
+ */
+void timingAnnotate(streamRecord *r) {
+   int kind;
+
+   r->fetchPenalty = 0;
+   r->memPenalty = 0;
+   if (cacheEnabled) {
+      r->fetchPenalty = cacheFetch(r->pc);
+      if (r->op.handler == UOP_LW)
+         r->memPenalty = cacheRead(r->addr);
+      else if (r->op.handler == UOP_SW)
+         r->memPenalty = cacheWrite(r->addr);
+   }
+
+   r->predicted = r->line + 1;
+   if (bpredEnabled) {
+      r->predicted = bpredPredict(r->line);
+      if ((kind = uopBranchKind(&r->op)) >= 0)
+         bpredResolve(r->line, kind, r->taken, kind == BRANCH_COND ? r->op.target : r->next,
+          r->predicted, TIMING_MISPREDICT_PENALTY);
+   }
+}
+
+/**
+ * One instruction through a scalar pipeline that forwards every result:
+ * a cycle each, one more when it needs the word the LW just ahead of it
+ * loads, shamt more for a shift, penalty more when fetch went down the
+ * wrong path, plus the cache misses
+ */
+static void inorderConsume(timingModel *m, const streamRecord *r) {
+   int src1, src2;
+
+   if (m->instructions == 0)
+      m->cycles += TIMING_PIPE_FILL;
+   m->cycles++;
+
+   uopSources(&r->op, &src1, &src2);
+   if (m->loadDest > 0 && (src1 == m->loadDest || src2 == m->loadDest)) {
+      m->cycles++;
+      m->loadUse++;
+   }
+   m->loadDest = r->op.handler == UOP_LW ? r->op.rt : -1;
+
+   if (r->op.handler == UOP_SLL || r->op.handler == UOP_SRL || r->op.handler == UOP_SRA) {
+      m->cycles += r->op.shamt;
+      m->execute += r->op.shamt;
+   }
+   if (r->next >= 0 && r->next != r->predicted) {
+      m->cycles += m->penalty;
+      m->control += m->penalty;
+   }
+   m->cycles += r->fetchPenalty + r->memPenalty;
+   m->memory += r->fetchPenalty + r->memPenalty;
+}
+
+static void modelConsume(timingModel *m, const streamRecord *shared) {
+   streamRecord own;
+   const streamRecord *r = shared;
+
+   if (m->caches != NULL || m->bpred != NULL) {
+      own = *shared;
+      annotate(&own, m->caches, m->bpred);
+      r = &own;
+   }
+   if (m->kind == TIMING_FIXED) {
+      m->cycles += r->op.cycles + r->fetchPenalty + r->memPenalty;
+      m->memory += r->fetchPenalty + r->memPenalty;
+   } else {
+      inorderConsume(m, r);
+   }
+   m->instructions++;
+}
+
+static void *workerMain(void *arg) {
+   timingWorker *w = arg;
+   long tail = 0, avail;
+   int spins = 0;
+
+   for (;;) {
+      avail = atomic_load_explicit(&head, memory_order_acquire);
+      if (tail == avail) {
+         if (atomic_load_explicit(&done, memory_order_acquire)
+          && tail == atomic_load_explicit(&head, memory_order_acquire))
+            return NULL;
+         backoff(&spins);
+         continue;
+      }
+      spins = 0;
+      while (tail < avail)
+         modelConsume(w->model, &ring[tail++ & (TIMING_RING_RECORDS - 1)]);
+      atomic_store_explicit(&w->tail, tail, memory_order_release);
+   }
+}
+
+/**
+ * Refresh the core's view of the slowest worker
+ */
+static long slowestTail(void) {
+   long t, min = atomic_load_explicit(&head, memory_order_relaxed);
+   int i;
+
+   for (i = 0; i < numWorkers; i++) {
+      t = atomic_load_explicit(&workers[i].tail, memory_order_acquire);
+      if (t < min)
+         min = t;
+   }
+
+   return min;
+}
+
+/**
+ * Annotate r, run the first model on it and publish it to the rest.
+ * Returns the cycles the first model charged for it.
+ */
+long timingConsume(streamRecord *r) {
+   long before = models[0].cycles, h;
+   int spins = 0;
+
+   timingAnnotate(r);
+   modelConsume(&models[0], r);
+
+   if (numWorkers > 0) {
+      h = atomic_load_explicit(&head, memory_order_relaxed);
+      while (h - minTail == TIMING_RING_RECORDS) {
+         minTail = slowestTail();
+         if (h - minTail == TIMING_RING_RECORDS)
+            backoff(&spins);
+      }
+      ring[h & (TIMING_RING_RECORDS - 1)] = *r;
+      atomic_store_explicit(&head, h + 1, memory_order_release);
+   }
+
+   return models[0].cycles - before;
+}
+
+/**
+ * Wait for every worker to consume what has been published, so their
+ * counters can be read
+ */
+static void timingDrain(void) {
+   int spins = 0;
+
+   while (numWorkers > 0 && (minTail = slowestTail())
+    != atomic_load_explicit(&head, memory_order_relaxed))
+      backoff(&spins);
+}
+
+static double cpi(timingModel *m) {
+   return m->instructions ? (double) m->cycles / m->instructions : 0.0;
+}
+
+void timingPrintStats(FILE *out) {
+   timingModel *m;
+
+   timingDrain();
+   for (m = models; m < models + numModels; m++) {
+      if (m->kind == TIMING_FIXED)
+         fprintf(out, "timing %s: %ld cycles, CPI %.3f, memory %ld\n", m->spec, m->cycles,
+          cpi(m), m->memory);
+      else
+         fprintf(out, "timing %s: %ld cycles, CPI %.3f, stalls load-use %ld, "
+          "control %ld, memory %ld, execute %ld\n", m->spec, m->cycles, cpi(m),
+          m->loadUse, m->control, m->memory, m->execute);
+      if (m->caches != NULL)
+         cacheHierarchyPrintStats(m->caches, out);
+      if (m->bpred != NULL)
+         bpredStatePrintStats(m->bpred, out);
+   }
+}
+
+/**
+ * Print the models as a JSON object member, leading comma included
+ */
+void timingPrintStatsJson(FILE *out) {
+   timingModel *m;
+
+   timingDrain();
+   fprintf(out, ", \"timing\": [");
+   for (m = models; m < models + numModels; m++) {
+      fprintf(out, "%s{\"model\": \"%s\", \"spec\": \"%s\", \"penalty\": %d, "
+       "\"cycles\": %ld, \"cpi\": %.3f, \"stalls\": {\"load_use\": %ld, \"control\": %ld, "
+       "\"memory\": %ld, \"execute\": %ld}", m > models ? ", " : "", kindNames[m->kind],
+       m->spec, m->kind == TIMING_INORDER ? m->penalty : 0, m->cycles, cpi(m), m->loadUse,
+       m->control, m->memory, m->execute);
+      if (m->caches != NULL)
+         cacheHierarchyPrintStatsJson(m->caches, out);
+      if (m->bpred != NULL)
+         bpredStatePrintStatsJson(m->bpred, out);
+      fprintf(out, "}");
+   }
+   fprintf(out, "]");
+}
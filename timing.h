@@ -0,0 +1,72 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdio.h>
+#include "predecode.h"
+#include "cache.h"
+#include "bpred.h"
+
+#define TIMING_FIXED 0     // the per-instruction costs the functional engine has always charged
+#define TIMING_INORDER 1   // scalar 5-stage pipeline with forwarding
+#define TIMING_KINDS 2
+
+#define TIMING_MAX_MODELS 64
+#define TIMING_RING_RECORDS 4096   // records in flight between the core and the model threads
+#define TIMING_MISPREDICT_PENALTY 1   // the fetch slot squashed when EX redirects
+#define TIMING_PIPE_FILL 4
+
+/**
+ * One executed instruction as the functional core saw it. The functional
+ * fields are filled in as it runs; the cache penalties and the predicted
+ * next line are annotations timingConsume adds once, before any model
+ * sees the record, so every model is charged for the same misses.
+ */
+typedef struct {
+   int line;              // text line executed
+   unsigned int pc;
+   unsigned int inst;     // raw word, as traced
+   uop op;                // what it ran as; a SW may re-decode its own line
+   unsigned int addr;     // LW/SW effective address
+   int taken;             // branch or jump went somewhere other than line + 1
+   int next;              // line executed next, -1 once the program exits
+   int predicted;         // line the front end would have fetched next
+   int fetchPenalty;      // I-cache miss cycles
+   int memPenalty;        // D-cache miss cycles for a LW or SW
+} streamRecord;
+
+/**
+ * A trace-driven timing model fed from the instruction stream. Models
+ * only count cycles; none of them touch registers or memory. A model
+ * with its own caches or predictor re-annotates each record from them
+ * instead of using the shared annotations.
+ */
+typedef struct {
+   int kind;
+   char *spec;            // as given on the command line, names the model in the stats
+   cacheHierarchy *caches;
+   bpredState *bpred;
+   int penalty;           // inorder: cycles lost to a mispredicted transfer
+   int loadDest;          // inorder: register the previous LW wrote, -1 for none
+   long cycles;
+   long instructions;
+   long loadUse;          // stall cycles by cause
+   long control;
+   long memory;
+   long execute;
+} timingModel;
+
+extern int timingEnabled;
+
+int timingInit(const char *spec, int memLatency);
+
+void timingFree(void);
+
+long timingConsume(streamRecord *r);
+
+void timingAnnotate(streamRecord *r);
+
+void timingPrintStats(FILE *out);
+
+void timingPrintStatsJson(FILE *out);
+
+#endif
@@ -0,0 +1,87 @@
+#include <stdlib.h>
+#include "trace.h"
+
+int traceEnabled = 0;
+traceSink traceOut;
+
+static void writeHeader(unsigned int count) {
+   traceHeader hdr;
+
+   hdr.magic = TRACE_MAGIC;
+   hdr.version = TRACE_VERSION;
+   hdr.recordSize = sizeof(traceRecord);
+   hdr.count = count;
+   fwrite(&hdr, sizeof(hdr), 1, traceOut.out);
+}
+
+/**
+ * Open a binary trace file. With ringRecords > 0 only the last ringRecords
+ * instructions are kept in memory and written out on close, otherwise every
+ * record goes to the file through a large buffer.
+ */
+int traceOpen(const char *path, long ringRecords) {
+   traceOut.out = fopen(path, "wb");
+   if (traceOut.out == NULL)
+      return -1;
+
+   traceOut.ring = ringRecords > 0;
+   traceOut.capacity = traceOut.ring ? ringRecords : TRACE_BUFFER_RECORDS;
+   traceOut.buf = malloc(traceOut.capacity * sizeof(traceRecord));
+   if (traceOut.buf == NULL) {
+      fclose(traceOut.out);
+      return -1;
+   }
+   traceOut.used = 0;
+   traceOut.written = 0;
+   traceOut.wrapped = 0;
+
+   writeHeader(0);
+   traceEnabled = 1;
+
+   return 0;
+}
+
+void traceFlush(void) {
+   fwrite(traceOut.buf, sizeof(traceRecord), traceOut.used, traceOut.out);
+   traceOut.written += traceOut.used;
+   traceOut.used = 0;
+}
+
+/**
+ * Write out whatever is buffered (oldest first for a ring) and patch the
+ * record count into the header
+ */
+void traceClose(void) {
+   long oldest;
+
+   if (!traceEnabled)
+      return;
+
+   if (traceOut.ring && traceOut.wrapped) {
+      oldest = traceOut.used;
+      fwrite(traceOut.buf + oldest, sizeof(traceRecord), traceOut.capacity - oldest,
+       traceOut.out);
+      traceOut.written += traceOut.capacity - oldest;
+   }
+   traceFlush();
+
+   if (fseek(traceOut.out, 0, SEEK_SET) == 0)
+      writeHeader((unsigned int) traceOut.written);
+
+   fclose(traceOut.out);
+   free(traceOut.buf);
+   traceEnabled = 0;
+}
+
+/**
+ * Read and check a trace header, returns 0 when it is a trace we understand
+ */
+int traceReadHeader(FILE *in, traceHeader *hdr) {
+   if (fread(hdr, sizeof(*hdr), 1, in) != 1)
+      return -1;
+   if (hdr->magic != TRACE_MAGIC || hdr->version != TRACE_VERSION
+    || hdr->recordSize != sizeof(traceRecord))
+      return -1;
+
+   return 0;
+}
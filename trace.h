@@ -0,0 +1,65 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+
+#define TRACE_MAGIC 0x4352544D  // "MTRC" read as little endian
+#define TRACE_VERSION 1
+#define TRACE_BUFFER_RECORDS (1 << 16)
+
+/**
+ * Binary trace layout: one traceHeader followed by traceRecords. count is
+ * filled in when the trace is closed; 0 means read to end of file.
+ */
+typedef struct {
+   unsigned int magic;
+   unsigned int version;
+   unsigned int recordSize;
+   unsigned int count;
+} traceHeader;
+
+typedef struct {
+   unsigned int pc;
+   unsigned int inst;
+} traceRecord;
+
+typedef struct {
+   FILE *out;
+   traceRecord *buf;
+   long capacity;
+   long used;      // next free slot in buf
+   long written;   // records already flushed to out
+   int ring;       // keep only the last capacity records in memory
+   int wrapped;
+} traceSink;
+
+extern int traceEnabled;
+extern traceSink traceOut;
+
+int traceOpen(const char *path, long ringRecords);
+
+void traceFlush(void);
+
+void traceClose(void);
+
+int traceReadHeader(FILE *in, traceHeader *hdr);
+
+/**
+ * Append one record. Callers check traceEnabled first so the untraced hot
+ * loop pays for a single predictable branch.
+ */
+static inline void traceInst(unsigned int pc, unsigned int inst) {
+   if (traceOut.used == traceOut.capacity) {
+      if (traceOut.ring) {
+         traceOut.used = 0;
+         traceOut.wrapped = 1;
+      } else {
+         traceFlush();
+      }
+   }
+   traceOut.buf[traceOut.used].pc = pc;
+   traceOut.buf[traceOut.used].inst = inst;
+   traceOut.used++;
+}
+
+#endif
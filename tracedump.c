@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <string.h>
+#include "trace.h"
+
+#define DUMP_CHUNK 4096
+
+/**
+ * Offline decoder for simulator traces written with --trace. Prints one
+ * "pc: instruction" line per record, or with -i just the instruction words
+ * the simulator used to echo.
+ */
+int main(int argc, char **argv) {
+   FILE *in;
+   traceHeader hdr;
+   traceRecord recs[DUMP_CHUNK];
+   size_t got, i;
+   unsigned long total = 0;
+   int instOnly = 0, arg = 1;
+
+   if (argc > 1 && !strcmp(argv[1], "-i")) {
+      instOnly = 1;
+      arg++;
+   }
+   if (arg >= argc) {
+      fprintf(stderr, "usage: %s [-i] trace.bin\n", argv[0]);
+      return 1;
+   }
+
+   in = fopen(argv[arg], "rb");
+   if (in == NULL) {
+      perror(argv[arg]);
+      return 1;
+   }
+   if (traceReadHeader(in, &hdr) != 0) {
+      fprintf(stderr, "%s: not a simulator trace\n", argv[arg]);
+      fclose(in);
+      return 1;
+   }
+
+   while ((got = fread(recs, sizeof(traceRecord), DUMP_CHUNK, in)) > 0) {
+      for (i = 0; i < got; i++) {
+         if (instOnly)
+            printf("%08X\n", recs[i].inst);
+         else
+            printf("%08X: %08X\n", recs[i].pc, recs[i].inst);
+      }
+      total += got;
+   }
+
+   if (hdr.count != 0 && hdr.count != total)
+      fprintf(stderr, "warning: header says %u records, read %lu\n", hdr.count, total);
+
+   fclose(in);
+   return 0;
+}